@@ -1,5 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// 行列のメモリ確保 (rows x cols)
+// 全要素を64バイト境界から始まる1つの連続領域に置き, 行の長さを16要素 (64バイト) の倍数に切り上げる
+int **imatrix(int rows, int cols) {
+    size_t ld = ((size_t)cols + 15) & ~(size_t)15;
+    int *base;
+    int **M = (int**)malloc(rows * sizeof(int*));
+    if (M == NULL || posix_memalign((void**)&base, 64, rows * ld * sizeof(int)) != 0) {
+        printf("メモリの確保に失敗しました。\n");
+        exit(1);
+    }
+    memset(base, 0, rows * ld * sizeof(int));
+    for (int i = 0; i < rows; i++) {
+        M[i] = base + i * ld;
+    }
+    return M;
+}
+
+// 行列のメモリ解放
+void free_imatrix(int **M) {
+    free(M[0]);
+    free(M);
+}
 
 int main() {
     int n;
@@ -8,10 +32,7 @@ int main() {
     scanf("%d", &n);
     
     // 行列 A のメモリ確保
-    int **A = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        A[i] = (int*)malloc(n * sizeof(int));
-    }
+    int **A = imatrix(n, n);
     
     // ベクトル a と結果ベクトルのメモリ確保
     int *a = (int*)malloc(n * sizeof(int));
@@ -49,10 +70,7 @@ int main() {
     }
     
     // メモリの解放
-    for (int i = 0; i < n; i++) {
-        free(A[i]);
-    }
-    free(A);
+    free_imatrix(A);
     free(a);
     free(result);
     
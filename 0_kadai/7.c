@@ -1,5 +1,157 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// 行列のメモリ確保 (rows x cols)
+// 全要素を64バイト境界から始まる1つの連続領域に置き, 行の長さを16要素 (64バイト) の倍数に切り上げる
+size_t imatrix_ld(int cols) {
+    return ((size_t)cols + 15) & ~(size_t)15;
+}
+
+int **imatrix(int rows, int cols) {
+    size_t ld = imatrix_ld(cols);
+    int *base;
+    int **M = (int**)malloc(rows * sizeof(int*));
+    if (M == NULL || posix_memalign((void**)&base, 64, rows * ld * sizeof(int)) != 0) {
+        printf("メモリの確保に失敗しました。\n");
+        exit(1);
+    }
+    memset(base, 0, rows * ld * sizeof(int));
+    for (int i = 0; i < rows; i++) {
+        M[i] = base + i * ld;
+    }
+    return M;
+}
+
+// 行列のメモリ解放
+void free_imatrix(int **M) {
+    free(M[0]);
+    free(M);
+}
+
+// 行列積 C = A B (A: m x k, B: k x n, いずれも行優先で行の間隔は lda, ldb, ldc)
+// B を KC x NC, A を MC x KC のブロックに切り出して連続領域にパックし (それぞれ L3, L2 に載る大きさ),
+// MR x NR のマイクロカーネルで C の小行列をレジスタに置いたまま k 方向に足し込む.
+// MC 方向のブロック (マクロタイル) をスレッド並列に処理する.
+// 要素型ごとに GEMM_DEFINE(型, 名前) で作る (この課題は int なので gemm_i32 だけ)
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MR 4   // マイクロカーネルは4行固定
+#define GEMM_NR 8
+
+#define GEMM_DEFINE(T, NAME)                                                            \
+/* NR 要素を1つのベクトルとして扱う (GCC のベクトル拡張, 使える SIMD 命令に展開される) */   \
+typedef T NAME##_vec __attribute__((vector_size(GEMM_NR * sizeof(T))));                \
+                                                                                        \
+/* MR = 4 行分のアキュムレータをレジスタに置く */                                        \
+static void NAME##_kernel(int kc, const T *restrict a, const T *restrict b,            \
+                          T *restrict c, size_t ldc, int mr, int nr)                   \
+{                                                                                       \
+    NAME##_vec acc[GEMM_MR], c0, c1, c2, c3, bv;                                        \
+    T out[GEMM_NR];                                                                     \
+    int p, r, s;                                                                        \
+                                                                                        \
+    memset(&c0, 0, sizeof(c0));                                                         \
+    c1 = c2 = c3 = c0;                                                                  \
+    for (p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR) {                              \
+        memcpy(&bv, b, sizeof(bv));                                                     \
+        c0 += a[0] * bv;                                                                \
+        c1 += a[1] * bv;                                                                \
+        c2 += a[2] * bv;                                                                \
+        c3 += a[3] * bv;                                                                \
+    }                                                                                   \
+    acc[0] = c0;                                                                        \
+    acc[1] = c1;                                                                        \
+    acc[2] = c2;                                                                        \
+    acc[3] = c3;                                                                        \
+    for (r = 0; r < mr; r++) {                                                          \
+        memcpy(out, &acc[r], sizeof(out));                                              \
+        for (s = 0; s < nr; s++) {                                                      \
+            c[r * ldc + s] += out[s];                                                   \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* A の mc x kc ブロックを MR 行ずつの帯に分け, 帯の中は列順に並べる (端は 0 で埋める) */   \
+static void NAME##_pack_a(int mc, int kc, const T *a, size_t lda, T *ap)               \
+{                                                                                       \
+    int i, p, r;                                                                        \
+                                                                                        \
+    for (i = 0; i < mc; i += GEMM_MR) {                                                 \
+        for (p = 0; p < kc; p++) {                                                      \
+            for (r = 0; r < GEMM_MR; r++) {                                             \
+                *ap++ = (i + r < mc) ? a[(size_t)(i + r) * lda + p] : 0;                \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* B の kc x nc ブロックを NR 列ずつの帯に分け, 帯の中は行順に並べる (端は 0 で埋める) */   \
+static void NAME##_pack_b(int kc, int nc, const T *b, size_t ldb, T *bp)               \
+{                                                                                       \
+    int p, s;                                                                           \
+                                                                                        \
+    for (p = 0; p < kc; p++) {                                                          \
+        for (s = 0; s < GEMM_NR; s++) {                                                 \
+            bp[p * GEMM_NR + s] = (s < nc) ? b[(size_t)p * ldb + s] : 0;                \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+void NAME(int m, int n, int k, const T *a, size_t lda, const T *b, size_t ldb,         \
+          T *c, size_t ldc)                                                             \
+{                                                                                       \
+    int i, jc, pc, nc, kc;                                                              \
+    T *bp;                                                                              \
+                                                                                        \
+    for (i = 0; i < m; i++) {                                                           \
+        memset(c + (size_t)i * ldc, 0, n * sizeof(T));                                  \
+    }                                                                                   \
+    if (posix_memalign((void **)&bp, 64, sizeof(T) * GEMM_KC * (GEMM_NC + GEMM_NR)) != 0) { \
+        printf("メモリの確保に失敗しました。\n");                                       \
+        exit(1);                                                                        \
+    }                                                                                   \
+                                                                                        \
+    for (jc = 0; jc < n; jc += GEMM_NC) {                                               \
+        nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;                                     \
+        for (pc = 0; pc < k; pc += GEMM_KC) {                                           \
+            kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;                                 \
+            _Pragma("omp parallel")                                                     \
+            {                                                                           \
+                T *ap;                                                                  \
+                int ic, ir, jr, mc;                                                     \
+                                                                                        \
+                _Pragma("omp for schedule(static)")                                     \
+                for (jr = 0; jr < nc; jr += GEMM_NR) {                                  \
+                    NAME##_pack_b(kc, nc - jr, b + (size_t)pc * ldb + jc + jr, ldb,     \
+                                  bp + (size_t)jr * kc);                                \
+                }                                                                       \
+                if (posix_memalign((void **)&ap, 64, sizeof(T) * GEMM_KC * (GEMM_MC + GEMM_MR)) != 0) { \
+                    printf("メモリの確保に失敗しました。\n");                           \
+                    exit(1);                                                            \
+                }                                                                       \
+                _Pragma("omp for schedule(dynamic)")                                    \
+                for (ic = 0; ic < m; ic += GEMM_MC) {                                   \
+                    mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;                         \
+                    NAME##_pack_a(mc, kc, a + (size_t)ic * lda + pc, lda, ap);          \
+                    for (jr = 0; jr < nc; jr += GEMM_NR) {                              \
+                        for (ir = 0; ir < mc; ir += GEMM_MR) {                          \
+                            NAME##_kernel(kc, ap + (size_t)ir * kc, bp + (size_t)jr * kc, \
+                                          c + (size_t)(ic + ir) * ldc + jc + jr, ldc,   \
+                                          (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR,      \
+                                          (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR);     \
+                        }                                                               \
+                    }                                                                   \
+                }                                                                       \
+                free(ap);                                                               \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+    free(bp);                                                                           \
+}
+
+GEMM_DEFINE(int, gemm_i32)
 
 int main() {
     int n, m;
@@ -11,22 +163,13 @@ int main() {
     scanf("%d", &m);
     
     // 行列 A のメモリ確保 (n x n)
-    int **A = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        A[i] = (int*)malloc(n * sizeof(int));
-    }
+    int **A = imatrix(n, n);
     
     // 行列 B のメモリ確保 (n x m)
-    int **B = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        B[i] = (int*)malloc(m * sizeof(int));
-    }
+    int **B = imatrix(n, m);
     
     // 結果行列 AB のメモリ確保 (n x m)
-    int **AB = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        AB[i] = (int*)malloc(m * sizeof(int));
-    }
+    int **AB = imatrix(n, m);
     
     // 行列 A の入力
     printf("行列 A の要素を入力してください（%d x %d）:\n", n, n);
@@ -46,15 +189,8 @@ int main() {
         }
     }
     
-    // AB の計算（行列積）
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < m; j++) {
-            AB[i][j] = 0;
-            for (int k = 0; k < n; k++) {
-                AB[i][j] += A[i][k] * B[k][j];
-            }
-        }
-    }
+    // AB の計算（ブロック化した行列積）
+    gemm_i32(n, m, n, A[0], imatrix_ld(n), B[0], imatrix_ld(m), AB[0], imatrix_ld(m));
     
     // 結果の表示
     printf("AB の結果:\n");
@@ -66,15 +202,9 @@ int main() {
     }
     
     // メモリの解放
-    for (int i = 0; i < n; i++) {
-        free(A[i]);
-        free(B[i]);
-        free(AB[i]);
-    }
-    
-    free(A);
-    free(B);
-    free(AB);
+    free_imatrix(A);
+    free_imatrix(B);
+    free_imatrix(AB);
     
     return 0;
 }
\ No newline at end of file
@@ -1,5 +1,302 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// 行列のメモリ確保 (rows x cols)
+// 全要素を64バイト境界から始まる1つの連続領域に置き, 行の長さを16要素 (64バイト) の倍数に切り上げる
+size_t imatrix_ld(int cols) {
+    return ((size_t)cols + 15) & ~(size_t)15;
+}
+
+int **imatrix(int rows, int cols) {
+    size_t ld = imatrix_ld(cols);
+    int *base;
+    int **M = (int**)malloc(rows * sizeof(int*));
+    if (M == NULL || posix_memalign((void**)&base, 64, rows * ld * sizeof(int)) != 0) {
+        printf("メモリの確保に失敗しました。\n");
+        exit(1);
+    }
+    memset(base, 0, rows * ld * sizeof(int));
+    for (int i = 0; i < rows; i++) {
+        M[i] = base + i * ld;
+    }
+    return M;
+}
+
+// 行列のメモリ解放
+void free_imatrix(int **M) {
+    free(M[0]);
+    free(M);
+}
+
+// 行列積 C = A B (A: m x k, B: k x n, いずれも行優先で行の間隔は lda, ldb, ldc)
+// B を KC x NC, A を MC x KC のブロックに切り出して連続領域にパックし (それぞれ L3, L2 に載る大きさ),
+// MR x NR のマイクロカーネルで C の小行列をレジスタに置いたまま k 方向に足し込む.
+// MC 方向のブロック (マクロタイル) をスレッド並列に処理する.
+// 要素型ごとに GEMM_DEFINE(型, 名前) で作る (この課題は int なので gemm_i32 だけ)
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MR 4   // マイクロカーネルは4行固定
+#define GEMM_NR 8
+
+#define GEMM_DEFINE(T, NAME)                                                            \
+/* NR 要素を1つのベクトルとして扱う (GCC のベクトル拡張, 使える SIMD 命令に展開される) */   \
+typedef T NAME##_vec __attribute__((vector_size(GEMM_NR * sizeof(T))));                \
+                                                                                        \
+/* MR = 4 行分のアキュムレータをレジスタに置く */                                        \
+static void NAME##_kernel(int kc, const T *restrict a, const T *restrict b,            \
+                          T *restrict c, size_t ldc, int mr, int nr)                   \
+{                                                                                       \
+    NAME##_vec acc[GEMM_MR], c0, c1, c2, c3, bv;                                        \
+    T out[GEMM_NR];                                                                     \
+    int p, r, s;                                                                        \
+                                                                                        \
+    memset(&c0, 0, sizeof(c0));                                                         \
+    c1 = c2 = c3 = c0;                                                                  \
+    for (p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR) {                              \
+        memcpy(&bv, b, sizeof(bv));                                                     \
+        c0 += a[0] * bv;                                                                \
+        c1 += a[1] * bv;                                                                \
+        c2 += a[2] * bv;                                                                \
+        c3 += a[3] * bv;                                                                \
+    }                                                                                   \
+    acc[0] = c0;                                                                        \
+    acc[1] = c1;                                                                        \
+    acc[2] = c2;                                                                        \
+    acc[3] = c3;                                                                        \
+    for (r = 0; r < mr; r++) {                                                          \
+        memcpy(out, &acc[r], sizeof(out));                                              \
+        for (s = 0; s < nr; s++) {                                                      \
+            c[r * ldc + s] += out[s];                                                   \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* A の mc x kc ブロックを MR 行ずつの帯に分け, 帯の中は列順に並べる (端は 0 で埋める) */   \
+static void NAME##_pack_a(int mc, int kc, const T *a, size_t lda, T *ap)               \
+{                                                                                       \
+    int i, p, r;                                                                        \
+                                                                                        \
+    for (i = 0; i < mc; i += GEMM_MR) {                                                 \
+        for (p = 0; p < kc; p++) {                                                      \
+            for (r = 0; r < GEMM_MR; r++) {                                             \
+                *ap++ = (i + r < mc) ? a[(size_t)(i + r) * lda + p] : 0;                \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* B の kc x nc ブロックを NR 列ずつの帯に分け, 帯の中は行順に並べる (端は 0 で埋める) */   \
+static void NAME##_pack_b(int kc, int nc, const T *b, size_t ldb, T *bp)               \
+{                                                                                       \
+    int p, s;                                                                           \
+                                                                                        \
+    for (p = 0; p < kc; p++) {                                                          \
+        for (s = 0; s < GEMM_NR; s++) {                                                 \
+            bp[p * GEMM_NR + s] = (s < nc) ? b[(size_t)p * ldb + s] : 0;                \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+void NAME(int m, int n, int k, const T *a, size_t lda, const T *b, size_t ldb,         \
+          T *c, size_t ldc)                                                             \
+{                                                                                       \
+    int i, jc, pc, nc, kc;                                                              \
+    T *bp;                                                                              \
+                                                                                        \
+    for (i = 0; i < m; i++) {                                                           \
+        memset(c + (size_t)i * ldc, 0, n * sizeof(T));                                  \
+    }                                                                                   \
+    if (posix_memalign((void **)&bp, 64, sizeof(T) * GEMM_KC * (GEMM_NC + GEMM_NR)) != 0) { \
+        printf("メモリの確保に失敗しました。\n");                                       \
+        exit(1);                                                                        \
+    }                                                                                   \
+                                                                                        \
+    for (jc = 0; jc < n; jc += GEMM_NC) {                                               \
+        nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;                                     \
+        for (pc = 0; pc < k; pc += GEMM_KC) {                                           \
+            kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;                                 \
+            _Pragma("omp parallel")                                                     \
+            {                                                                           \
+                T *ap;                                                                  \
+                int ic, ir, jr, mc;                                                     \
+                                                                                        \
+                _Pragma("omp for schedule(static)")                                     \
+                for (jr = 0; jr < nc; jr += GEMM_NR) {                                  \
+                    NAME##_pack_b(kc, nc - jr, b + (size_t)pc * ldb + jc + jr, ldb,     \
+                                  bp + (size_t)jr * kc);                                \
+                }                                                                       \
+                if (posix_memalign((void **)&ap, 64, sizeof(T) * GEMM_KC * (GEMM_MC + GEMM_MR)) != 0) { \
+                    printf("メモリの確保に失敗しました。\n");                           \
+                    exit(1);                                                            \
+                }                                                                       \
+                _Pragma("omp for schedule(dynamic)")                                    \
+                for (ic = 0; ic < m; ic += GEMM_MC) {                                   \
+                    mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;                         \
+                    NAME##_pack_a(mc, kc, a + (size_t)ic * lda + pc, lda, ap);          \
+                    for (jr = 0; jr < nc; jr += GEMM_NR) {                              \
+                        for (ir = 0; ir < mc; ir += GEMM_MR) {                          \
+                            NAME##_kernel(kc, ap + (size_t)ir * kc, bp + (size_t)jr * kc, \
+                                          c + (size_t)(ic + ir) * ldc + jc + jr, ldc,   \
+                                          (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR,      \
+                                          (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR);     \
+                        }                                                               \
+                    }                                                                   \
+                }                                                                       \
+                free(ap);                                                               \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+    free(bp);                                                                           \
+}
+
+GEMM_DEFINE(int, gemm_i32)
+
+// 行列積の連鎖 X_0 X_1 ... X_{k-1} の計算
+// 各項はコピーを持たないビュー (行方向・列方向の間隔 rs, cs) で, 転置は間隔を入れ替えるだけで表す.
+// 掛ける順序は動的計画法で乗算回数が最小になるものを選び, 中間結果は内側の積の分だけ確保する.
+typedef struct {
+    const int *p;
+    int rows, cols;
+    size_t rs, cs;
+} IMat;
+
+// imatrix で確保した行列のビュー
+IMat imat_view(int **M, int rows, int cols) {
+    IMat X = { M[0], rows, cols, imatrix_ld(cols), 1 };
+    return X;
+}
+
+// 列ベクトル (n x 1) のビュー
+IMat imat_vec(const int *v, int n) {
+    IMat X = { v, n, 1, 1, 1 };
+    return X;
+}
+
+// 転置 (データは動かさない)
+IMat imat_t(IMat X) {
+    IMat T = { X.p, X.cols, X.rows, X.cs, X.rs };
+    return T;
+}
+
+// C = X Y (C は行優先で行の間隔 ldc)
+// どちらも行方向に連続していてマイクロカーネル1枚分以上の大きさがあれば gemm_i32 を使い,
+// それ以外 (転置ビュー, ベクトル) は間隔付きのループで直接読む
+void imat_mul(IMat X, IMat Y, int *C, size_t ldc) {
+    if (X.cs == 1 && Y.cs == 1 && X.rows >= GEMM_MR && Y.cols >= GEMM_NR) {
+        gemm_i32(X.rows, Y.cols, X.cols, X.p, X.rs, Y.p, Y.rs, C, ldc);
+        return;
+    }
+    for (int i = 0; i < X.rows; i++) {
+        int *c = C + (size_t)i * ldc;
+        memset(c, 0, Y.cols * sizeof(int));
+        for (int p = 0; p < X.cols; p++) {
+            int x = X.p[i * X.rs + p * X.cs];
+            const int *y = Y.p + p * Y.rs;
+            if (x == 0) continue;
+            for (int j = 0; j < Y.cols; j++) {
+                c[j] += x * y[j * Y.cs];
+            }
+        }
+    }
+}
+
+// X[i..j] の積を out に求める (分割位置は split[i][j])
+static void chain_eval(IMat *X, int **split, int i, int j, int *out, size_t ldo) {
+    IMat L, R;
+    int *lbuf = NULL, *rbuf = NULL;
+    int s = split[i][j];
+
+    if (s == i) {
+        L = X[i];
+    } else {
+        L.rows = X[i].rows;
+        L.cols = X[s].cols;
+        L.rs = imatrix_ld(L.cols);
+        L.cs = 1;
+        if (posix_memalign((void**)&lbuf, 64, L.rows * L.rs * sizeof(int)) != 0) {
+            printf("メモリの確保に失敗しました。\n");
+            exit(1);
+        }
+        chain_eval(X, split, i, s, lbuf, L.rs);
+        L.p = lbuf;
+    }
+    if (s + 1 == j) {
+        R = X[j];
+    } else {
+        R.rows = X[s + 1].rows;
+        R.cols = X[j].cols;
+        R.rs = imatrix_ld(R.cols);
+        R.cs = 1;
+        if (posix_memalign((void**)&rbuf, 64, R.rows * R.rs * sizeof(int)) != 0) {
+            printf("メモリの確保に失敗しました。\n");
+            exit(1);
+        }
+        chain_eval(X, split, s + 1, j, rbuf, R.rs);
+        R.p = rbuf;
+    }
+    imat_mul(L, R, out, ldo);
+    free(lbuf);
+    free(rbuf);
+}
+
+// X[0] X[1] ... X[k-1] を out (X[0].rows x X[k-1].cols, 行の間隔 ldo) に求める
+void chain_product(int k, IMat *X, int *out, size_t ldo) {
+    double **cost = (double**)malloc(k * sizeof(double*));
+    int **split = (int**)malloc(k * sizeof(int*));
+
+    if (cost == NULL || split == NULL) {
+        printf("メモリの確保に失敗しました。\n");
+        exit(1);
+    }
+    for (int i = 0; i < k; i++) {
+        cost[i] = (double*)calloc(k, sizeof(double));
+        split[i] = (int*)calloc(k, sizeof(int));
+        if (cost[i] == NULL || split[i] == NULL) {
+            printf("メモリの確保に失敗しました。\n");
+            exit(1);
+        }
+        if (i > 0 && X[i - 1].cols != X[i].rows) {
+            printf("行列のサイズが合いません (%d 番目: %d x %d, %d 番目: %d x %d)\n",
+                   i, X[i - 1].rows, X[i - 1].cols, i + 1, X[i].rows, X[i].cols);
+            exit(1);
+        }
+    }
+
+    // cost[i][j]: X[i..j] の積に必要な乗算回数の最小値
+    for (int len = 1; len < k; len++) {
+        for (int i = 0; i + len < k; i++) {
+            int j = i + len;
+            cost[i][j] = -1.0;
+            for (int s = i; s < j; s++) {
+                double c = cost[i][s] + cost[s + 1][j]
+                         + (double)X[i].rows * X[s].cols * X[j].cols;
+                if (cost[i][j] < 0.0 || c < cost[i][j]) {
+                    cost[i][j] = c;
+                    split[i][j] = s;
+                }
+            }
+        }
+    }
+
+    if (k == 1) {
+        for (int i = 0; i < X[0].rows; i++) {
+            for (int j = 0; j < X[0].cols; j++) {
+                out[i * ldo + j] = X[0].p[i * X[0].rs + j * X[0].cs];
+            }
+        }
+    } else {
+        chain_eval(X, split, 0, k - 1, out, ldo);
+    }
+
+    for (int i = 0; i < k; i++) {
+        free(cost[i]);
+        free(split[i]);
+    }
+    free(cost);
+    free(split);
+}
 
 int main() {
     int n, m;
@@ -14,28 +311,16 @@ int main() {
     int *a = (int*)malloc(n * sizeof(int));
     
     // 行列 A のメモリ確保 (n x n)
-    int **A = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        A[i] = (int*)malloc(n * sizeof(int));
-    }
+    int **A = imatrix(n, n);
     
     // 行列 B のメモリ確保 (n x m)
-    int **B = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        B[i] = (int*)malloc(m * sizeof(int));
-    }
-    
-    // 中間結果 AB のメモリ確保 (n x m)
-    int **AB = (int**)malloc(n * sizeof(int*));
-    for (int i = 0; i < n; i++) {
-        AB[i] = (int*)malloc(m * sizeof(int));
-    }
+    int **B = imatrix(n, m);
     
     // 最終結果 a^T AB のメモリ確保 (1 x m)
     int *result = (int*)malloc(m * sizeof(int));
     
     // メモリ確保の確認
-    if (a == NULL || A == NULL || B == NULL || AB == NULL || result == NULL) {
+    if (a == NULL || A == NULL || B == NULL || result == NULL) {
         printf("メモリの確保に失敗しました。\n");
         return 1;
     }
@@ -65,21 +350,9 @@ int main() {
         }
     }
     
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < m; j++) {
-            AB[i][j] = 0.0;
-            for (int k = 0; k < n; k++) {
-                AB[i][j] += A[i][k] * B[k][j];
-            }
-        }
-    }
-    
-    for (int j = 0; j < m; j++) {
-        result[j] = 0.0;
-        for (int i = 0; i < n; i++) {
-            result[j] += a[i] * AB[i][j];
-        }
-    }
+    // a^T A B の計算（乗算回数が最小になる順序を選ぶ: 通常は (a^T A) B で AB は作らない）
+    IMat chain[3] = { imat_t(imat_vec(a, n)), imat_view(A, n, n), imat_view(B, n, m) };
+    chain_product(3, chain, result, m);
     
     // 結果の表示
     printf("a^T AB の結果:\n");
@@ -92,14 +365,8 @@ int main() {
     
     // メモリの解放
     free(a);
-    for (int i = 0; i < n; i++) {
-        free(A[i]);
-        free(B[i]);
-        free(AB[i]);
-    }
-    free(A);
-    free(B);
-    free(AB);
+    free_imatrix(A);
+    free_imatrix(B);
     free(result);
     
     return 0;
@@ -1,107 +1,574 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
+// バイナリ行列ファイル (CRMAT, matconv で作成) のヘッダ: 64バイト
+#define CRMAT_MAGIC "CRMAT01"
+enum { CRMAT_DENSE = 0, CRMAT_UPPER = 1, CRMAT_BAND = 2, CRMAT_VECTOR = 3 };
+typedef struct {
+    char magic[8];
+    int32_t kind;         // 格納形式
+    int32_t symmetric;    // 1: 対称行列
+    int64_t rows;
+    int64_t cols;
+    int64_t bandwidth;    // 上側バンド幅 (対角を含む)
+    int64_t data_offset;  // データの開始位置
+    int64_t reserved[2];
+} CrmatHeader;
 
-int Size_count(char *vector_file) // mainからの呼び出しと printf 文から引数を推定
-{
-    FILE *fp;
-    char c;
-    int N = 0;
+// テキスト行列の並列パーサ
+// ファイルを改行位置で区切ったチャンクに分け, 各スレッドが1回の走査で数値・行数・列数を求める
+typedef struct {
+    double *val;     // 値 (行優先, rows x cols)
+    int rows;        // 空でない行の数
+    int cols;        // 1行あたりの値の数
+    int symmetric;   // 1: 正方かつ対称
+    int bandwidth;   // 上側バンド幅 (対角を含む)
+} TextMatrix;
+
+typedef struct {
+    const char *begin, *end;
+    const char *bad;   // 数値として読めなかった位置
+    double *val;
+    size_t count, cap;
+    int lines;
+    int first_cols;    // チャンク内の最初の行の値の数
+    int ragged;        // 値の数が違う行があった
+} TextChunk;
+
+static const double pow10_table[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// from_chars 相当の double 変換: 仮数が 2^53 以下かつ指数が ±22 以内なら正確に計算し,
+// それ以外 (桁数が多い, inf/nan など) は strtod に任せる. 読めなければ NULL を返す
+const char *Parse_double(const char *p, const char *end, double *out) {
+    const char *s = p, *q;
+    uint64_t m = 0;
+    int neg = 0, nd = 0, exp10 = 0, ex = 0, eneg = 0, digits = 0, exact = 1;
+    char buf[128];
+    char *e;
+    size_t len;
 
-    printf("Vectror file: %s\n", vector_file); 
-    fp = fopen(vector_file, "r"); 
-    if (fp == NULL) { 
-        printf("Vectror file not found!!\n"); 
-        exit(1); 
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (nd < 19) {
+            m = m * 10 + (*p - '0');
+            if (m != 0) nd++;
+        } else {
+            exp10++;
+            exact = 0;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (nd < 19) {
+                m = m * 10 + (*p - '0');
+                if (m != 0) nd++;
+                exp10--;
+            } else {
+                exact = 0;
+            }
+        }
     }
-    
-    // fgetcで一文字ずつ読み込む-ファイル終端（EOF）まで繰り返し
-    while ((c = fgetc(fp)) != EOF) { 
-        if (c == '\n') { 
-            N++; 
+    if (digits > 0 && p < end && (*p == 'e' || *p == 'E')) {
+        q = p + 1;
+        if (q < end && (*q == '-' || *q == '+')) {
+            eneg = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            for (p = q; p < end && *p >= '0' && *p <= '9'; p++) {
+                if (ex < 100000) ex = ex * 10 + (*p - '0');
+            }
+            exp10 += eneg ? -ex : ex;
         }
     }
-    fclose(fp); 
-    return N;  
+
+    if (digits > 0 && exact && m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22
+        && (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        *out = (exp10 < 0) ? (double)m / pow10_table[-exp10] : (double)m * pow10_table[exp10];
+        if (neg) *out = -*out;
+        return p;
+    }
+
+    // 低速経路: 空白までを切り出して strtod で変換する
+    for (q = s; q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n'; q++)
+        ;
+    len = (size_t)(q - s) < sizeof(buf) - 1 ? (size_t)(q - s) : sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *out = strtod(buf, &e);
+    if (e != buf + len) return NULL;
+    return q;
 }
 
+void Parse_chunk(TextChunk *c) {
+    const char *p = c->begin, *q;
+    int in_row = 0;
 
-// 行列A、ベクトルb、ベクトルcのメモリを確保する関数
-void Memory_allocate(int N, double ***A, double **b, double **c) 
-{
-    int i; 
+    c->first_cols = -1;
+    c->cap = (size_t)(c->end - c->begin) / 8 + 16;
+    if ((c->val = (double *)malloc(c->cap * sizeof(double))) == NULL) {
+        c->bad = p;
+        return;
+    }
 
-    *A = (double **)malloc(N * sizeof(double *)); 
-    if (*A == NULL) { 
-        printf("No memories are available (A)\n"); 
-        exit(1); 
+    for (;;) {
+        if (p == c->end || *p == '\n') {
+            // 空行は数えない (count_matrix_size と同じ扱い)
+            if (in_row > 0) {
+                if (c->first_cols < 0) c->first_cols = in_row;
+                else if (in_row != c->first_cols) c->ragged = 1;
+                c->lines++;
+            }
+            if (p == c->end) break;
+            in_row = 0;
+            p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+        if (c->count == c->cap) {
+            c->cap *= 2;
+            if ((c->val = (double *)realloc(c->val, c->cap * sizeof(double))) == NULL) {
+                c->bad = p;
+                return;
+            }
+        }
+        if ((q = Parse_double(p, c->end, &c->val[c->count])) == NULL) {
+            c->bad = p;
+            return;
+        }
+        c->count++;
+        in_row++;
+        p = q;
+    }
+}
+
+// ファイルを1回だけ読み, 値・サイズ・対称性・バンド幅をまとめて求める
+void Text_parse(char *filename, TextMatrix *t) {
+    int fd, nchunk, k, i, j, square, sym, bw;
+    struct stat st;
+    char *base;
+    const char *p;
+    size_t len, total, *offset;
+    TextChunk *chunk;
+
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        printf("Cannot open file %s\n", filename);
+        exit(1);
+    }
+    len = st.st_size;
+    if (len == 0) {
+        printf("File %s is empty\n", filename);
+        exit(1);
+    }
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("mmap failed for %s\n", filename);
+        exit(1);
     }
-    for (i = 0; i < N; i++) { 
-        (*A)[i] = (double *)malloc(N * sizeof(double)); 
-        if ((*A)[i] == NULL) { 
-            printf("No memories are available (A[%d])\n", i); 
-            exit(1); 
+    madvise(base, len, MADV_WILLNEED);
+
+    // スレッド数の4倍に分割 (1チャンク 1MB 以上)
+#ifdef _OPENMP
+    nchunk = omp_get_max_threads() * 4;
+#else
+    nchunk = 1;
+#endif
+    if ((size_t)nchunk > len / (1 << 20)) nchunk = (int)(len / (1 << 20));
+    if (nchunk < 1) nchunk = 1;
+
+    chunk = (TextChunk *)calloc(nchunk, sizeof(TextChunk));
+    offset = (size_t *)malloc((nchunk + 1) * sizeof(size_t));
+    if (chunk == NULL || offset == NULL) {
+        printf("No memories are available (chunk)\n");
+        exit(1);
+    }
+    // 区切りは必ず改行の直後に置く
+    p = base;
+    for (k = 0; k < nchunk; k++) {
+        chunk[k].begin = p;
+        if (k == nchunk - 1) {
+            p = base + len;
+        } else {
+            if (p < base + len * (k + 1) / nchunk) p = base + len * (k + 1) / nchunk;
+            while (p < base + len && *p != '\n') p++;
+            if (p < base + len) p++;
         }
+        chunk[k].end = p;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < nchunk; k++) {
+        Parse_chunk(&chunk[k]);
     }
 
-    *b = (double *)malloc(N * sizeof(double)); 
-    if (*b == NULL) { 
-        printf("No memories are available (b)\n"); 
-        exit(1); 
+    t->rows = 0;
+    t->cols = -1;
+    total = 0;
+    for (k = 0; k < nchunk; k++) {
+        if (chunk[k].bad != NULL) {
+            printf("%s: invalid number at byte %ld\n", filename, (long)(chunk[k].bad - base));
+            exit(1);
+        }
+        if (chunk[k].first_cols >= 0) {
+            if (t->cols < 0) t->cols = chunk[k].first_cols;
+            if (chunk[k].ragged || chunk[k].first_cols != t->cols) {
+                printf("%s: rows have different numbers of values\n", filename);
+                exit(1);
+            }
+        }
+        offset[k] = total;
+        total += chunk[k].count;
+        t->rows += chunk[k].lines;
+    }
+    if (t->rows == 0) {
+        printf("File %s has no values\n", filename);
+        exit(1);
     }
 
-    *c = (double *)malloc(N * sizeof(double)); 
-    if (*c == NULL) { 
-        printf("No memories are available (c)\n"); 
-        exit(1); 
+    if ((t->val = (double *)malloc(total * sizeof(double))) == NULL) {
+        printf("No memories are available (%s)\n", filename);
+        exit(1);
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < nchunk; k++) {
+        memcpy(t->val + offset[k], chunk[k].val, chunk[k].count * sizeof(double));
+        free(chunk[k].val);
     }
+    free(chunk);
+    free(offset);
+    munmap(base, len);
+
+    // 対称性とバンド幅 (5_kadai の get_bandwidth と同じ定義)
+    square = (t->rows == t->cols);
+    sym = square;
+    bw = 0;
+    #pragma omp parallel for private(j) reduction(max:bw) reduction(&&:sym) schedule(static)
+    for (i = 0; i < t->rows; i++) {
+        for (j = i; j < t->cols; j++) {
+            if (t->val[(size_t)i * t->cols + j] != 0.0 && j - i + 1 > bw) bw = j - i + 1;
+            if (square && sym && t->val[(size_t)i * t->cols + j] != t->val[(size_t)j * t->cols + i]) sym = 0;
+        }
+    }
+    t->symmetric = sym;
+    t->bandwidth = (bw > 0) ? bw : 1;
 }
 
-void File_read(int N, double **A, double *b, char *mat_file, char *vec_file) {
-    FILE *fp;
-    int i, j;
+// CRMATファイルをmmapしてデータ部の先頭を返す（CRMATでなければNULL）
+// MAP_PRIVATEなので書き換えてもファイルには反映されない
+double *Binary_open(char *filename, CrmatHeader *h, size_t *map_len)
+{
+    int fd;
+    struct stat st;
+    int64_t count;
+    char *p;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        printf("File not found!! (%s)\n", filename);
+        exit(1);
+    }
+    if (pread(fd, h, sizeof(CrmatHeader), 0) != sizeof(CrmatHeader)
+        || memcmp(h->magic, CRMAT_MAGIC, sizeof(h->magic)) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-    // Matrix file read
-    printf("Matrix file: %s\n", mat_file);
-    fp = fopen(mat_file, "r");
-    if (fp == NULL) {
-        printf("Matrix file not found!!\n");
+    switch (h->kind) {
+    case CRMAT_UPPER: count = h->rows * (h->rows + 1) / 2; break;
+    case CRMAT_BAND:  count = h->rows * h->bandwidth;      break;
+    default:          count = h->rows * h->cols;           break;
+    }
+    fstat(fd, &st);
+    if (h->data_offset + count * (int64_t)sizeof(double) > st.st_size) {
+        printf("Binary file is truncated (%s)\n", filename);
         exit(1);
     }
 
+    *map_len = st.st_size;
+    p = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("mmap failed (%s)\n", filename);
+        exit(1);
+    }
+    madvise(p, *map_len, MADV_SEQUENTIAL);
+    return (double *)(p + h->data_offset);
+}
+
+void Binary_close(double *data, CrmatHeader *h, size_t map_len)
+{
+    munmap((char *)data - h->data_offset, map_len);
+}
+
+// 連続領域に置かれた N x N 行列の各行を指すポインタ配列を作る
+double **Row_pointers(int N, double *data) {
+    double **A;
+    int i;
+
+    if ((A = (double **)malloc(N * sizeof(double *))) == NULL) {
+        printf("No memories are available (A)\n");
+        exit(1);
+    }
     for (i = 0; i < N; i++) {
-        for (j = 0; j < N; j++) {
-            // fscanfを使って行列の要素をdouble型で読み込む
-            if(fscanf(fp, "%lf", &A[i][j]) == EOF){
-                printf("vector file read error [%d]\n", i);
-                exit(1);
-            }
+        A[i] = data + (size_t)i * N;
+    }
+    return A;
+}
+
+// 行列ベクトル積 y = A x のカーネル (A は行優先, 行の間隔 lda)
+// 4行ずつ同時に処理し, 各行に2本ずつアキュムレータを持たせて FMA の遅延を隠す.
+// SSE2 / AVX2 / AVX-512 版を用意し, 起動時に cpuid で使えるものを選ぶ
+typedef void (*gemv_fn)(int m, int n, const double *a, size_t lda, const double *x, double *y);
+
+void Gemv_scalar(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    double s0, s1, s2, s3;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < n; j++) {
+            s0 += a0[j] * x[j];
+            s1 += a1[j] * x[j];
+            s2 += a2[j] * x[j];
+            s3 += a3[j] * x[j];
         }
+        y[i] = s0;
+        y[i + 1] = s1;
+        y[i + 2] = s2;
+        y[i + 3] = s3;
     }
-    fclose(fp);
+    for (; i < m; i++) {
+        a0 = a + (size_t)i * lda;
+        s0 = s1 = 0.0;
+        for (j = 0; j + 2 <= n; j += 2) {
+            s0 += a0[j] * x[j];
+            s1 += a0[j + 1] * x[j + 1];
+        }
+        if (j < n) s0 += a0[j] * x[j];
+        y[i] = s0 + s1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline double hsum_sse2(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
 
-    // Vector file read
-    fp = fopen(vec_file, "r");
+__attribute__((target("sse2")))
+void Gemv_sse2(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m128d xv0, xv1, s0a, s0b, s1a, s1b, s2a, s2b, s3a, s3b;
+    double t0, t1, t2, t3;
 
-    for (i = 0; i < N; i++) {
-        if (fscanf(fp, "%lf", &b[i]) == EOF) { 
-            printf("Vector file read error b[%d]\n", i);
-            exit(1);
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0a = s0b = s1a = s1b = s2a = s2b = s3a = s3b = _mm_setzero_pd();
+        for (j = 0; j + 4 <= n; j += 4) {
+            xv0 = _mm_loadu_pd(x + j);
+            xv1 = _mm_loadu_pd(x + j + 2);
+            s0a = _mm_add_pd(s0a, _mm_mul_pd(_mm_loadu_pd(a0 + j), xv0));
+            s0b = _mm_add_pd(s0b, _mm_mul_pd(_mm_loadu_pd(a0 + j + 2), xv1));
+            s1a = _mm_add_pd(s1a, _mm_mul_pd(_mm_loadu_pd(a1 + j), xv0));
+            s1b = _mm_add_pd(s1b, _mm_mul_pd(_mm_loadu_pd(a1 + j + 2), xv1));
+            s2a = _mm_add_pd(s2a, _mm_mul_pd(_mm_loadu_pd(a2 + j), xv0));
+            s2b = _mm_add_pd(s2b, _mm_mul_pd(_mm_loadu_pd(a2 + j + 2), xv1));
+            s3a = _mm_add_pd(s3a, _mm_mul_pd(_mm_loadu_pd(a3 + j), xv0));
+            s3b = _mm_add_pd(s3b, _mm_mul_pd(_mm_loadu_pd(a3 + j + 2), xv1));
         }
+        t0 = hsum_sse2(_mm_add_pd(s0a, s0b));
+        t1 = hsum_sse2(_mm_add_pd(s1a, s1b));
+        t2 = hsum_sse2(_mm_add_pd(s2a, s2b));
+        t3 = hsum_sse2(_mm_add_pd(s3a, s3b));
+        for (; j < n; j++) {
+            t0 += a0[j] * x[j];
+            t1 += a1[j] * x[j];
+            t2 += a2[j] * x[j];
+            t3 += a3[j] * x[j];
+        }
+        y[i] = t0;
+        y[i + 1] = t1;
+        y[i + 2] = t2;
+        y[i + 3] = t3;
     }
-    fclose(fp);
+    if (i < m) Gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
 }
 
-// 行列とベクトルの乗算を実行する関数
-void Matrix_vector_multiplier(int N, double **A, double *b, double *c) {
+__attribute__((target("avx2,fma")))
+void Gemv_avx2(int m, int n, const double *a, size_t lda, const double *x, double *y) {
     int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m256d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3, h0, h1;
+    double t[4];
 
-    for (i = 0; i < N; i++) {
-        c[i] = 0.0; 
-        for (j = 0; j < N; j++) {
-            c[i] += A[i][j] * b[j]; 
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm256_setzero_pd();
+        for (j = 0; j + 8 <= n; j += 8) {
+            xv0 = _mm256_loadu_pd(x + j);
+            xv1 = _mm256_loadu_pd(x + j + 4);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j + 4), xv1, u0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j + 4), xv1, u1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j + 4), xv1, u2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j + 4), xv1, u3);
         }
+        if (j + 4 <= n) {
+            xv0 = _mm256_loadu_pd(x + j);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            j += 4;
+        }
+        // 4行分の水平和を1本のベクトルにまとめる
+        h0 = _mm256_hadd_pd(_mm256_add_pd(s0, u0), _mm256_add_pd(s1, u1));
+        h1 = _mm256_hadd_pd(_mm256_add_pd(s2, u2), _mm256_add_pd(s3, u3));
+        _mm256_storeu_pd(t, _mm256_add_pd(_mm256_permute2f128_pd(h0, h1, 0x20),
+                                          _mm256_permute2f128_pd(h0, h1, 0x31)));
+        for (; j < n; j++) {
+            t[0] += a0[j] * x[j];
+            t[1] += a1[j] * x[j];
+            t[2] += a2[j] * x[j];
+            t[3] += a3[j] * x[j];
+        }
+        y[i] = t[0];
+        y[i + 1] = t[1];
+        y[i + 2] = t[2];
+        y[i + 3] = t[3];
     }
+    if (i < m) Gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+
+__attribute__((target("avx512f")))
+void Gemv_avx512(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m512d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3;
+    __mmask8 k;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm512_setzero_pd();
+        for (j = 0; j + 16 <= n; j += 16) {
+            xv0 = _mm512_loadu_pd(x + j);
+            xv1 = _mm512_loadu_pd(x + j + 8);
+            s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j + 8), xv1, u0);
+            s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j + 8), xv1, u1);
+            s2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j + 8), xv1, u2);
+            s3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j + 8), xv1, u3);
+        }
+        // 端数はマスク付きロードで処理する (範囲外は 0 として読む)
+        for (; j < n; j += 8) {
+            k = (n - j >= 8) ? 0xFF : (__mmask8)((1u << (n - j)) - 1);
+            xv0 = _mm512_maskz_loadu_pd(k, x + j);
+            s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a0 + j), xv0, s0);
+            s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a1 + j), xv0, s1);
+            s2 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a2 + j), xv0, s2);
+            s3 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a3 + j), xv0, s3);
+        }
+        y[i] = _mm512_reduce_add_pd(_mm512_add_pd(s0, u0));
+        y[i + 1] = _mm512_reduce_add_pd(_mm512_add_pd(s1, u1));
+        y[i + 2] = _mm512_reduce_add_pd(_mm512_add_pd(s2, u2));
+        y[i + 3] = _mm512_reduce_add_pd(_mm512_add_pd(s3, u3));
+    }
+    if (i < m) Gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+#endif
+
+// 環境変数 GEMV_ISA (scalar, sse2, avx2, avx512) で明示的に選ぶこともできる
+gemv_fn Gemv_select(const char **name) {
+    const char *isa = getenv("GEMV_ISA");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa == NULL || strcmp(isa, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        *name = "avx512";
+        return Gemv_avx512;
+    }
+    if ((isa == NULL || strcmp(isa, "avx2") == 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return Gemv_avx2;
+    }
+    if ((isa == NULL || strcmp(isa, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return Gemv_sse2;
+    }
+#endif
+    (void)isa;
+    *name = "scalar";
+    return Gemv_scalar;
+}
+
+// 行を64行ずつのブロックに分けて, スレッド並列に fn を呼ぶ
+void Gemv_blocked(gemv_fn fn, int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int ib, blk = 64;
+
+    if ((double)m * n < 1e5) {
+        fn(m, n, a, lda, x, y);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (ib = 0; ib < m; ib += blk) {
+        fn((m - ib < blk) ? m - ib : blk, n, a + (size_t)ib * lda, lda, x, y + ib);
+    }
+}
+
+// y = A x (初回呼び出し時にカーネルを選ぶ)
+void Gemv(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    static gemv_fn fn = NULL;
+    const char *name;
+
+    if (fn == NULL) fn = Gemv_select(&name);
+    Gemv_blocked(fn, m, n, a, lda, x, y);
+}
+
+// 行列とベクトルの乗算を実行する関数
+// A の各行は連続領域上に間隔 N で並んでいる (Row_pointers) ので, そのままSIMDカーネルに渡す
+void Matrix_vector_multiplier(int N, double **A, double *b, double *c) {
+    Gemv(N, N, A[0], N, b, c);
 }
 
 void Print_results(int N, double *c) {
@@ -115,6 +582,10 @@ void Print_results(int N, double *c) {
 int main(int argc, char *argv[]) {
     int N;
     double **A, *b, *c;
+    double *A_map, *b_map;
+    CrmatHeader mh, vh;
+    TextMatrix mt, vt;
+    size_t A_len = 0, b_len = 0;
 
     if (argc < 3) {
         printf("Usage:\n");
@@ -122,13 +593,55 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    N = Size_count(argv[2]); 
-    printf("Data size (N): %d\n", N);
+    // CRMAT形式なら読み込みもサイズ判定もせずmmapした領域をそのまま使う
+    A_map = Binary_open(argv[1], &mh, &A_len);
+    b_map = Binary_open(argv[2], &vh, &b_len);
+    if ((A_map == NULL) != (b_map == NULL)) {
+        printf("Matrix and vector files must both be text or both be binary\n");
+        exit(1);
+    }
+
+    if (A_map != NULL) {
+        N = (int)vh.rows;
+        printf("Data size (N): %d (binary)\n", N);
+        if (mh.kind != CRMAT_DENSE || mh.rows != N || mh.cols != N || vh.kind != CRMAT_VECTOR) {
+            printf("Binary matrix must be dense %d x %d\n", N, N);
+            exit(1);
+        }
+        A = Row_pointers(N, A_map);
+        b = b_map;
+    } else {
+        // テキストは1回の並列走査でサイズも求め, 読んだ領域をそのまま使う
+        printf("Matrix file: %s\n", argv[1]);
+        Text_parse(argv[1], &mt);
+        printf("Vectror file: %s\n", argv[2]);
+        Text_parse(argv[2], &vt);
+        N = mt.rows;
+        printf("Data size (N): %d\n", N);
+        if (mt.cols != N || vt.rows * vt.cols != N) {
+            printf("Matrix (%d x %d) and vector (%d) sizes do not match\n", mt.rows, mt.cols, vt.rows * vt.cols);
+            exit(1);
+        }
+        A = Row_pointers(N, mt.val);
+        b = vt.val;
+    }
+    if ((c = (double *)malloc(N * sizeof(double))) == NULL) {
+        printf("No memories are available (c)\n");
+        exit(1);
+    }
 
-    Memory_allocate(N, &A, &b, &c);
-    File_read(N, A, b, argv[1], argv[2]); 
     Matrix_vector_multiplier(N, A, b, c);
     Print_results(N, c);
 
+    free(A);
+    free(c);
+    if (A_map != NULL) {
+        Binary_close(A_map, &mh, A_len);
+        Binary_close(b_map, &vh, b_len);
+    } else {
+        free(mt.val);
+        free(vt.val);
+    }
+
     return 0;
 }
\ No newline at end of file
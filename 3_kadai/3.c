@@ -1,45 +1,137 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define N 4
+#define ALIGN 64 // 行列・ベクトル領域の境界 (キャッシュライン)
+#define LU_NB 128 // LU 分解のパネル幅
 
-void input_matrix(double **a, char c, FILE *fin, FILE *fout);
-void input_vector(double *b, char c, FILE *fin, FILE *fout);
+void input_matrix(double **a, int n, char c, FILE *fin, FILE *fout);
+void input_vector(double *b, int n, char c, FILE *fin, FILE *fout);
+int count_values(FILE *fin);
 double **dmatrix(int nr1, int nr2, int nl1, int nl2);
+size_t dmatrix_ld(int nl1, int nl2);
 void free_dmatrix(double **a, int nr1, int nr2, int nl1, int nl2);
 void *dvector(int i, int j);
 void free_dvector(void *a, int i);
-double *gauss(double **a, double *b);
+void gemm_sub(int m, int n, int k, const double *a, size_t lda, const double *b, size_t ldb,
+              double *c, size_t ldc);
+void lu_factor(double **a, int n, int *ipiv);
+void lu_solve(double **a, int n, const int *ipiv, double *b, int nrhs, size_t ldb);
+double elapsed(struct timespec *t0);
 
-int main(void)
+int main(int argc, char *argv[])
 {
     FILE *fin, *fout;
-    double **a, *b;
-    int i;
+    double **a, *b, *x, err, tmp, t_factor, t_solve;
+    int i, j, n, nrhs, count, *ipiv;
+    char *input_file = "input.dat";
+    struct timespec t0;
+
+    // -r n [nrhs]: 乱数で作った n 次の行列で分解と nrhs 本の右辺の求解の時間を測る (解はすべて 1)
+    if (argc > 2 && strcmp(argv[1], "-r") == 0)
+    {
+        n = atoi(argv[2]);
+        nrhs = (argc > 3) ? atoi(argv[3]) : 1;
+        if (n < 1 || nrhs < 1)
+        {
+            fprintf(stderr, "行列のサイズが不正です: %s\n", argv[2]);
+            exit(1);
+        }
+        a = dmatrix(1, n, 1, n);
+        b = dvector(1, n);
+        x = dvector(1, n * nrhs); // 右辺 j 本目の第 i 成分は x[j * n + i]
+        ipiv = (int *)malloc(sizeof(int) * (n + 1));
+        if (ipiv == NULL)
+        {
+            fprintf(stderr, "メモリ割り当てエラー\n");
+            exit(1);
+        }
+        srand(1);
+        for (i = 1; i <= n; i++)
+        {
+            b[i] = 0.0;
+            for (j = 1; j <= n; j++)
+            {
+                a[i][j] = (double)rand() / RAND_MAX - 0.5;
+                b[i] += a[i][j];
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        lu_factor(a, n, ipiv);
+        t_factor = elapsed(&t0);
+        for (j = 0; j < nrhs; j++)
+        {
+            memcpy(&x[(size_t)j * n + 1], &b[1], sizeof(double) * n);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        lu_solve(a, n, ipiv, x, nrhs, n);
+        t_solve = elapsed(&t0);
+
+        err = 0.0;
+        for (i = 1; i <= n * nrhs; i++)
+        {
+            tmp = fabs(x[i] - 1.0);
+            if (tmp > err) err = tmp;
+        }
+        printf("n = %d: 分解 %.3f 秒 (%.2f GFlop/s), 求解 %d 本 %.3f 秒, max|x - 1| = %.3e\n",
+               n, t_factor, 2.0 / 3.0 * n * (double)n * n / t_factor * 1e-9, nrhs, t_solve, err);
 
-    a = dmatrix(1, N, 1, N);
-    b = dvector(1, N);
+        free(ipiv);
+        free_dvector(x, 1);
+        free_dvector(b, 1);
+        free_dmatrix(a, 1, n, 1, n);
+        return 0;
+    }
+    if (argc > 1)
+    {
+        input_file = argv[1];
+    }
 
-    if ((fin = fopen("input.dat", "r")) == NULL)
+    if ((fin = fopen(input_file, "r")) == NULL)
     {
         fprintf(stderr, "Error opening input file\n");
         exit(1);
     }
 
+    // 入力は n x n 行列と n 次のベクトルが続いたもの: 値の個数 n^2 + n から n を決める
+    count = count_values(fin);
+    n = (int)((sqrt(4.0 * count + 1.0) - 1.0) / 2.0 + 0.5);
+    if (n < 1 || n * n + n != count)
+    {
+        fprintf(stderr, "入力の値の個数 (%d) が n x n 行列と n 次のベクトルになっていません\n", count);
+        exit(1);
+    }
+    rewind(fin);
+
     if ((fout = fopen("output.dat", "w")) == NULL)
     {
         fprintf(stderr, "Error opening output file\n");
         exit(1);
     }
 
-    input_matrix(a, 'A', fin, fout);
-    input_vector(b, 'B', fin, fout);
+    a = dmatrix(1, n, 1, n);
+    b = dvector(1, n);
+    ipiv = (int *)malloc(sizeof(int) * (n + 1));
+    if (ipiv == NULL)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+
+    input_matrix(a, n, 'A', fin, fout);
+    input_vector(b, n, 'B', fin, fout);
 
-    b = gauss(a, b);
+    lu_factor(a, n, ipiv);
+    lu_solve(a, n, ipiv, b, 1, n);
 
     fprintf(fout, "Ax = bの解は次の通りです\n");
-    for (i = 1; i <= N; i++)
+    for (i = 1; i <= n; i++)
     {
         fprintf(fout, "x[%d] = %f\n", i, b[i]);
     }
@@ -47,77 +139,602 @@ int main(void)
     fclose(fin);
     fclose(fout);
 
-    free_dmatrix(a, 1, N, 1, N);
+    free(ipiv);
+    free_dmatrix(a, 1, n, 1, n);
     free_dvector(b, 1);
 
     return 0;
 }
 
-// 部分ピボット選択付きのガウスの消去法
-double *gauss(double **a, double *b)
+double elapsed(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+// 行列積の減算 C -= A B (A: m x k, B: k x n, いずれも行優先で行の間隔は lda, ldb, ldc)
+// B を KC x NC, A を MC x KC のブロックに切り出して連続領域にパックし,
+// MR x NR のマイクロカーネルで C の小行列をレジスタに置いたまま k 方向に足し込む.
+// MC 方向のブロック (マクロタイル) をスレッド並列に処理する (0_kadai の GEMM_DEFINE と同じ構成)
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MR 4   // マイクロカーネルは4行固定
+#define GEMM_NR 8
+
+// NR 要素を1つのベクトルとして扱う (GCC のベクトル拡張, 使える SIMD 命令に展開される)
+typedef double gemm_vec __attribute__((vector_size(GEMM_NR * sizeof(double))));
+
+// MR = 4 行分のアキュムレータをレジスタに置く
+static void gemm_kernel(int kc, const double *restrict a, const double *restrict b,
+                        double *restrict c, size_t ldc, int mr, int nr)
+{
+    gemm_vec acc[GEMM_MR], c0, c1, c2, c3, bv;
+    double out[GEMM_NR];
+    int p, r, s;
+
+    memset(&c0, 0, sizeof(c0));
+    c1 = c2 = c3 = c0;
+    for (p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR)
+    {
+        memcpy(&bv, b, sizeof(bv));
+        c0 += a[0] * bv;
+        c1 += a[1] * bv;
+        c2 += a[2] * bv;
+        c3 += a[3] * bv;
+    }
+    acc[0] = c0;
+    acc[1] = c1;
+    acc[2] = c2;
+    acc[3] = c3;
+    for (r = 0; r < mr; r++)
+    {
+        memcpy(out, &acc[r], sizeof(out));
+        for (s = 0; s < nr; s++)
+        {
+            c[r * ldc + s] -= out[s];
+        }
+    }
+}
+
+// A の mc x kc ブロックを MR 行ずつの帯に分け, 帯の中は列順に並べる (端は 0 で埋める)
+static void gemm_pack_a(int mc, int kc, const double *a, size_t lda, double *ap)
+{
+    int i, p, r;
+
+    for (i = 0; i < mc; i += GEMM_MR)
+    {
+        for (p = 0; p < kc; p++)
+        {
+            for (r = 0; r < GEMM_MR; r++)
+            {
+                *ap++ = (i + r < mc) ? a[(size_t)(i + r) * lda + p] : 0.0;
+            }
+        }
+    }
+}
+
+// B の kc x nc ブロックを NR 列ずつの帯に分け, 帯の中は行順に並べる (端は 0 で埋める)
+static void gemm_pack_b(int kc, int nc, const double *b, size_t ldb, double *bp)
+{
+    int p, s;
+
+    for (p = 0; p < kc; p++)
+    {
+        for (s = 0; s < GEMM_NR; s++)
+        {
+            bp[p * GEMM_NR + s] = (s < nc) ? b[(size_t)p * ldb + s] : 0.0;
+        }
+    }
+}
+
+void gemm_sub(int m, int n, int k, const double *a, size_t lda, const double *b, size_t ldb,
+              double *c, size_t ldc)
+{
+    int jc, pc, nc, kc;
+    int ncmax = (n < GEMM_NC) ? n : GEMM_NC, mcmax = (m < GEMM_MC) ? m : GEMM_MC;
+    double *bp;
+
+    if (m <= 0 || n <= 0 || k <= 0) return;
+    if (posix_memalign((void **)&bp, ALIGN, sizeof(double) * GEMM_KC * (ncmax + GEMM_NR)) != 0)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+
+    for (jc = 0; jc < n; jc += GEMM_NC)
+    {
+        nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+        for (pc = 0; pc < k; pc += GEMM_KC)
+        {
+            kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            #pragma omp parallel
+            {
+                double *ap;
+                int ic, ir, jr, mc;
+
+                #pragma omp for schedule(static)
+                for (jr = 0; jr < nc; jr += GEMM_NR)
+                {
+                    gemm_pack_b(kc, nc - jr, b + (size_t)pc * ldb + jc + jr, ldb, bp + (size_t)jr * kc);
+                }
+                if (posix_memalign((void **)&ap, ALIGN, sizeof(double) * GEMM_KC * (mcmax + GEMM_MR)) != 0)
+                {
+                    fprintf(stderr, "メモリ割り当てエラー\n");
+                    exit(1);
+                }
+                #pragma omp for schedule(dynamic)
+                for (ic = 0; ic < m; ic += GEMM_MC)
+                {
+                    mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                    gemm_pack_a(mc, kc, a + (size_t)ic * lda + pc, lda, ap);
+                    for (jr = 0; jr < nc; jr += GEMM_NR)
+                    {
+                        for (ir = 0; ir < mc; ir += GEMM_MR)
+                        {
+                            gemm_kernel(kc, ap + (size_t)ir * kc, bp + (size_t)jr * kc,
+                                        c + (size_t)(ic + ir) * ldc + jc + jr, ldc,
+                                        (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR,
+                                        (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR);
+                        }
+                    }
+                }
+                free(ap);
+            }
+        }
+    }
+    free(bp);
+}
+
+// 行交換: k1 <= k < k2 について行 k と行 ipiv[k] の列 [0, n) を入れ替える (行の先頭は a)
+static void lu_swap(int n, double *a, size_t lda, const int *ipiv, int k1, int k2)
+{
+    int j, k, jb;
+    double *r1, *r2, tmp;
+
+    if (n <= 0) return;
+    // 列方向に分けてスレッドに配る (1ブロックの中では行交換の順序を守る)
+    #pragma omp parallel for private(j, k, r1, r2, tmp) schedule(static) if (n >= 1024)
+    for (jb = 0; jb < n; jb += 256)
+    {
+        int je = (jb + 256 < n) ? jb + 256 : n;
+        for (k = k1; k < k2; k++)
+        {
+            if (ipiv[k] == k) continue;
+            r1 = a + (size_t)k * lda;
+            r2 = a + (size_t)ipiv[k] * lda;
+            for (j = jb; j < je; j++)
+            {
+                tmp = r1[j];
+                r1[j] = r2[j];
+                r2[j] = tmp;
+            }
+        }
+    }
+}
+
+// 単位下三角 L (m x m) について B <- L^{-1} B (B: m x n)
+static void lu_trsm_lower(int m, int n, const double *l, size_t ldl, double *b, size_t ldb)
 {
-    int i, j, k, ip;
-    double alpha, tmp;
-    double amax, eps = pow(2.0, -50.0);
+    int jb;
 
-    for (k = 1; k <= N - 1; k++)
+    #pragma omp parallel for schedule(static) if ((double)m * m * n >= 1e6)
+    for (jb = 0; jb < n; jb += 256)
+    {
+        int i, p, j, je = (jb + 256 < n) ? jb + 256 : n;
+        double *restrict bi, *restrict bp, lip;
+        for (i = 1; i < m; i++)
+        {
+            bi = b + (size_t)i * ldb;
+            for (p = 0; p < i; p++)
+            {
+                lip = l[(size_t)i * ldl + p];
+                if (lip == 0.0) continue;
+                bp = b + (size_t)p * ldb;
+                for (j = jb; j < je; j++)
+                {
+                    bi[j] -= lip * bp[j];
+                }
+            }
+        }
+    }
+}
+
+// パネル (m x n, m >= n) の再帰的な LU 分解
+// 列を半分に分け, 左半分を分解 → 右半分に行交換と三角解法 → 残りを行列積で更新 → 右下を分解.
+// ipiv[k] はパネル先頭からの相対位置で, 行交換はパネル内の列にだけ施す
+static void lu_panel(int m, int n, double *a, size_t lda, int *ipiv)
+{
+    int i, k, n1, n2, ip;
+    double amax, pivot, eps = pow(2.0, -50.0);
+
+    if (n == 1)
     {
         // ピボット選択
-        amax = fabs(a[k][k]);
-        ip = k;
-        for (i = k + 1; i <= N; i++)
+        amax = fabs(a[0]);
+        ip = 0;
+        for (i = 1; i < m; i++)
         {
-            if (fabs(a[i][k]) > amax){
-                amax = fabs(a[i][k]);
+            if (fabs(a[(size_t)i * lda]) > amax)
+            {
+                amax = fabs(a[(size_t)i * lda]);
                 ip = i;
             }
         }
-
         // 正則性の判定
         if (amax < eps)
         {
             fprintf(stderr, "係数行列が正則ではありません\n");
             exit(1);
         }
-        // 行交換
-        if (ip != k)
+        ipiv[0] = ip;
+        pivot = a[(size_t)ip * lda];
+        a[(size_t)ip * lda] = a[0];
+        a[0] = pivot;
+        for (i = 1; i < m; i++)
+        {
+            a[(size_t)i * lda] /= pivot;
+        }
+        return;
+    }
+
+    n1 = n / 2;
+    n2 = n - n1;
+    lu_panel(m, n1, a, lda, ipiv);
+    lu_swap(n2, a + n1, lda, ipiv, 0, n1);
+    lu_trsm_lower(n1, n2, a, lda, a + n1, lda);
+    gemm_sub(m - n1, n2, n1, a + (size_t)n1 * lda, lda, a + n1, lda, a + (size_t)n1 * lda + n1, lda);
+    lu_panel(m - n1, n2, a + (size_t)n1 * lda + n1, lda, ipiv + n1);
+    for (k = n1; k < n; k++)
+    {
+        ipiv[k] += n1;
+    }
+    lu_swap(n1, a, lda, ipiv, n1, n);
+}
+
+// 部分ピボット選択付きの LU 分解 (右方向のブロック版)
+// PA = LU を A (行の間隔 lda, 0 始まり) に上書きする (L は単位下三角で対角は持たない). 行交換は要素を動かす代わりに
+// パネルごとに piv[k] (k 行目と入れ替えた行) に記録し, パネルの外の列へはまとめて施す.
+// 残りの小行列の更新は gemm_sub で行い, ここに計算量の大半が集まる
+static void lu_factor_blocked(int n, double *A, size_t lda, int *piv)
+{
+    int j, jb, k;
+
+    for (j = 0; j < n; j += LU_NB)
+    {
+        jb = (n - j < LU_NB) ? n - j : LU_NB;
+
+        // パネル A[j:n, j:j+jb] の分解
+        lu_panel(n - j, jb, A + (size_t)j * lda + j, lda, piv + j);
+        for (k = j; k < j + jb; k++)
+        {
+            piv[k] += j;
+        }
+
+        // パネルの左右の列に行交換を施す
+        lu_swap(j, A, lda, piv, j, j + jb);
+        lu_swap(n - j - jb, A + j + jb, lda, piv, j, j + jb);
+
+        // U12 = L11^{-1} A12, A22 -= L21 U12
+        lu_trsm_lower(jb, n - j - jb, A + (size_t)j * lda + j, lda, A + (size_t)j * lda + j + jb, lda);
+        gemm_sub(n - j - jb, n - j - jb, jb, A + (size_t)(j + jb) * lda + j, lda,
+                 A + (size_t)j * lda + j + jb, lda, A + (size_t)(j + jb) * lda + j + jb, lda);
+    }
+}
+
+// タイル版の LU 分解 (タスクの依存グラフで実行する)
+// 行列を LU_NB x LU_NB のタイルに分け, 各ステップ k について
+//   PANEL(k)    : タイル列 k 全体の分解 (ピボット選択はタイル列全体から行う)
+//   SWAP(k, j)  : タイル列 j に行交換を施し, タイル (k, j) に L_kk^{-1} を掛ける
+//   GEMM(i,j,k) : A_ij -= L_ik U_kj
+// をタスクとして作り, tile[i][j] への depend で入力がそろったものから空いたスレッドが実行する.
+// 次のパネルは前のステップの更新が終わるのを待たずに始められ, 優先度を上げて臨界経路を先に進める
+// (優先度は OMP_MAX_TASK_PRIORITY を設定したときに有効). タスクの中の gemm_sub などは入れ子の並列を作らない
+static void lu_factor_dag(int n, double *A, size_t lda, int *piv)
+{
+    int nt = (n + LU_NB - 1) / LU_NB;
+    int i, j, k;
+    char (*tile)[nt] = malloc(sizeof(char) * nt * nt); // 依存関係の目印 (中身は使わない)
+
+    if (tile == NULL)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+
+    #pragma omp parallel private(i, j, k)
+    #pragma omp single
+    {
+        for (k = 0; k < nt; k++)
+        {
+            int k0 = k * LU_NB, kb = (n - k0 < LU_NB) ? n - k0 : LU_NB;
+
+            #pragma omp task firstprivate(k0, kb) depend(iterator(it = k:nt), inout: tile[it][k]) priority(2)
+            {
+                int p;
+                lu_panel(n - k0, kb, A + (size_t)k0 * lda + k0, lda, piv + k0);
+                for (p = k0; p < k0 + kb; p++)
+                {
+                    piv[p] += k0;
+                }
+            }
+
+            for (j = k + 1; j < nt; j++)
+            {
+                int j0 = j * LU_NB, jb = (n - j0 < LU_NB) ? n - j0 : LU_NB;
+
+                #pragma omp task firstprivate(k0, kb, j0, jb) depend(in: tile[k][k]) depend(iterator(it = k:nt), inout: tile[it][j]) priority(j == k + 1 ? 1 : 0)
+                {
+                    lu_swap(jb, A + j0, lda, piv, k0, k0 + kb);
+                    lu_trsm_lower(kb, jb, A + (size_t)k0 * lda + k0, lda, A + (size_t)k0 * lda + j0, lda);
+                }
+            }
+
+            for (i = k + 1; i < nt; i++)
+            {
+                for (j = k + 1; j < nt; j++)
+                {
+                    int i0 = i * LU_NB, ib = (n - i0 < LU_NB) ? n - i0 : LU_NB;
+                    int j0 = j * LU_NB, jb = (n - j0 < LU_NB) ? n - j0 : LU_NB;
+
+                    #pragma omp task firstprivate(k0, kb, i0, ib, j0, jb) depend(in: tile[i][k], tile[k][j]) depend(inout: tile[i][j]) priority(j == k + 1 ? 1 : 0)
+                    gemm_sub(ib, jb, kb, A + (size_t)i0 * lda + k0, lda, A + (size_t)k0 * lda + j0, lda,
+                             A + (size_t)i0 * lda + j0, lda);
+                }
+            }
+        }
+    }
+
+    // 左側の列 (L の部分) への行交換は, 更新に使われ終わってからまとめて施す
+    for (k = LU_NB; k < n; k += LU_NB)
+    {
+        lu_swap(k, A, lda, piv, k, (n - k < LU_NB) ? n : k + LU_NB);
+    }
+    free(tile);
+}
+
+// 部分ピボット選択付きの LU 分解: PA = LU を a に上書きし, ipiv[k] (1 始まり) に k 行目と入れ替えた行を記録する.
+// 複数スレッドのときはタイル版 (lu_factor_dag), 1スレッドのときはブロック版を使う.
+// 環境変数 LU_SCHED=blocked|dag で選択を上書きできる
+void lu_factor(double **a, int n, int *ipiv)
+{
+    size_t lda = dmatrix_ld(1, n);
+    int k, *piv = ipiv + 1; // 0 始まりの作業用
+    int dag = 0;
+    char *sched = getenv("LU_SCHED");
+
+#ifdef _OPENMP
+    dag = (omp_get_max_threads() > 1 && n > LU_NB);
+#endif
+    if (sched != NULL)
+    {
+        if (strcmp(sched, "dag") == 0) dag = 1;
+        else if (strcmp(sched, "blocked") == 0) dag = 0;
+        else
+        {
+            fprintf(stderr, "LU_SCHED は blocked か dag を指定してください: %s\n", sched);
+            exit(1);
+        }
+    }
+
+    if (dag)
+    {
+        lu_factor_dag(n, &a[1][1], lda, piv);
+    }
+    else
+    {
+        lu_factor_blocked(n, &a[1][1], lda, piv);
+    }
+
+    for (k = 0; k < n; k++)
+    {
+        ipiv[k + 1] = piv[k] + 1;
+    }
+}
+
+// 上三角 U (m x m) について B <- U^{-1} B (B: m x n)
+static void lu_trsm_upper(int m, int n, const double *u, size_t ldu, double *b, size_t ldb)
+{
+    int i, p, j;
+    double *restrict bi, *restrict bp, uip;
+
+    for (i = m - 1; i >= 0; i--)
+    {
+        bi = b + (size_t)i * ldb;
+        for (p = i + 1; p < m; p++)
+        {
+            uip = u[(size_t)i * ldu + p];
+            bp = b + (size_t)p * ldb;
+            for (j = 0; j < n; j++)
+            {
+                bi[j] -= uip * bp[j];
+            }
+        }
+        for (j = 0; j < n; j++)
+        {
+            bi[j] /= u[(size_t)i * ldu + i];
+        }
+    }
+}
+
+// lu_factor の結果を使って AX = B を解く (B に解を上書きする)
+// B は nrhs 本の右辺で, j 本目の第 i 成分 (1 始まり) が b[j * ldb + i].
+// 右辺を LU_NB 本ずつ行優先の作業領域に並べ替え (このとき行交換も施す), LU_NB 行ごとのブロックに分けて
+// 対角ブロックの三角解法と残りの行への行列積 (gemm_sub) で前進・後退代入を行う
+void lu_solve(double **a, int n, const int *ipiv, double *b, int nrhs, size_t ldb)
+{
+    int i, j, k, c0, nb, k0, kb, *perm;
+    size_t lda = dmatrix_ld(1, n);
+    double *A = &a[1][1], *W, tmp;
+
+    perm = (int *)malloc(sizeof(int) * n);
+    if (perm == NULL || posix_memalign((void **)&W, ALIGN, sizeof(double) * n * LU_NB) != 0)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+    // 行交換を順に施した結果の並び: 作業領域の i 行目は元の perm[i] 行目
+    for (i = 0; i < n; i++)
+    {
+        perm[i] = i;
+    }
+    for (k = 0; k < n; k++)
+    {
+        j = perm[k];
+        perm[k] = perm[ipiv[k + 1] - 1];
+        perm[ipiv[k + 1] - 1] = j;
+    }
+
+    for (c0 = 0; c0 < nrhs; c0 += LU_NB)
+    {
+        nb = (nrhs - c0 < LU_NB) ? nrhs - c0 : LU_NB;
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < nb; j++)
+            {
+                W[(size_t)i * nb + j] = b[(size_t)(c0 + j) * ldb + perm[i] + 1];
+            }
+        }
+
+        // L Y = PB (L の対角は 1)
+        for (k0 = 0; k0 < n; k0 += LU_NB)
+        {
+            kb = (n - k0 < LU_NB) ? n - k0 : LU_NB;
+            lu_trsm_lower(kb, nb, A + (size_t)k0 * lda + k0, lda, W + (size_t)k0 * nb, nb);
+            gemm_sub(n - k0 - kb, nb, kb, A + (size_t)(k0 + kb) * lda + k0, lda,
+                     W + (size_t)k0 * nb, nb, W + (size_t)(k0 + kb) * nb, nb);
+        }
+        // U X = Y
+        for (k0 = (n - 1) / LU_NB * LU_NB; k0 >= 0; k0 -= LU_NB)
+        {
+            kb = (n - k0 < LU_NB) ? n - k0 : LU_NB;
+            gemm_sub(kb, nb, n - k0 - kb, A + (size_t)k0 * lda + k0 + kb, lda,
+                     W + (size_t)(k0 + kb) * nb, nb, W + (size_t)k0 * nb, nb);
+            lu_trsm_upper(kb, nb, A + (size_t)k0 * lda + k0, lda, W + (size_t)k0 * nb, nb);
+        }
+
+        for (i = 0; i < n; i++)
         {
-            for (j = k; j <= N; j++)
+            for (j = 0; j < nb; j++)
             {
-                tmp = a[k][j];
-                a[k][j] = a[ip][j];
-                a[ip][j] = tmp;
+                tmp = W[(size_t)i * nb + j];
+                b[(size_t)(c0 + j) * ldb + i + 1] = tmp;
             }
-            tmp = b[k];
-            b[k] = b[ip];
-            b[ip] = tmp;
         }
+    }
+    free(W);
+    free(perm);
+}
+
+// 入力ファイルの値の個数を数える
+int count_values(FILE *fin)
+{
+    int count = 0;
+    double v;
 
-        // 前進消去
-        for (i = k + 1; i <= N; i++)
+    while (fscanf(fin, "%lf", &v) == 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+// 行列の入力
+void input_matrix(double **a, int n, char c, FILE *fin, FILE *fout)
+{
+    int i, j;
+
+    fprintf(fout, "行列%cを入力します\n", c);
+    for (i = 1; i <= n; i++)
+    {
+        for (j = 1; j <= n; j++)
         {
-            alpha = a[i][k] / a[k][k];
-            for (j = k + 1; j <= N; j++)
+            if (fscanf(fin, "%lf", &a[i][j]) != 1)
             {
-                a[i][j] -= alpha * a[k][j];
+                fprintf(stderr, "行列の読み込みエラーです\n");
+                exit(1);
             }
-            b[i] -= alpha * b[k];
         }
     }
+}
+
+// ベクトルの入力
+void input_vector(double *b, int n, char c, FILE *fin, FILE *fout)
+{
+    int i;
 
-    // 後退代入
-    b[N] = b[N] / a[N][N];
-    for (k = N - 1; k >= 1; k--)
+    fprintf(fout, "ベクトル%cを入力します\n", c);
+    for (i = 1; i <= n; i++)
     {
-        tmp = b[k];
-        for (j = k + 1; j <= N; j++)
+        if (fscanf(fin, "%lf", &b[i]) != 1)
         {
-            tmp -= a[k][j] * b[j];
+            fprintf(stderr, "ベクトルの読み込みエラーです\n");
+            exit(1);
         }
-        b[k] = tmp / a[k][k];
     }
+}
 
-    return b;
+// 行列領域の確保
+// 全要素を1つの連続領域に置き, 行の長さを 8 要素の倍数 (dmatrix_ld) に切り上げて各行の先頭を 64 バイト境界に揃える.
+// 添字調整で使われない a[nr1-1] に領域の先頭を保存しておく
+size_t dmatrix_ld(int nl1, int nl2)
+{
+    return ((size_t)(nl2 - nl1 + 1) + 7) & ~(size_t)7;
 }
 
+double **dmatrix(int nr1, int nr2, int nl1, int nl2)
+{
+    int i;
+    size_t ld = dmatrix_ld(nl1, nl2);
+    double *base;
+    double **p = (double **)malloc(sizeof(double *) * (nr2 - nr1 + 2));
 
+    if (p == NULL || posix_memalign((void **)&base, ALIGN, sizeof(double) * ld * (nr2 - nr1 + 1)) != 0)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+    memset(base, 0, sizeof(double) * ld * (nr2 - nr1 + 1));
+
+    p = p - nr1 + 1;
+    p[nr1 - 1] = base;
+    for (i = nr1; i <= nr2; i++)
+    {
+        p[i] = base + (size_t)(i - nr1) * ld - nl1;
+    }
+    return p;
+}
+
+// 行列領域の解放
+void free_dmatrix(double **a, int nr1, int nr2, int nl1, int nl2)
+{
+    (void)nr2; (void)nl1; (void)nl2; // 大きさは確保した領域の先頭から分かるので使わない
+    free(a[nr1 - 1]);
+    free(a + nr1 - 1);
+}
+
+// ベクトル領域の確保 (先頭要素 b[i] が 64 バイト境界に来る)
+void *dvector(int i, int j)
+{
+    char *base;
+    double *p;
+    size_t n = ((size_t)(j - i + 1) + 7) & ~(size_t)7;
+
+    // 先頭の ALIGN バイトは空けておき, 要素の直前に領域の先頭を保存する (free_dvector で使う)
+    if (posix_memalign((void **)&base, ALIGN, ALIGN + sizeof(double) * n) != 0)
+    {
+        fprintf(stderr, "メモリ割り当てエラー\n");
+        exit(1);
+    }
+    p = (double *)(base + ALIGN);
+    ((void **)p)[-1] = base;
+    return p - i;
+}
+
+// ベクトル領域の解放
+void free_dvector(void *a, int i)
+{
+    free(((void **)((double *)a + i))[-1]);
+}
@@ -10,14 +10,17 @@ void free_dvector(double *a, int i);
 int count_matrix_size(FILE *fin);
 void input_symmetric_matrix(double *a, int n, FILE *fin, FILE *fout);
 void input_vector(double *b, int n, FILE *fin, FILE *fout);
-double *gauss_symmetric(double *a, double *b, int n);
-int get_upper_index(int i, int j, int n);
+int cholesky_packed(double *a, int n);
+void cholesky_to_ldlt(double *a, int n, int k);
+void ldlt_packed(double *a, int n, int k0);
+void cholesky_solve_packed(double *a, double *b, int n);
+void ldlt_solve_packed(double *a, double *b, int n);
 
 int main(int argc, char *argv[])
 {
     FILE *fin_matrix, *fin_vector, *fout;
     double *a, *b;
-    int i, n;
+    int i, k, n;
     char *matrix_file = "input_matrix.txt";
     char *vector_file = "input_vector.txt";
     char *output_file = "output.dat";
@@ -72,7 +75,22 @@ int main(int argc, char *argv[])
     input_symmetric_matrix(a, n, fin_matrix, fout);
     input_vector(b, n, fin_vector, fout);
 
-    b = gauss_symmetric(a, b, n);
+    // 正定値ならコレスキー分解, 途中で正でない対角が出たらそこから LDL^T 分解に切り替える
+    k = cholesky_packed(a, n);
+    if (k == 0)
+    {
+        fprintf(fout, "コレスキー分解で解きます\n");
+        printf("コレスキー分解で解きます\n");
+        cholesky_solve_packed(a, b, n);
+    }
+    else
+    {
+        fprintf(fout, "正定値ではないので LDL^T 分解で解きます\n");
+        printf("正定値ではないので LDL^T 分解で解きます\n");
+        cholesky_to_ldlt(a, n, k);
+        ldlt_packed(a, n, k);
+        ldlt_solve_packed(a, b, n);
+    }
 
     fprintf(fout, "Ax = bの解は次の通りです\n");
     printf("Ax = bの解は次の通りです\n");
@@ -108,17 +126,6 @@ int count_matrix_size(FILE *fin)
     return n;
 }
 
-// 上三角行列のインデックス計算（i,j → 1次元配列のインデックス）
-int get_upper_index(int i, int j, int n)
-{
-    if (i <= j) {
-        return (i - 1) * n - (i - 1) * (i - 2) / 2 + (j - i);
-    } else {
-        // 対称性を利用してj,iのインデックスを返す
-        return (j - 1) * n - (j - 1) * (j - 2) / 2 + (i - j);
-    }
-}
-
 // 対称行列の上三角部分のメモリ割り当て（n(n+1)/2個のみ）
 double *symmetric_matrix(int n)
 {
@@ -161,7 +168,7 @@ void free_dvector(double *a, int i)
 // 対称行列の入力（上三角部分のみを読み取り）
 void input_symmetric_matrix(double *a, int n, FILE *fin, FILE *fout)
 {
-    int i, j, index;
+    int i, j, index = 0;
     double value;
     
     fprintf(fout, "対称行列A（上三角部分）の入力:\n");
@@ -173,10 +180,11 @@ void input_symmetric_matrix(double *a, int n, FILE *fin, FILE *fout)
                 fprintf(stderr, "行列要素の読み込みエラー\n");
                 exit(1);
             }
-            index = get_upper_index(i, j, n);
+            // 行 i は対角から n-i+1 個なので, 読み込み順がそのままインデックスになる
             a[index] = value;
             fprintf(fout, "A[%d][%d] = %f (インデックス: %d)\n", i, j, value, index);
             printf("A[%d][%d] = %f (インデックス: %d)\n", i, j, value, index);
+            index++;
         }
     }
 }
@@ -198,67 +206,170 @@ void input_vector(double *b, int n, FILE *fin, FILE *fout)
     }
 }
 
-// 対称行列用のガウスの消去法（部分ピボット選択なし）
-double *gauss_symmetric(double *a, double *b, int n)
+// 上三角パック形式: 行 i は a(i,i), a(i,i+1), ..., a(i,n) の n-i+1 個で, 行 i+1 がその直後に続く.
+// 以下の分解・求解はどれも行の先頭をポインタで進めて要素を連続に読み, 添字計算を行わない.
+// 右下の小行列は上三角だけ更新するので, 計算量は全体を更新する消去法の半分 (n^3/6) になる
+
+// コレスキー分解 A = U^T U (U を a に上書きする)
+// 正定値なら 0 を返す. 第 k 段の対角が正でなければ, その段を始める前の状態で k を返す
+// (このとき行 k 以降にはシューア補行列が入っていて, LDL^T 分解の第 k 段の前と同じになる)
+int cholesky_packed(double *a, int n)
+{
+    int i, k, t, len;
+    double d, inv, u;
+    double *rk, *restrict ri, *restrict rkj;
+
+    rk = a;
+    for (k = 1; k <= n; k++)
+    {
+        len = n - k + 1;
+        if (rk[0] <= 0.0)
+        {
+            return k;
+        }
+        d = sqrt(rk[0]);
+        rk[0] = d;
+        inv = 1.0 / d;
+        for (t = 1; t < len; t++)
+        {
+            rk[t] *= inv;
+        }
+
+        ri = rk + len;
+        for (i = k + 1; i <= n; i++)
+        {
+            u = rk[i - k];
+            rkj = rk + (i - k);
+            for (t = 0; t <= n - i; t++)
+            {
+                ri[t] -= u * rkj[t];
+            }
+            ri += n - i + 1;
+        }
+        rk += len;
+    }
+    return 0;
+}
+
+// cholesky_packed が第 k 段で止まったとき, 行 1..k-1 の U を LDL^T 分解の形 (対角に d, 右側に L^T) に直す
+void cholesky_to_ldlt(double *a, int n, int k)
+{
+    int i, t;
+    double u, *ri = a;
+
+    for (i = 1; i < k; i++)
+    {
+        u = ri[0];
+        ri[0] = u * u;
+        for (t = 1; t <= n - i; t++)
+        {
+            ri[t] /= u;
+        }
+        ri += n - i + 1;
+    }
+}
+
+// LDL^T 分解 A = L D L^T (ピボット選択なし, 不定値でもよい) を第 k0 段から行う
+// 対角に D, 対角より右に L^T (単位上三角) を上書きする
+void ldlt_packed(double *a, int n, int k0)
 {
-    int i, j, k;
-    int idx_ij, idx_ik, idx_kj, idx_kk;
-    double alpha, tmp;
-    double eps = pow(2.0, -50.0);
+    int i, k, t, len;
+    double d, l, eps = pow(2.0, -50.0);
+    double *rk, *restrict ri, *restrict rkj;
 
-    // 前進消去
-    for (k = 1; k <= n - 1; k++)
+    rk = a + (size_t)(k0 - 1) * n - (size_t)(k0 - 1) * (k0 - 2) / 2;
+    for (k = k0; k <= n; k++)
     {
-        // 対角要素のインデックス計算 (k,k)
-        idx_kk = get_upper_index(k, k, n);
-        
+        len = n - k + 1;
+        d = rk[0];
+
         // 正則性の判定
-        if (fabs(a[idx_kk]) < eps)
+        if (fabs(d) < eps)
         {
             fprintf(stderr, "係数行列が正則ではありません\n");
             exit(1);
         }
 
-        // 前進消去
+        ri = rk + len;
         for (i = k + 1; i <= n; i++)
         {
-            // (i,k)要素のインデックス計算（対称性により(k,i)と同じ）
-            idx_ik = get_upper_index(i, k, n);
-            
-            alpha = a[idx_ik] / a[idx_kk];
-            
-            for (j = k + 1; j <= n; j++)
+            l = rk[i - k] / d;
+            rkj = rk + (i - k);
+            for (t = 0; t <= n - i; t++)
             {
-                // (i,j)要素のインデックス計算
-                idx_ij = get_upper_index(i, j, n);
-                // (k,j)要素のインデックス計算
-                idx_kj = get_upper_index(k, j, n);
-                
-                a[idx_ij] -= alpha * a[idx_kj];
+                ri[t] -= l * rkj[t];
             }
-            b[i] -= alpha * b[k];
+            ri += n - i + 1;
+        }
+        for (t = 1; t < len; t++)
+        {
+            rk[t] /= d;
         }
+        rk += len;
     }
+}
 
-    // 後退代入
-    idx_kk = get_upper_index(n, n, n);  // (n,n)要素
-    b[n] = b[n] / a[idx_kk];
-    
-    for (k = n - 1; k >= 1; k--)
+// U^T U x = b を解いて b に x を上書きする
+void cholesky_solve_packed(double *a, double *b, int n)
+{
+    int i, t;
+    double tmp, *ri;
+
+    // U^T y = b (前進代入)
+    ri = a;
+    for (i = 1; i <= n; i++)
     {
-        tmp = b[k];
-        for (j = k + 1; j <= n; j++)
+        b[i] /= ri[0];
+        tmp = b[i];
+        for (t = 1; t <= n - i; t++)
         {
-            // (k,j)要素のインデックス計算
-            idx_kj = get_upper_index(k, j, n);
-            tmp -= a[idx_kj] * b[j];
+            b[i + t] -= ri[t] * tmp;
         }
-        // (k,k)要素のインデックス計算
-        idx_kk = get_upper_index(k, k, n);
-        b[k] = tmp / a[idx_kk];
+        ri += n - i + 1;
     }
 
-    return b;
+    // U x = y (後退代入, 最後の行から先頭へ戻る)
+    ri = a + (size_t)n * (n + 1) / 2 - 1;
+    for (i = n; i >= 1; i--)
+    {
+        tmp = b[i];
+        for (t = 1; t <= n - i; t++)
+        {
+            tmp -= ri[t] * b[i + t];
+        }
+        b[i] = tmp / ri[0];
+        if (i > 1) ri -= n - i + 2; // 先頭の行の後は戻らない (a より前を指さないように)
+    }
 }
 
+// L D L^T x = b を解いて b に x を上書きする
+void ldlt_solve_packed(double *a, double *b, int n)
+{
+    int i, t;
+    double tmp, *ri;
+
+    // L z = b (前進代入, L の対角は 1)
+    ri = a;
+    for (i = 1; i <= n; i++)
+    {
+        tmp = b[i];
+        for (t = 1; t <= n - i; t++)
+        {
+            b[i + t] -= ri[t] * tmp;
+        }
+        ri += n - i + 1;
+    }
 
+    // D y = z, L^T x = y (後退代入)
+    ri = a + (size_t)n * (n + 1) / 2 - 1;
+    for (i = n; i >= 1; i--)
+    {
+        tmp = b[i] / ri[0];
+        for (t = 1; t <= n - i; t++)
+        {
+            tmp -= ri[t] * b[i + t];
+        }
+        b[i] = tmp;
+        if (i > 1) ri -= n - i + 2;
+    }
+}
@@ -2,88 +2,607 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-int N;  // 行列のサイズ
-double *b;  // 右辺ベクトル
-double *x;  // 解ベクトル
-FILE *fp;
+// バイナリ行列ファイル (CRMAT, matconv で作成) のヘッダ: 64バイト
+#define CRMAT_MAGIC "CRMAT01"
+enum { CRMAT_DENSE = 0, CRMAT_UPPER = 1, CRMAT_BAND = 2, CRMAT_VECTOR = 3 };
+typedef struct {
+    char magic[8];
+    int32_t kind;         // 格納形式
+    int32_t symmetric;    // 1: 対称行列
+    int64_t rows;
+    int64_t cols;
+    int64_t bandwidth;    // 上側バンド幅 (対角を含む)
+    int64_t data_offset;  // データの開始位置
+    int64_t reserved[2];
+} CrmatHeader;
 
-void memory_allocate(double*** A, int n) {
-    int i;
-    if((*A = (double**)malloc(n * sizeof(double*))) == NULL){
-        printf("No memories are available (a)\n");
+// テキスト行列の並列パーサ
+// ファイルを改行位置で区切ったチャンクに分け, 各スレッドが1回の走査で数値・行数・列数を求める
+typedef struct {
+    double *val;     // 値 (行優先, rows x cols)
+    int rows;        // 空でない行の数
+    int cols;        // 1行あたりの値の数
+    int symmetric;   // 1: 正方かつ対称
+    int bandwidth;   // 上側バンド幅 (対角を含む)
+} TextMatrix;
+
+typedef struct {
+    const char *begin, *end;
+    const char *bad;   // 数値として読めなかった位置
+    double *val;
+    size_t count, cap;
+    int lines;
+    int first_cols;    // チャンク内の最初の行の値の数
+    int ragged;        // 値の数が違う行があった
+} TextChunk;
+
+static const double pow10_table[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// from_chars 相当の double 変換: 仮数が 2^53 以下かつ指数が ±22 以内なら正確に計算し,
+// それ以外 (桁数が多い, inf/nan など) は strtod に任せる. 読めなければ NULL を返す
+const char *parse_double(const char *p, const char *end, double *out){
+    const char *s = p, *q;
+    uint64_t m = 0;
+    int neg = 0, nd = 0, exp10 = 0, ex = 0, eneg = 0, digits = 0, exact = 1;
+    char buf[128];
+    char *e;
+    size_t len;
+
+    if(p < end && (*p == '-' || *p == '+')){
+        neg = (*p == '-');
+        p++;
+    }
+    for(; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+        if(nd < 19){
+            m = m * 10 + (*p - '0');
+            if(m != 0) nd++;
+        }else{
+            exp10++;
+            exact = 0;
+        }
+    }
+    if(p < end && *p == '.'){
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+            if(nd < 19){
+                m = m * 10 + (*p - '0');
+                if(m != 0) nd++;
+                exp10--;
+            }else{
+                exact = 0;
+            }
+        }
+    }
+    if(digits > 0 && p < end && (*p == 'e' || *p == 'E')){
+        q = p + 1;
+        if(q < end && (*q == '-' || *q == '+')){
+            eneg = (*q == '-');
+            q++;
+        }
+        if(q < end && *q >= '0' && *q <= '9'){
+            for(p = q; p < end && *p >= '0' && *p <= '9'; p++){
+                if(ex < 100000) ex = ex * 10 + (*p - '0');
+            }
+            exp10 += eneg ? -ex : ex;
+        }
+    }
+
+    if(digits > 0 && exact && m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22
+        && (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')){
+        *out = (exp10 < 0) ? (double)m / pow10_table[-exp10] : (double)m * pow10_table[exp10];
+        if(neg) *out = -*out;
+        return p;
+    }
+
+    // 低速経路: 空白までを切り出して strtod で変換する
+    for(q = s; q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n'; q++)
+        ;
+    len = (size_t)(q - s) < sizeof(buf) - 1 ? (size_t)(q - s) : sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *out = strtod(buf, &e);
+    if(e != buf + len) return NULL;
+    return q;
+}
+
+void parse_chunk(TextChunk *c){
+    const char *p = c->begin, *q;
+    int in_row = 0;
+
+    c->first_cols = -1;
+    c->cap = (size_t)(c->end - c->begin) / 8 + 16;
+    if((c->val = (double *)malloc(c->cap * sizeof(double))) == NULL){
+        c->bad = p;
+        return;
+    }
+
+    for(;;){
+        if(p == c->end || *p == '\n'){
+            // 空行は数えない (count_matrix_size と同じ扱い)
+            if(in_row > 0){
+                if(c->first_cols < 0) c->first_cols = in_row;
+                else if(in_row != c->first_cols) c->ragged = 1;
+                c->lines++;
+            }
+            if(p == c->end) break;
+            in_row = 0;
+            p++;
+            continue;
+        }
+        if(*p == ' ' || *p == '\t' || *p == '\r'){
+            p++;
+            continue;
+        }
+        if(c->count == c->cap){
+            c->cap *= 2;
+            if((c->val = (double *)realloc(c->val, c->cap * sizeof(double))) == NULL){
+                c->bad = p;
+                return;
+            }
+        }
+        if((q = parse_double(p, c->end, &c->val[c->count])) == NULL){
+            c->bad = p;
+            return;
+        }
+        c->count++;
+        in_row++;
+        p = q;
+    }
+}
+
+// ファイルを1回だけ読み, 値・サイズ・対称性・バンド幅をまとめて求める
+void text_parse(char *filename, TextMatrix *t){
+    int fd, nchunk, k, i, j, square, sym, bw;
+    struct stat st;
+    char *base;
+    const char *p;
+    size_t len, total, *offset;
+    TextChunk *chunk;
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+        printf("Cannot open file %s\n", filename);
+        exit(1);
+    }
+    len = st.st_size;
+    if(len == 0){
+        printf("File %s is empty\n", filename);
+        exit(1);
+    }
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        printf("mmap failed for %s\n", filename);
         exit(1);
     }
+    madvise(base, len, MADV_WILLNEED);
 
-    for(i = 0; i < n; i++){
-        if(((*A)[i] = (double*)malloc((n - i)* sizeof(double))) == NULL){
-            printf("No memories are available (A[%d])\n", i);
-            exit(1);
+    // スレッド数の4倍に分割 (1チャンク 1MB 以上)
+#ifdef _OPENMP
+    nchunk = omp_get_max_threads() * 4;
+#else
+    nchunk = 1;
+#endif
+    if((size_t)nchunk > len / (1 << 20)) nchunk = (int)(len / (1 << 20));
+    if(nchunk < 1) nchunk = 1;
+
+    chunk = (TextChunk *)calloc(nchunk, sizeof(TextChunk));
+    offset = (size_t *)malloc((nchunk + 1) * sizeof(size_t));
+    if(chunk == NULL || offset == NULL){
+        printf("No memories are available (chunk)\n");
+        exit(1);
+    }
+    // 区切りは必ず改行の直後に置く
+    p = base;
+    for(k = 0; k < nchunk; k++){
+        chunk[k].begin = p;
+        if(k == nchunk - 1){
+            p = base + len;
+        }else{
+            if(p < base + len * (k + 1) / nchunk) p = base + len * (k + 1) / nchunk;
+            while(p < base + len && *p != '\n') p++;
+            if(p < base + len) p++;
         }
+        chunk[k].end = p;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(k = 0; k < nchunk; k++){
+        parse_chunk(&chunk[k]);
     }
 
-    // bとxのメモリ割り当て
-    if((b = (double*)malloc(n * sizeof(double))) == NULL){
-        printf("No memories are available (b)\n");
+    t->rows = 0;
+    t->cols = -1;
+    total = 0;
+    for(k = 0; k < nchunk; k++){
+        if(chunk[k].bad != NULL){
+            printf("%s: invalid number at byte %ld\n", filename, (long)(chunk[k].bad - base));
+            exit(1);
+        }
+        if(chunk[k].first_cols >= 0){
+            if(t->cols < 0) t->cols = chunk[k].first_cols;
+            if(chunk[k].ragged || chunk[k].first_cols != t->cols){
+                printf("%s: rows have different numbers of values\n", filename);
+                exit(1);
+            }
+        }
+        offset[k] = total;
+        total += chunk[k].count;
+        t->rows += chunk[k].lines;
+    }
+    if(t->rows == 0){
+        printf("File %s has no values\n", filename);
         exit(1);
     }
-    if((x = (double*)malloc(n * sizeof(double))) == NULL){
-        printf("No memories are available (x)\n");
+
+    if((t->val = (double *)malloc(total * sizeof(double))) == NULL){
+        printf("No memories are available (%s)\n", filename);
         exit(1);
     }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(k = 0; k < nchunk; k++){
+        memcpy(t->val + offset[k], chunk[k].val, chunk[k].count * sizeof(double));
+        free(chunk[k].val);
+    }
+    free(chunk);
+    free(offset);
+    munmap(base, len);
+
+    // 対称性とバンド幅 (5_kadai の get_bandwidth と同じ定義)
+    square = (t->rows == t->cols);
+    sym = square;
+    bw = 0;
+    #pragma omp parallel for private(j) reduction(max:bw) reduction(&&:sym) schedule(static)
+    for(i = 0; i < t->rows; i++){
+        for(j = i; j < t->cols; j++){
+            if(t->val[(size_t)i * t->cols + j] != 0.0 && j - i + 1 > bw) bw = j - i + 1;
+            if(square && sym && t->val[(size_t)i * t->cols + j] != t->val[(size_t)j * t->cols + i]) sym = 0;
+        }
+    }
+    t->symmetric = sym;
+    t->bandwidth = (bw > 0) ? bw : 1;
 }
 
-void read_matrix(double** A, int n, char* matfile){
-    int i, j;
-    double tmp;
-    printf("Matrix file: %s\n", matfile);
+// CRMATファイルをmmapしてデータ部の先頭を返す（CRMATでなければNULL）
+// MAP_PRIVATEなので前進消去で書き換えてもファイルには反映されない
+double* binary_open(char* filename, CrmatHeader* h, size_t* map_len){
+    int fd;
+    struct stat st;
+    int64_t count;
+    char* p;
+
+    if((fd = open(filename, O_RDONLY)) < 0){
+        printf("Cannot open file %s\n", filename);
+        exit(1);
+    }
+    if(pread(fd, h, sizeof(CrmatHeader), 0) != sizeof(CrmatHeader)
+       || memcmp(h->magic, CRMAT_MAGIC, sizeof(h->magic)) != 0){
+        close(fd);
+        return NULL;
+    }
+
+    switch(h->kind){
+        case CRMAT_UPPER: count = h->rows * (h->rows + 1) / 2; break;
+        case CRMAT_BAND:  count = h->rows * h->bandwidth;      break;
+        default:          count = h->rows * h->cols;           break;
+    }
+    fstat(fd, &st);
+    if(h->data_offset + count * (int64_t)sizeof(double) > st.st_size){
+        printf("Binary file %s is truncated\n", filename);
+        exit(1);
+    }
 
-    if((fp = fopen(matfile, "r")) == NULL){
-        printf("Matrix file open error\n");
+    *map_len = st.st_size;
+    p = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        printf("mmap failed for %s\n", filename);
         exit(1);
     }
+    madvise(p, *map_len, MADV_SEQUENTIAL);
+    return (double*)(p + h->data_offset);
+}
 
-    // 行列Aの読み込み
+void binary_close(double* data, CrmatHeader* h, size_t map_len){
+    munmap((char*)data - h->data_offset, map_len);
+}
+
+// 行列データ (mmap またはテキストから読んだ領域) の各行の対角位置をA[i]に設定する（A[i][j-i] = a(i,j) となる）
+void binary_attach(double*** A, int n, double* data, CrmatHeader* h){
+    int i;
+
+    if(!h->symmetric || h->rows != h->cols){
+        printf("Matrix is not symmetric\n");
+        exit(1);
+    }
+    if(h->kind != CRMAT_DENSE && h->kind != CRMAT_UPPER){
+        printf("Binary matrix must be stored as dense or upper\n");
+        exit(1);
+    }
+    if((*A = (double**)malloc(n * sizeof(double*))) == NULL){
+        printf("No memories are available (a)\n");
+        exit(1);
+    }
     for(i = 0; i < n; i++){
-        for(j = 0; j < n; j++){
-            if(fscanf(fp, "%lf", &tmp) == EOF){
-                printf("Matrix file read error at position (%d,%d)\n", i, j);
-                exit(1);
+        if(h->kind == CRMAT_DENSE){
+            (*A)[i] = data + (size_t)i * n + i;
+        }else{
+            (*A)[i] = data + (size_t)i * n - (size_t)i * (i - 1) / 2;
+        }
+    }
+}
+
+// 行列積の減算 C -= op(A) B (op(A) は transa が 0 なら A (m x k), 1 なら A^T (A: k x m),
+// B: k x n, いずれも行優先で行の間隔は lda, ldb, ldc)
+// B を KC x NC, op(A) を MC x KC のブロックに切り出して連続領域にパックし,
+// MR x NR のマイクロカーネルで C の小行列をレジスタに置いたまま k 方向に足し込む (0_kadai の GEMM_DEFINE と同じ構成)
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MR 4   // マイクロカーネルは4行固定
+#define GEMM_NR 8
+
+// NR 要素を1つのベクトルとして扱う (GCC のベクトル拡張, 使える SIMD 命令に展開される)
+typedef double gemm_vec __attribute__((vector_size(GEMM_NR * sizeof(double))));
+
+// MR = 4 行分のアキュムレータをレジスタに置く
+static void gemm_kernel(int kc, const double *restrict a, const double *restrict b,
+                        double *restrict c, size_t ldc, int mr, int nr){
+    gemm_vec acc[GEMM_MR], c0, c1, c2, c3, bv;
+    double out[GEMM_NR];
+    int p, r, s;
+
+    memset(&c0, 0, sizeof(c0));
+    c1 = c2 = c3 = c0;
+    for(p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR){
+        memcpy(&bv, b, sizeof(bv));
+        c0 += a[0] * bv;
+        c1 += a[1] * bv;
+        c2 += a[2] * bv;
+        c3 += a[3] * bv;
+    }
+    acc[0] = c0;
+    acc[1] = c1;
+    acc[2] = c2;
+    acc[3] = c3;
+    for(r = 0; r < mr; r++){
+        memcpy(out, &acc[r], sizeof(out));
+        for(s = 0; s < nr; s++){
+            c[r * ldc + s] -= out[s];
+        }
+    }
+}
+
+// op(A) の mc x kc ブロックを MR 行ずつの帯に分け, 帯の中は列順に並べる (端は 0 で埋める)
+// A^T の場合は A の行をそのまま読む
+static void gemm_pack_a(int transa, int mc, int kc, const double *a, size_t lda, double *ap){
+    int i, p, r;
+
+    for(i = 0; i < mc; i += GEMM_MR){
+        for(p = 0; p < kc; p++){
+            for(r = 0; r < GEMM_MR; r++){
+                if(i + r >= mc){
+                    *ap++ = 0.0;
+                }else{
+                    *ap++ = transa ? a[(size_t)p * lda + i + r] : a[(size_t)(i + r) * lda + p];
+                }
             }
-            if(j >= i){
-                A[i][j-i] = tmp;
-            }else{
-                if(tmp != A[j][i-j]){
-                    printf("Matrix is not symmetric\n");
+        }
+    }
+}
+
+// B の kc x nc ブロックを NR 列ずつの帯に分け, 帯の中は行順に並べる (端は 0 で埋める)
+static void gemm_pack_b(int kc, int nc, const double *b, size_t ldb, double *bp){
+    int p, s;
+
+    for(p = 0; p < kc; p++){
+        for(s = 0; s < GEMM_NR; s++){
+            bp[p * GEMM_NR + s] = (s < nc) ? b[(size_t)p * ldb + s] : 0.0;
+        }
+    }
+}
+
+void gemm_sub(int transa, int m, int n, int k, const double *a, size_t lda, const double *b, size_t ldb,
+              double *c, size_t ldc){
+    int jc, pc, nc, kc;
+    int ncmax = (n < GEMM_NC) ? n : GEMM_NC, mcmax = (m < GEMM_MC) ? m : GEMM_MC;
+    double *bp;
+
+    if(m <= 0 || n <= 0 || k <= 0) return;
+    if(posix_memalign((void**)&bp, 64, sizeof(double) * GEMM_KC * (ncmax + GEMM_NR)) != 0){
+        printf("No memories are available (gemm)\n");
+        exit(1);
+    }
+
+    for(jc = 0; jc < n; jc += GEMM_NC){
+        nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+        for(pc = 0; pc < k; pc += GEMM_KC){
+            kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            #pragma omp parallel
+            {
+                double *ap;
+                int ic, ir, jr, mc;
+
+                #pragma omp for schedule(static)
+                for(jr = 0; jr < nc; jr += GEMM_NR){
+                    gemm_pack_b(kc, nc - jr, b + (size_t)pc * ldb + jc + jr, ldb, bp + (size_t)jr * kc);
+                }
+                if(posix_memalign((void**)&ap, 64, sizeof(double) * GEMM_KC * (mcmax + GEMM_MR)) != 0){
+                    printf("No memories are available (gemm)\n");
                     exit(1);
                 }
+                #pragma omp for schedule(dynamic)
+                for(ic = 0; ic < m; ic += GEMM_MC){
+                    mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                    gemm_pack_a(transa, mc, kc, transa ? a + (size_t)pc * lda + ic : a + (size_t)ic * lda + pc, lda, ap);
+                    for(jr = 0; jr < nc; jr += GEMM_NR){
+                        for(ir = 0; ir < mc; ir += GEMM_MR){
+                            gemm_kernel(kc, ap + (size_t)ir * kc, bp + (size_t)jr * kc,
+                                        c + (size_t)(ic + ir) * ldc + jc + jr, ldc,
+                                        (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR,
+                                        (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR);
+                        }
+                    }
+                }
+                free(ap);
             }
         }
     }
+    free(bp);
+}
+
+// タイル (nb x nb) のコレスキー分解 A = U^T U (上三角だけを使い, U を上書きする)
+// 正定値でなければ -1 を返す
+static int chol_tile_potrf(int nb, double *a, size_t lda){
+    int i, j, k;
+    double d, *ak, *ai;
 
-    fclose(fp);
+    for(k = 0; k < nb; k++){
+        ak = a + (size_t)k * lda;
+        if(ak[k] <= 0.0) return -1;
+        d = sqrt(ak[k]);
+        ak[k] = d;
+        for(j = k+1; j < nb; j++){
+            ak[j] /= d;
+        }
+        for(i = k+1; i < nb; i++){
+            ai = a + (size_t)i * lda;
+            for(j = i; j < nb; j++){
+                ai[j] -= ak[i] * ak[j];
+            }
+        }
+    }
+    return 0;
 }
 
-void read_vector(int n, char* vecfile){
-    int i;
-    printf("Vector file: %s\n", vecfile);
+// U^T X = B を解いて B に X を上書きする (U: kb x kb 上三角, B: kb x nb)
+static void chol_tile_trsm(int kb, int nb, const double *u, size_t ldu, double *b, size_t ldb){
+    int i, j, p;
+    double *restrict bp, *restrict bi, upi;
 
-    if((fp = fopen(vecfile, "r")) == NULL){
-        printf("Vector file open error\n");
+    for(p = 0; p < kb; p++){
+        bp = b + (size_t)p * ldb;
+        for(j = 0; j < nb; j++){
+            bp[j] /= u[(size_t)p * ldu + p];
+        }
+        for(i = p+1; i < kb; i++){
+            upi = u[(size_t)p * ldu + i];
+            bi = b + (size_t)i * ldb;
+            for(j = 0; j < nb; j++){
+                bi[j] -= upi * bp[j];
+            }
+        }
+    }
+}
+
+// タイル版のコレスキー分解 A = U^T U (U は行優先 n x n, 行の間隔 ldu の上三角に上書きする)
+// 行列を CHOL_NB x CHOL_NB のタイルに分け, 各ステップ k について
+//   POTRF(k)    : 対角タイル (k, k) の分解
+//   TRSM(k, j)  : A_kj <- U_kk^{-T} A_kj
+//   SYRK(j, k)  : A_jj -= A_kj^T A_kj
+//   GEMM(i,j,k) : A_ij -= A_ki^T A_kj  (k < i < j)
+// をタスクとして作り, tile[i][j] への depend で入力がそろったものから空いたスレッドが実行する.
+// fork-join のブロック版と違い, 次の対角タイルの分解が前のステップの残りの更新と重なる.
+// 正定値でなければ -1 を返す
+#define CHOL_NB 256
+
+int cholesky_dag(int n, double *U, size_t ldu){
+    int nt = (n + CHOL_NB - 1) / CHOL_NB;
+    int i, j, k, failed = 0;
+    char (*tile)[nt] = malloc(sizeof(char) * nt * nt); // 依存関係の目印 (中身は使わない)
+
+    if(tile == NULL){
+        printf("No memories are available (tile)\n");
         exit(1);
     }
 
-    // 右辺ベクトルbの読み込み
-    for(i = 0; i < n; i++){
-        if(fscanf(fp, "%lf", &b[i]) == EOF){
-            printf("Vector file read error\n");
-            exit(1);
+    #pragma omp parallel private(i, j, k)
+    #pragma omp single
+    {
+        for(k = 0; k < nt; k++){
+            int k0 = k * CHOL_NB, kb = (n - k0 < CHOL_NB) ? n - k0 : CHOL_NB;
+            double *ukk = U + (size_t)k0 * ldu + k0;
+
+            #pragma omp task firstprivate(kb, ukk) depend(inout: tile[k][k]) priority(2)
+            {
+                int f;
+                #pragma omp atomic read
+                f = failed;
+                if(!f && chol_tile_potrf(kb, ukk, ldu) != 0){
+                    #pragma omp atomic write
+                    failed = 1;
+                }
+            }
+
+            for(j = k+1; j < nt; j++){
+                int j0 = j * CHOL_NB, jb = (n - j0 < CHOL_NB) ? n - j0 : CHOL_NB;
+                double *ukj = U + (size_t)k0 * ldu + j0;
+
+                #pragma omp task firstprivate(kb, jb, ukk, ukj) depend(in: tile[k][k]) depend(inout: tile[k][j]) priority(j == k+1 ? 1 : 0)
+                {
+                    int f;
+                    #pragma omp atomic read
+                    f = failed;
+                    if(!f) chol_tile_trsm(kb, jb, ukk, ldu, ukj, ldu);
+                }
+            }
+
+            for(i = k+1; i < nt; i++){
+                for(j = i; j < nt; j++){
+                    int i0 = i * CHOL_NB, ib = (n - i0 < CHOL_NB) ? n - i0 : CHOL_NB;
+                    int j0 = j * CHOL_NB, jb = (n - j0 < CHOL_NB) ? n - j0 : CHOL_NB;
+                    double *uki = U + (size_t)k0 * ldu + i0;
+                    double *ukj = U + (size_t)k0 * ldu + j0;
+                    double *uij = U + (size_t)i0 * ldu + j0;
+
+                    // i == j は SYRK (対角タイルは下側も計算するが, 使うのは上三角だけ)
+                    #pragma omp task firstprivate(kb, ib, jb, uki, ukj, uij) depend(in: tile[k][i], tile[k][j]) depend(inout: tile[i][j]) priority(i == k+1 ? 1 : 0)
+                    {
+                        int f;
+                        #pragma omp atomic read
+                        f = failed;
+                        if(!f) gemm_sub(1, ib, jb, kb, uki, ldu, ukj, ldu, uij, ldu);
+                    }
+                }
+            }
         }
     }
 
-    fclose(fp);
+    free(tile);
+    return failed ? -1 : 0;
 }
 
+// U x = B を解いて B に X を上書きする (U: kb x kb 上三角, B: kb x nb)
+static void chol_tile_trsm_upper(int kb, int nb, const double *u, size_t ldu, double *b, size_t ldb){
+    int i, j, p;
+    double *restrict bp, *restrict bi, uip;
+
+    for(i = kb-1; i >= 0; i--){
+        bi = b + (size_t)i * ldb;
+        for(p = i+1; p < kb; p++){
+            uip = u[(size_t)i * ldu + p];
+            bp = b + (size_t)p * ldb;
+            for(j = 0; j < nb; j++){
+                bi[j] -= uip * bp[j];
+            }
+        }
+        for(j = 0; j < nb; j++){
+            bi[j] /= u[(size_t)i * ldu + i];
+        }
+    }
+}
+
+// 消去法 (ピボット選択なし) で A を上三角に書き換える. 第 i 段の乗数は A[i][j-i]/A[i][0] として残る
 void forward_erase(double** A, int n){
     int i, j, k;
     double tmp;
@@ -95,63 +614,326 @@ void forward_erase(double** A, int n){
         }
         for(j = i+1; j < n; j++){
             tmp = A[i][j-i]/A[i][0];
-            b[j] -= tmp * b[i];
             for(k = j; k < n; k++){
                 A[j][k-j] -= tmp * A[i][k-i];
             }
         }
     }
+    if(A[n-1][0] == 0.0){
+        printf("Division by zero at i=%d\n", n-1);
+        exit(1);
+    }
+}
+
+// スカイライン (プロファイル) 形式: 上三角を列ごとに, 各列の最初の非零から対角までだけ持つ.
+// 列 j は a(first[j], j), ..., a(j, j) の順に連続して置く. LDL^T 分解のフィルインはこの範囲の中に収まる
+typedef struct {
+    int n;
+    int *first;      // 列 j の最初の非零の行
+    double *val;     // 全列を続けて置いた領域
+    double **col;    // col[j][i] = a(i, j) (first[j] <= i <= j)
+    size_t size;     // 格納する要素数 (プロファイル)
+} Skyline;
+
+// 各列の最初の非零の行を求め, 格納する要素数を返す (A[i][t] = a(i, i+t), 行 i は対角から bw 個まで)
+size_t skyline_profile(double** A, int n, int bw, int* first){
+    int i, t, w;
+    size_t size = 0;
+
+    for(i = 0; i < n; i++){
+        first[i] = i;
+    }
+    for(i = 0; i < n; i++){
+        w = (n - i < bw) ? n - i : bw;
+        for(t = 1; t < w; t++){
+            if(A[i][t] != 0.0 && first[i+t] == i+t) first[i+t] = i;
+        }
+    }
+    for(i = 0; i < n; i++){
+        size += i - first[i] + 1;
+    }
+    return size;
 }
 
-void backward_assignment(double** A, int n){
+// skyline_profile で求めた first (Skyline が引き取る) の範囲だけを A から写す
+Skyline* skyline_create(double** A, int n, int* first){
+    Skyline *s;
     int i, j;
+    size_t pos;
 
-    for(i = n-1; i >= 0; i--){
-        for(j = i+1; j < n; j++){
-            b[i] -= A[i][j-i] * x[j];
+    if((s = (Skyline*)malloc(sizeof(Skyline))) == NULL
+       || (s->col = (double**)malloc(n * sizeof(double*))) == NULL){
+        printf("No memories are available (skyline)\n");
+        exit(1);
+    }
+    s->n = n;
+    s->first = first;
+    s->size = 0;
+    for(j = 0; j < n; j++){
+        s->size += j - s->first[j] + 1;
+    }
+    if(posix_memalign((void**)&s->val, 64, s->size * sizeof(double)) != 0){
+        printf("No memories are available (skyline)\n");
+        exit(1);
+    }
+    pos = 0;
+    for(j = 0; j < n; j++){
+        s->col[j] = s->val + pos - s->first[j];
+        pos += j - s->first[j] + 1;
+    }
+    #pragma omp parallel for private(i) schedule(dynamic, 64)
+    for(j = 0; j < n; j++){
+        for(i = s->first[j]; i <= j; i++){
+            s->col[j][i] = A[i][j-i];
         }
-        if(A[i][0] == 0.0){
-            printf("Division by zero at i=%d\n", i);
+    }
+    return s;
+}
+
+void skyline_free(Skyline* s){
+    free(s->val);
+    free(s->col);
+    free(s->first);
+    free(s);
+}
+
+// スカイラインの LDL^T 分解 (列ごとの左方向版, ピボット選択なし)
+// 列 j について g(i,j) = a(i,j) - sum_k u(k,i) g(k,j) を求め, u(i,j) = g(i,j)/d(i), d(j) = a(j,j) - sum_i u(i,j) g(i,j).
+// 和は2つの列の重なる範囲の内積で, どちらも連続領域を読む. 対角に D, その上に U = L^T を上書きする
+void skyline_ldlt(Skyline* s){
+    int n = s->n, i, j, k, k0, fj;
+    double *restrict cj, *restrict ci, sum, d, g, u;
+
+    for(j = 0; j < n; j++){
+        cj = s->col[j];
+        fj = s->first[j];
+        for(i = fj+1; i < j; i++){
+            ci = s->col[i];
+            k0 = (s->first[i] > fj) ? s->first[i] : fj;
+            sum = 0.0;
+            for(k = k0; k < i; k++){
+                sum += ci[k] * cj[k];
+            }
+            cj[i] -= sum;
+        }
+        d = cj[j];
+        for(i = fj; i < j; i++){
+            g = cj[i];
+            u = g / s->col[i][i];
+            cj[i] = u;
+            d -= u * g;
+        }
+        if(d == 0.0){
+            printf("Division by zero at i=%d\n", j);
             exit(1);
         }
-        x[i] = b[i]/A[i][0];
+        cj[j] = d;
     }
 }
 
-void print_solution(int n){
-    int i;
-    printf("\nSolution:\n");
+// 行優先の作業領域 W (n x nb) の右辺をスカイラインの LDL^T で解く
+void skyline_solve(Skyline* s, double* W, int nb){
+    int n = s->n, i, j, k;
+    double *restrict wi, *restrict wj, u;
+
+    // U^T Z = B
+    for(j = 0; j < n; j++){
+        wj = W + (size_t)j * nb;
+        for(i = s->first[j]; i < j; i++){
+            u = s->col[j][i];
+            wi = W + (size_t)i * nb;
+            for(k = 0; k < nb; k++){
+                wj[k] -= u * wi[k];
+            }
+        }
+    }
+    // Y = D^{-1} Z
+    for(j = 0; j < n; j++){
+        wj = W + (size_t)j * nb;
+        u = 1.0 / s->col[j][j];
+        for(k = 0; k < nb; k++){
+            wj[k] *= u;
+        }
+    }
+    // U X = Y
+    for(j = n-1; j >= 0; j--){
+        wj = W + (size_t)j * nb;
+        for(i = s->first[j]; i < j; i++){
+            u = s->col[j][i];
+            wi = W + (size_t)i * nb;
+            for(k = 0; k < nb; k++){
+                wi[k] -= u * wj[k];
+            }
+        }
+    }
+}
+
+// 分解の結果: 一度作れば右辺を何本でも解ける
+enum { FACTOR_CHOLESKY, FACTOR_ELIMINATION, FACTOR_SKYLINE };
+typedef struct {
+    int kind;
+    int n;
+    double *U;     // FACTOR_CHOLESKY: U^T U = A (行優先, 行の間隔 ldu)
+    size_t ldu;
+    double **A;    // FACTOR_ELIMINATION: forward_erase 後の A (呼び出し側の領域)
+    Skyline *sky;  // FACTOR_SKYLINE: スカイラインの LDL^T
+} Factor;
+
+// プロファイルが上三角の 1/4 より小さければスカイラインの LDL^T 分解を行う.
+// そうでなければ上三角を作業領域に写してタイル版のコレスキー分解を行う (A 自体は書き換えない).
+// 正定値でなければ A を消去法で書き換える
+Factor* factor_create(double** A, int n){
+    Factor *f;
+    int i, j, *first;
+    size_t size;
+
+    if((f = (Factor*)malloc(sizeof(Factor))) == NULL || (first = (int*)malloc(n * sizeof(int))) == NULL){
+        printf("No memories are available (factor)\n");
+        exit(1);
+    }
+    f->n = n;
+    f->A = A;
+    f->U = NULL;
+    f->sky = NULL;
+
+    size = skyline_profile(A, n, n, first);
+    if(size * 4 < (size_t)n * (n + 1) / 2){
+        printf("Profile: %zu of %zu entries (skyline LDL^T)\n", size, (size_t)n * (n + 1) / 2);
+        f->kind = FACTOR_SKYLINE;
+        f->sky = skyline_create(A, n, first);
+        skyline_ldlt(f->sky);
+        return f;
+    }
+    free(first);
+
+    f->ldu = ((size_t)n + 7) & ~(size_t)7;
+    if(posix_memalign((void**)&f->U, 64, sizeof(double) * f->ldu * n) != 0){
+        printf("No memories are available (U)\n");
+        exit(1);
+    }
+    #pragma omp parallel for private(j) schedule(static)
     for(i = 0; i < n; i++){
-        printf("x[%d] = %f\n", i, x[i]);
+        for(j = i; j < n; j++){
+            f->U[(size_t)i * f->ldu + j] = A[i][j-i];
+        }
+    }
+    if(cholesky_dag(n, f->U, f->ldu) == 0){
+        f->kind = FACTOR_CHOLESKY;
+    }else{
+        printf("Matrix is not positive definite; using Gaussian elimination\n");
+        free(f->U);
+        f->U = NULL;
+        f->kind = FACTOR_ELIMINATION;
+        forward_erase(A, n);
     }
+    return f;
+}
+
+void factor_free(Factor* f){
+    free(f->U);
+    if(f->sky != NULL) skyline_free(f->sky);
+    free(f);
 }
 
-int count_matrix_size(char* filename) {
-    FILE* fp;
-    int size = 0;
-    char line[1024];
+// 右辺 nrhs 本 (B は列優先 n x nrhs, 列の間隔 ldb) を解いて B に解を上書きする.
+// SOLVE_NB 本ずつ行優先の作業領域に並べ替え, 前進・後退代入の各行の演算を右辺方向に連続させる.
+// コレスキー分解の場合は CHOL_NB 行ごとのブロックに分け, 対角ブロックの三角解法と残りの行への
+// 行列積 (gemm_sub) で代入を行う
+#define SOLVE_NB 64
 
-    if((fp = fopen(filename, "r")) == NULL){
-        printf("Cannot open file %s for size counting\n", filename);
+void factor_solve(Factor* f, double* B, int nrhs, size_t ldb){
+    int n = f->n, c0, nb, i, j, k, k0, kb;
+    double *W, *restrict wi, *restrict wj, tmp;
+
+    if(posix_memalign((void**)&W, 64, sizeof(double) * n * SOLVE_NB) != 0){
+        printf("No memories are available (solve)\n");
         exit(1);
     }
+    for(c0 = 0; c0 < nrhs; c0 += SOLVE_NB){
+        nb = (nrhs - c0 < SOLVE_NB) ? nrhs - c0 : SOLVE_NB;
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nb; j++){
+                W[(size_t)i * nb + j] = B[(size_t)(c0 + j) * ldb + i];
+            }
+        }
 
-    // 空でない行の数を数える
-    while(fgets(line, sizeof(line), fp) != NULL) {
-        if(strlen(line) > 1) { // 改行文字のみの行は無視
-            size++;
+        if(f->kind == FACTOR_SKYLINE){
+            skyline_solve(f->sky, W, nb);
+        }else if(f->kind == FACTOR_CHOLESKY){
+            // U^T Y = B
+            for(k0 = 0; k0 < n; k0 += CHOL_NB){
+                kb = (n - k0 < CHOL_NB) ? n - k0 : CHOL_NB;
+                chol_tile_trsm(kb, nb, f->U + (size_t)k0 * f->ldu + k0, f->ldu, W + (size_t)k0 * nb, nb);
+                gemm_sub(1, n - k0 - kb, nb, kb, f->U + (size_t)k0 * f->ldu + k0 + kb, f->ldu,
+                         W + (size_t)k0 * nb, nb, W + (size_t)(k0 + kb) * nb, nb);
+            }
+            // U X = Y
+            for(k0 = (n - 1) / CHOL_NB * CHOL_NB; k0 >= 0; k0 -= CHOL_NB){
+                kb = (n - k0 < CHOL_NB) ? n - k0 : CHOL_NB;
+                gemm_sub(0, kb, nb, n - k0 - kb, f->U + (size_t)k0 * f->ldu + k0 + kb, f->ldu,
+                         W + (size_t)(k0 + kb) * nb, nb, W + (size_t)k0 * nb, nb);
+                chol_tile_trsm_upper(kb, nb, f->U + (size_t)k0 * f->ldu + k0, f->ldu, W + (size_t)k0 * nb, nb);
+            }
+        }else{
+            // 前進消去で右辺に施していた操作 (乗数は A[k][j-k]/A[k][0])
+            for(k = 0; k < n-1; k++){
+                wi = W + (size_t)k * nb;
+                for(j = k+1; j < n; j++){
+                    tmp = f->A[k][j-k] / f->A[k][0];
+                    wj = W + (size_t)j * nb;
+                    for(i = 0; i < nb; i++){
+                        wj[i] -= tmp * wi[i];
+                    }
+                }
+            }
+            // 後退代入
+            for(k = n-1; k >= 0; k--){
+                wi = W + (size_t)k * nb;
+                for(j = k+1; j < n; j++){
+                    tmp = f->A[k][j-k];
+                    wj = W + (size_t)j * nb;
+                    for(i = 0; i < nb; i++){
+                        wi[i] -= tmp * wj[i];
+                    }
+                }
+                for(i = 0; i < nb; i++){
+                    wi[i] /= f->A[k][0];
+                }
+            }
+        }
+
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nb; j++){
+                B[(size_t)(c0 + j) * ldb + i] = W[(size_t)i * nb + j];
+            }
         }
     }
+    free(W);
+}
 
-    fclose(fp);
-    return size;
+// 解の表示 (X は列優先 n x nrhs, 右辺が複数なら1行に各右辺の解を並べる)
+void print_solution(int n, double* X, int nrhs){
+    int i, j;
+    printf("\nSolution:\n");
+    for(i = 0; i < n; i++){
+        printf("x[%d] =", i);
+        for(j = 0; j < nrhs; j++){
+            printf(" %f", X[(size_t)j * n + i]);
+        }
+        printf("\n");
+    }
 }
 
 int main(int argc, char *argv[]){
     double **A;
+    double *A_map, *b_map, *B, *X;
+    CrmatHeader mh, vh;
+    TextMatrix mt, vt;
+    Factor *f;
+    size_t A_len = 0, b_len = 0;
     char *matrix_file = NULL;
     char *vector_file = NULL;
-    int opt;
+    int opt, n, nrhs, i, j;
 
     // コマンドライン引数の解析
     while((opt = getopt(argc, argv, "a:b:")) != -1) {
@@ -174,26 +956,83 @@ int main(int argc, char *argv[]){
         exit(1);
     }
 
-    // 行列のサイズを自動的に判定
-    N = count_matrix_size(matrix_file);
-    printf("Matrix size: %d x %d\n", N, N);
+    // CRMAT形式ならヘッダからサイズと対称性が分かるので, 読み込まずにmmapで使う
+    if((A_map = binary_open(matrix_file, &mh, &A_len)) != NULL){
+        n = (int)mh.rows;
+        printf("Matrix size: %d x %d (binary)\n", n, n);
+        binary_attach(&A, n, A_map, &mh);
+    }else{
+        // テキストは1回の並列走査でサイズ・対称性まで求め, 読んだ領域をそのまま使う
+        printf("Matrix file: %s\n", matrix_file);
+        text_parse(matrix_file, &mt);
+        n = mt.rows;
+        printf("Matrix size: %d x %d\n", n, n);
+        memset(&mh, 0, sizeof(mh));
+        mh.kind = CRMAT_DENSE;
+        mh.rows = mt.rows;
+        mh.cols = mt.cols;
+        mh.symmetric = mt.symmetric;
+        mh.bandwidth = mt.bandwidth;
+        binary_attach(&A, n, mt.val, &mh);
+    }
+
+    // 右辺: バイナリは列優先 n x nrhs, テキストは1行に各右辺の第 i 成分を並べる (1行に n 個なら右辺1本)
+    if((b_map = binary_open(vector_file, &vh, &b_len)) != NULL){
+        if(vh.kind != CRMAT_VECTOR || vh.rows != n){
+            printf("Binary vector must have %d rows\n", n);
+            exit(1);
+        }
+        nrhs = (int)vh.cols;
+        B = b_map;
+    }else{
+        printf("Vector file: %s\n", vector_file);
+        text_parse(vector_file, &vt);
+        if(vt.rows == n){
+            nrhs = vt.cols;
+        }else if(vt.rows == 1 && vt.cols == n){
+            nrhs = 1;
+        }else{
+            printf("Vector file read error\n");
+            exit(1);
+        }
+        B = vt.val;
+    }
+    if(nrhs > 1){
+        printf("Right-hand sides: %d\n", nrhs);
+    }
+    if((X = (double*)malloc(sizeof(double) * n * nrhs)) == NULL){
+        printf("No memories are available (x)\n");
+        exit(1);
+    }
+    if(b_map != NULL || nrhs == 1){
+        memcpy(X, B, sizeof(double) * n * nrhs);
+    }else{
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nrhs; j++){
+                X[(size_t)j * n + i] = B[(size_t)i * nrhs + j];
+            }
+        }
+    }
 
-    memory_allocate(&A, N);
-    read_matrix(A, N, matrix_file);
-    read_vector(N, vector_file);
-    
     printf("\nSolving the system...\n");
-    forward_erase(A, N);
-    backward_assignment(A, N);
-    print_solution(N);
+    f = factor_create(A, n);
+    factor_solve(f, X, nrhs, n);
+    print_solution(n, X, nrhs);
 
     // メモリの解放
-    for(int i = 0; i < N; i++){
-        free(A[i]);
+    factor_free(f);
+    if(A_map != NULL){
+        binary_close(A_map, &mh, A_len);
+    }else{
+        free(mt.val);
     }
     free(A);
-    free(b);
-    free(x);
+    if(b_map != NULL){
+        binary_close(b_map, &vh, b_len);
+    }else{
+        free(B);
+    }
+    free(X);
 
     return 0;
-}
\ No newline at end of file
+}
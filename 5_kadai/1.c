@@ -2,207 +2,1354 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-int N;  // 行列のサイズ
-int B;  // バンド幅
-double *b;  // 右辺ベクトル
-double *x;  // 解ベクトル
-FILE *fp;
+// バイナリ行列ファイル (CRMAT, matconv で作成) のヘッダ: 64バイト
+#define CRMAT_MAGIC "CRMAT01"
+enum { CRMAT_DENSE = 0, CRMAT_UPPER = 1, CRMAT_BAND = 2, CRMAT_VECTOR = 3 };
+typedef struct {
+    char magic[8];
+    int32_t kind;         // 格納形式
+    int32_t symmetric;    // 1: 対称行列
+    int64_t rows;
+    int64_t cols;
+    int64_t bandwidth;    // 上側バンド幅 (対角を含む)
+    int64_t data_offset;  // データの開始位置
+    int64_t reserved[2];
+} CrmatHeader;
 
-// バンド幅を計算する関数
-int get_bandwidth(char* matfile, int n) {
-    FILE* fp_band;
-    int i, j;
-    double tmp;
-    int bandwidth = 0;
+// テキスト行列の並列パーサ
+// ファイルを改行位置で区切ったチャンクに分け, 各スレッドが1回の走査で数値・行数・列数を求める
+typedef struct {
+    double *val;     // 値 (行優先, rows x cols)
+    int rows;        // 空でない行の数
+    int cols;        // 1行あたりの値の数
+    int symmetric;   // 1: 正方かつ対称
+    int bandwidth;   // 上側バンド幅 (対角を含む)
+} TextMatrix;
+
+typedef struct {
+    const char *begin, *end;
+    const char *bad;   // 数値として読めなかった位置
+    double *val;
+    size_t count, cap;
+    int lines;
+    int first_cols;    // チャンク内の最初の行の値の数
+    int ragged;        // 値の数が違う行があった
+} TextChunk;
+
+static const double pow10_table[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    if ((fp_band = fopen(matfile, "r")) == NULL) {
-        printf("Matrix file open error for bandwidth calculation\n");
+// from_chars 相当の double 変換: 仮数が 2^53 以下かつ指数が ±22 以内なら正確に計算し,
+// それ以外 (桁数が多い, inf/nan など) は strtod に任せる. 読めなければ NULL を返す
+const char *parse_double(const char *p, const char *end, double *out){
+    const char *s = p, *q;
+    uint64_t m = 0;
+    int neg = 0, nd = 0, exp10 = 0, ex = 0, eneg = 0, digits = 0, exact = 1;
+    char buf[128];
+    char *e;
+    size_t len;
+
+    if(p < end && (*p == '-' || *p == '+')){
+        neg = (*p == '-');
+        p++;
+    }
+    for(; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+        if(nd < 19){
+            m = m * 10 + (*p - '0');
+            if(m != 0) nd++;
+        }else{
+            exp10++;
+            exact = 0;
+        }
+    }
+    if(p < end && *p == '.'){
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++, digits++){
+            if(nd < 19){
+                m = m * 10 + (*p - '0');
+                if(m != 0) nd++;
+                exp10--;
+            }else{
+                exact = 0;
+            }
+        }
+    }
+    if(digits > 0 && p < end && (*p == 'e' || *p == 'E')){
+        q = p + 1;
+        if(q < end && (*q == '-' || *q == '+')){
+            eneg = (*q == '-');
+            q++;
+        }
+        if(q < end && *q >= '0' && *q <= '9'){
+            for(p = q; p < end && *p >= '0' && *p <= '9'; p++){
+                if(ex < 100000) ex = ex * 10 + (*p - '0');
+            }
+            exp10 += eneg ? -ex : ex;
+        }
+    }
+
+    if(digits > 0 && exact && m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22
+        && (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')){
+        *out = (exp10 < 0) ? (double)m / pow10_table[-exp10] : (double)m * pow10_table[exp10];
+        if(neg) *out = -*out;
+        return p;
+    }
+
+    // 低速経路: 空白までを切り出して strtod で変換する
+    for(q = s; q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n'; q++)
+        ;
+    len = (size_t)(q - s) < sizeof(buf) - 1 ? (size_t)(q - s) : sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *out = strtod(buf, &e);
+    if(e != buf + len) return NULL;
+    return q;
+}
+
+void parse_chunk(TextChunk *c){
+    const char *p = c->begin, *q;
+    int in_row = 0;
+
+    c->first_cols = -1;
+    c->cap = (size_t)(c->end - c->begin) / 8 + 16;
+    if((c->val = (double *)malloc(c->cap * sizeof(double))) == NULL){
+        c->bad = p;
+        return;
+    }
+
+    for(;;){
+        if(p == c->end || *p == '\n'){
+            // 空行は数えない (count_matrix_size と同じ扱い)
+            if(in_row > 0){
+                if(c->first_cols < 0) c->first_cols = in_row;
+                else if(in_row != c->first_cols) c->ragged = 1;
+                c->lines++;
+            }
+            if(p == c->end) break;
+            in_row = 0;
+            p++;
+            continue;
+        }
+        if(*p == ' ' || *p == '\t' || *p == '\r'){
+            p++;
+            continue;
+        }
+        if(c->count == c->cap){
+            c->cap *= 2;
+            if((c->val = (double *)realloc(c->val, c->cap * sizeof(double))) == NULL){
+                c->bad = p;
+                return;
+            }
+        }
+        if((q = parse_double(p, c->end, &c->val[c->count])) == NULL){
+            c->bad = p;
+            return;
+        }
+        c->count++;
+        in_row++;
+        p = q;
+    }
+}
+
+// ファイルを1回だけ読み, 値・サイズ・対称性・バンド幅をまとめて求める
+void text_parse(char *filename, TextMatrix *t){
+    int fd, nchunk, k, i, j, square, sym, bw;
+    struct stat st;
+    char *base;
+    const char *p;
+    size_t len, total, *offset;
+    TextChunk *chunk;
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+        printf("Cannot open file %s\n", filename);
+        exit(1);
+    }
+    len = st.st_size;
+    if(len == 0){
+        printf("File %s is empty\n", filename);
         exit(1);
     }
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        printf("mmap failed for %s\n", filename);
+        exit(1);
+    }
+    madvise(base, len, MADV_WILLNEED);
+
+    // スレッド数の4倍に分割 (1チャンク 1MB 以上)
+#ifdef _OPENMP
+    nchunk = omp_get_max_threads() * 4;
+#else
+    nchunk = 1;
+#endif
+    if((size_t)nchunk > len / (1 << 20)) nchunk = (int)(len / (1 << 20));
+    if(nchunk < 1) nchunk = 1;
 
-    for (i = 0; i < n; i++) {
-        for (j = 0; j < n; j++) {
-            if (fscanf(fp_band, "%lf", &tmp) != 1) {
-                printf("Matrix file read error during bandwidth calculation at (%d, %d)\n", i, j);
-                fclose(fp_band);
+    chunk = (TextChunk *)calloc(nchunk, sizeof(TextChunk));
+    offset = (size_t *)malloc((nchunk + 1) * sizeof(size_t));
+    if(chunk == NULL || offset == NULL){
+        printf("No memories are available (chunk)\n");
+        exit(1);
+    }
+    // 区切りは必ず改行の直後に置く
+    p = base;
+    for(k = 0; k < nchunk; k++){
+        chunk[k].begin = p;
+        if(k == nchunk - 1){
+            p = base + len;
+        }else{
+            if(p < base + len * (k + 1) / nchunk) p = base + len * (k + 1) / nchunk;
+            while(p < base + len && *p != '\n') p++;
+            if(p < base + len) p++;
+        }
+        chunk[k].end = p;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(k = 0; k < nchunk; k++){
+        parse_chunk(&chunk[k]);
+    }
+
+    t->rows = 0;
+    t->cols = -1;
+    total = 0;
+    for(k = 0; k < nchunk; k++){
+        if(chunk[k].bad != NULL){
+            printf("%s: invalid number at byte %ld\n", filename, (long)(chunk[k].bad - base));
+            exit(1);
+        }
+        if(chunk[k].first_cols >= 0){
+            if(t->cols < 0) t->cols = chunk[k].first_cols;
+            if(chunk[k].ragged || chunk[k].first_cols != t->cols){
+                printf("%s: rows have different numbers of values\n", filename);
                 exit(1);
             }
-            if (j >= i && tmp != 0.0) {
-                if (j - i + 1 > bandwidth) {
-                    bandwidth = j - i + 1;
-                }
-            }
         }
+        offset[k] = total;
+        total += chunk[k].count;
+        t->rows += chunk[k].lines;
+    }
+    if(t->rows == 0){
+        printf("File %s has no values\n", filename);
+        exit(1);
+    }
+
+    if((t->val = (double *)malloc(total * sizeof(double))) == NULL){
+        printf("No memories are available (%s)\n", filename);
+        exit(1);
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(k = 0; k < nchunk; k++){
+        memcpy(t->val + offset[k], chunk[k].val, chunk[k].count * sizeof(double));
+        free(chunk[k].val);
     }
+    free(chunk);
+    free(offset);
+    munmap(base, len);
 
-    fclose(fp_band);
-    return bandwidth;
+    // 対称性とバンド幅 (5_kadai の get_bandwidth と同じ定義)
+    square = (t->rows == t->cols);
+    sym = square;
+    bw = 0;
+    #pragma omp parallel for private(j) reduction(max:bw) reduction(&&:sym) schedule(static)
+    for(i = 0; i < t->rows; i++){
+        for(j = i; j < t->cols; j++){
+            if(t->val[(size_t)i * t->cols + j] != 0.0 && j - i + 1 > bw) bw = j - i + 1;
+            if(square && sym && t->val[(size_t)i * t->cols + j] != t->val[(size_t)j * t->cols + i]) sym = 0;
+        }
+    }
+    t->symmetric = sym;
+    t->bandwidth = (bw > 0) ? bw : 1;
 }
 
-void memory_allocate(double*** A, int n, int b_width) {
+// CRMATファイルをmmapしてデータ部の先頭を返す（CRMATでなければNULL）
+// MAP_PRIVATEなので前進消去で書き換えてもファイルには反映されない
+double* binary_open(char* filename, CrmatHeader* h, size_t* map_len){
+    int fd;
+    struct stat st;
+    int64_t count;
+    char* p;
+
+    if((fd = open(filename, O_RDONLY)) < 0){
+        printf("Cannot open file %s\n", filename);
+        exit(1);
+    }
+    if(pread(fd, h, sizeof(CrmatHeader), 0) != sizeof(CrmatHeader)
+       || memcmp(h->magic, CRMAT_MAGIC, sizeof(h->magic)) != 0){
+        close(fd);
+        return NULL;
+    }
+
+    switch(h->kind){
+        case CRMAT_UPPER: count = h->rows * (h->rows + 1) / 2; break;
+        case CRMAT_BAND:  count = h->rows * h->bandwidth;      break;
+        default:          count = h->rows * h->cols;           break;
+    }
+    fstat(fd, &st);
+    if(h->data_offset + count * (int64_t)sizeof(double) > st.st_size){
+        printf("Binary file %s is truncated\n", filename);
+        exit(1);
+    }
+
+    *map_len = st.st_size;
+    p = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        printf("mmap failed for %s\n", filename);
+        exit(1);
+    }
+    madvise(p, *map_len, MADV_SEQUENTIAL);
+    return (double*)(p + h->data_offset);
+}
+
+void binary_close(double* data, CrmatHeader* h, size_t map_len){
+    munmap((char*)data - h->data_offset, map_len);
+}
+
+// 行列データ (mmap またはテキストから読んだ領域) の各行の対角位置をA[i]に設定する（A[i][j-i] = a(i,j) となる）
+// バンド形式は行ごとに b_width 個, 密・上三角形式もバンド内しか参照しないのでそのまま使える
+void binary_attach(double*** A, int n, double* data, CrmatHeader* h){
     int i;
+
+    if(!h->symmetric || h->rows != h->cols || h->kind == CRMAT_VECTOR){
+        printf("Matrix is not symmetric\n");
+        exit(1);
+    }
     if((*A = (double**)malloc(n * sizeof(double*))) == NULL){
         printf("No memories are available (a)\n");
         exit(1);
     }
-
     for(i = 0; i < n; i++){
-        if(((*A)[i] = (double*)malloc(b_width * sizeof(double))) == NULL){
-            printf("No memories are available (A[%d])\n", i);
-            exit(1);
+        if(h->kind == CRMAT_BAND){
+            (*A)[i] = data + (size_t)i * h->bandwidth;
+        }else if(h->kind == CRMAT_UPPER){
+            (*A)[i] = data + (size_t)i * n - (size_t)i * (i - 1) / 2;
+        }else{
+            (*A)[i] = data + (size_t)i * n + i;
         }
     }
+}
 
-    // bとxのメモリ割り当て
-    if((b = (double*)malloc(n * sizeof(double))) == NULL){
-        printf("No memories are available (b)\n");
-        exit(1);
+// 行列積の減算 C -= op(A) B (op(A) は transa が 0 なら A (m x k), 1 なら A^T (A: k x m),
+// B: k x n, いずれも行優先で行の間隔は lda, ldb, ldc)
+// B を KC x NC, op(A) を MC x KC のブロックに切り出して連続領域にパックし,
+// MR x NR のマイクロカーネルで C の小行列をレジスタに置いたまま k 方向に足し込む (0_kadai の GEMM_DEFINE と同じ構成).
+// バンドの更新では小さな行列積を何度も呼ぶので, 作業領域は k に合わせて確保し, 小さいときはスレッドを起こさない
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MR 4   // マイクロカーネルは4行固定
+#define GEMM_NR 8
+
+// NR 要素を1つのベクトルとして扱う (GCC のベクトル拡張, 使える SIMD 命令に展開される)
+typedef double gemm_vec __attribute__((vector_size(GEMM_NR * sizeof(double))));
+
+// MR = 4 行分のアキュムレータをレジスタに置く
+static void gemm_kernel(int kc, const double *restrict a, const double *restrict b,
+                        double *restrict c, size_t ldc, int mr, int nr){
+    gemm_vec acc[GEMM_MR], c0, c1, c2, c3, bv;
+    double out[GEMM_NR];
+    int p, r, s;
+
+    memset(&c0, 0, sizeof(c0));
+    c1 = c2 = c3 = c0;
+    for(p = 0; p < kc; p++, a += GEMM_MR, b += GEMM_NR){
+        memcpy(&bv, b, sizeof(bv));
+        c0 += a[0] * bv;
+        c1 += a[1] * bv;
+        c2 += a[2] * bv;
+        c3 += a[3] * bv;
     }
-    if((x = (double*)malloc(n * sizeof(double))) == NULL){
-        printf("No memories are available (x)\n");
-        exit(1);
+    acc[0] = c0;
+    acc[1] = c1;
+    acc[2] = c2;
+    acc[3] = c3;
+    for(r = 0; r < mr; r++){
+        memcpy(out, &acc[r], sizeof(out));
+        for(s = 0; s < nr; s++){
+            c[r * ldc + s] -= out[s];
+        }
     }
 }
 
-void read_matrix(double** A, int n, int b_width, char* matfile){
-    int i, j;
-    double tmp;
-    printf("Matrix file: %s\n", matfile);
+// op(A) の mc x kc ブロックを MR 行ずつの帯に分け, 帯の中は列順に並べる (端は 0 で埋める)
+// A^T の場合は A の行をそのまま読む
+static void gemm_pack_a(int transa, int mc, int kc, const double *a, size_t lda, double *ap){
+    int i, p, r;
 
-    if((fp = fopen(matfile, "r")) == NULL){
-        printf("Matrix file open error\n");
+    for(i = 0; i < mc; i += GEMM_MR){
+        for(p = 0; p < kc; p++){
+            for(r = 0; r < GEMM_MR; r++){
+                if(i + r >= mc){
+                    *ap++ = 0.0;
+                }else{
+                    *ap++ = transa ? a[(size_t)p * lda + i + r] : a[(size_t)(i + r) * lda + p];
+                }
+            }
+        }
+    }
+}
+
+// B の kc x nc ブロックを NR 列ずつの帯に分け, 帯の中は行順に並べる (端は 0 で埋める)
+static void gemm_pack_b(int kc, int nc, const double *b, size_t ldb, double *bp){
+    int p, s;
+
+    for(p = 0; p < kc; p++){
+        for(s = 0; s < GEMM_NR; s++){
+            bp[p * GEMM_NR + s] = (s < nc) ? b[(size_t)p * ldb + s] : 0.0;
+        }
+    }
+}
+
+void gemm_sub(int transa, int m, int n, int k, const double *a, size_t lda, const double *b, size_t ldb,
+              double *c, size_t ldc){
+    int jc, pc, nc, kc;
+    int ncmax = (n < GEMM_NC) ? n : GEMM_NC, mcmax = (m < GEMM_MC) ? m : GEMM_MC;
+    int kcmax = (k < GEMM_KC) ? k : GEMM_KC;
+    double *bp;
+
+    if(m <= 0 || n <= 0 || k <= 0) return;
+    if(posix_memalign((void**)&bp, 64, sizeof(double) * kcmax * (ncmax + GEMM_NR)) != 0){
+        printf("No memories are available (gemm)\n");
         exit(1);
     }
 
-    // バンド行列Aを0で初期化
-    for(i=0; i<n; i++) {
-        for(j=0; j<b_width; j++) {
-            A[i][j] = 0.0;
+    for(jc = 0; jc < n; jc += GEMM_NC){
+        nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+        for(pc = 0; pc < k; pc += GEMM_KC){
+            kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            #pragma omp parallel if((double)m * nc * kc >= 1e6)
+            {
+                double *ap;
+                int ic, ir, jr, mc;
+
+                #pragma omp for schedule(static)
+                for(jr = 0; jr < nc; jr += GEMM_NR){
+                    gemm_pack_b(kc, nc - jr, b + (size_t)pc * ldb + jc + jr, ldb, bp + (size_t)jr * kc);
+                }
+                if(posix_memalign((void**)&ap, 64, sizeof(double) * kcmax * (mcmax + GEMM_MR)) != 0){
+                    printf("No memories are available (gemm)\n");
+                    exit(1);
+                }
+                #pragma omp for schedule(dynamic)
+                for(ic = 0; ic < m; ic += GEMM_MC){
+                    mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                    gemm_pack_a(transa, mc, kc, transa ? a + (size_t)pc * lda + ic : a + (size_t)ic * lda + pc, lda, ap);
+                    for(jr = 0; jr < nc; jr += GEMM_NR){
+                        for(ir = 0; ir < mc; ir += GEMM_MR){
+                            gemm_kernel(kc, ap + (size_t)ir * kc, bp + (size_t)jr * kc,
+                                        c + (size_t)(ic + ir) * ldc + jc + jr, ldc,
+                                        (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR,
+                                        (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR);
+                        }
+                    }
+                }
+                free(ap);
+            }
         }
     }
+    free(bp);
+}
+
+// タイル (nb x nb) のコレスキー分解 A = U^T U (上三角だけを使い, U を上書きする)
+// 正定値でなければ -1 を返す
+static int chol_tile_potrf(int nb, double *a, size_t lda){
+    int i, j, k;
+    double d, *ak, *ai;
+
+    for(k = 0; k < nb; k++){
+        ak = a + (size_t)k * lda;
+        if(ak[k] <= 0.0) return -1;
+        d = sqrt(ak[k]);
+        ak[k] = d;
+        for(j = k+1; j < nb; j++){
+            ak[j] /= d;
+        }
+        for(i = k+1; i < nb; i++){
+            ai = a + (size_t)i * lda;
+            for(j = i; j < nb; j++){
+                ai[j] -= ak[i] * ak[j];
+            }
+        }
+    }
+    return 0;
+}
 
-    // 行列Aの読み込み
+// U^T X = B を解いて B に X を上書きする (U: kb x kb 上三角, B: kb x nb)
+static void chol_tile_trsm(int kb, int nb, const double *u, size_t ldu, double *b, size_t ldb){
+    int i, j, p;
+    double *restrict bp, *restrict bi, upi;
+
+    for(p = 0; p < kb; p++){
+        bp = b + (size_t)p * ldb;
+        for(j = 0; j < nb; j++){
+            bp[j] /= u[(size_t)p * ldu + p];
+        }
+        for(i = p+1; i < kb; i++){
+            upi = u[(size_t)p * ldu + i];
+            bi = b + (size_t)i * ldb;
+            for(j = 0; j < nb; j++){
+                bi[j] -= upi * bp[j];
+            }
+        }
+    }
+}
+
+// バンド行列の連続領域 (LAPACK の pbtrf と同じ並び)
+// 行 i の a(i,i), ..., a(i,i+bw-1) を ab[i*bw + (j-i)] に置き, 行列の外 (j >= n) は 0 にする.
+// a(i,j) は ab + i*(bw-1) + j にあるので, バンド内の小行列は行の間隔 bw-1 の普通の行列として扱える
+void band_fill(double* ab, double** A, int n, int bw){
+    int i, w;
+
+    #pragma omp parallel for private(w) schedule(static)
     for(i = 0; i < n; i++){
-        for(j = 0; j < n; j++){
-            if(fscanf(fp, "%lf", &tmp) == EOF){
-                printf("Matrix file read error at position (%d,%d)\n", i, j);
-                exit(1);
+        w = (n - i < bw) ? n - i : bw;
+        memcpy(ab + (size_t)i * bw, A[i], w * sizeof(double));
+        memset(ab + (size_t)i * bw + w, 0, (bw - w) * sizeof(double));
+    }
+}
+
+double* band_create(double** A, int n, int bw){
+    double *ab;
+
+    if(posix_memalign((void**)&ab, 64, sizeof(double) * n * bw) != 0){
+        printf("No memories are available (band)\n");
+        exit(1);
+    }
+    band_fill(ab, A, n, bw);
+    return ab;
+}
+
+// バンドのコレスキー分解 A = U^T U (U を ab に上書きする). 正定値でなければ -1 を返す
+// 第 k 段で更新する範囲は行 k のバンド (幅 w) の中に収まるので, 内側のループは境界の判定なしで回る
+int band_cholesky(double* ab, int n, int bw){
+    int i, k, t, w;
+    double d, u, *rk, *restrict ri, *restrict rkj;
+
+    for(k = 0; k < n; k++){
+        rk = ab + (size_t)k * bw;
+        w = (n - k < bw) ? n - k : bw;
+        if(rk[0] <= 0.0) return -1;
+        d = sqrt(rk[0]);
+        rk[0] = d;
+        for(t = 1; t < w; t++){
+            rk[t] /= d;
+        }
+        for(i = 1; i < w; i++){
+            u = rk[i];
+            ri = rk + (size_t)i * bw;   // 行 k+i
+            rkj = rk + i;
+            for(t = 0; t < w - i; t++){
+                ri[t] -= u * rkj[t];
             }
-            if(j >= i){
-                if (j - i < b_width) {
-                    A[i][j-i] = tmp;
-                }
-            } else { // j < i
-                if (i - j < b_width) {
-                    if(tmp != A[j][i-j]){
-                        printf("Matrix is not symmetric at (%d, %d)\n", i, j);
-                        exit(1);
+        }
+    }
+    return 0;
+}
+
+// ブロック版のバンドコレスキー分解 (バンド幅が BAND_BLOCKED 以上のとき用, LAPACK の pbtrf と同じ手順)
+// BAND_NB 行ずつ, 対角ブロックの分解 → 右側のブロック U12 を作業領域に写して三角解法 →
+// 右下 A22 -= U12^T U12 を行列積で更新する. A22 の対角をまたぐタイルだけは上三角を直接更新する
+// (下三角はバンド領域の別の要素と重なるので書いてはいけない)
+#define BAND_NB 32
+#define BAND_BLOCKED 192   // これより狭いバンドでは行列積が小さすぎて非ブロック版の方が速い
+
+int band_cholesky_blocked(double* ab, int n, int bw){
+    int L = bw - 1, k0, kb, m, p, qmax, i, j, i0, ti;
+    double *W, *a11, *a12, *a22, *restrict ci, *restrict wp, wpi;
+
+    if(posix_memalign((void**)&W, 64, sizeof(double) * BAND_NB * L) != 0){
+        printf("No memories are available (band)\n");
+        exit(1);
+    }
+    for(k0 = 0; k0 < n; k0 += BAND_NB){
+        kb = (n - k0 < BAND_NB) ? n - k0 : BAND_NB;
+        a11 = ab + (size_t)k0 * bw;
+        if(chol_tile_potrf(kb, a11, L) != 0){
+            free(W);
+            return -1;
+        }
+        // 右側の列 k0+kb, ..., k0+kb+m-1 (行 k0+kb-1 のバンドの右端まで)
+        m = (n - k0 - kb < L) ? n - k0 - kb : L;
+        if(m <= 0) continue;
+        a12 = a11 + kb;
+        a22 = ab + (size_t)(k0 + kb) * bw;
+
+        // U12 を写す. 行 k0+p のバンドは列 k0+p+L までなので, その先は 0
+        for(p = 0; p < kb; p++){
+            qmax = L - kb + p + 1;
+            if(qmax > m) qmax = m;
+            memcpy(W + (size_t)p * m, a12 + (size_t)p * L, qmax * sizeof(double));
+            memset(W + (size_t)p * m + qmax, 0, (m - qmax) * sizeof(double));
+        }
+        chol_tile_trsm(kb, m, a11, L, W, m);
+        for(p = 0; p < kb; p++){
+            qmax = L - kb + p + 1;
+            if(qmax > m) qmax = m;
+            memcpy(a12 + (size_t)p * L, W + (size_t)p * m, qmax * sizeof(double));
+        }
+
+        // A22 -= U12^T U12 (上三角のみ)
+        for(i0 = 0; i0 < m; i0 += BAND_NB){
+            ti = (m - i0 < BAND_NB) ? m - i0 : BAND_NB;
+            for(p = 0; p < kb; p++){
+                wp = W + (size_t)p * m;
+                for(i = i0; i < i0 + ti; i++){
+                    wpi = wp[i];
+                    ci = a22 + (size_t)i * L;
+                    for(j = i; j < i0 + ti; j++){
+                        ci[j] -= wpi * wp[j];
                     }
                 }
             }
+            gemm_sub(1, ti, m - i0 - ti, kb, W + i0, m, W + i0 + ti, m, a22 + (size_t)i0 * L + i0 + ti, L);
         }
     }
+    free(W);
+    return 0;
+}
 
-    fclose(fp);
+// バンドの LDL^T 分解 (ピボット選択なし, 不定値でもよい)
+// 対角に D, 対角より右に L^T (単位上三角) を上書きする
+void band_ldlt(double* ab, int n, int bw){
+    int i, k, t, w;
+    double d, l, *rk, *restrict ri, *restrict rkj;
+
+    for(k = 0; k < n; k++){
+        rk = ab + (size_t)k * bw;
+        w = (n - k < bw) ? n - k : bw;
+        d = rk[0];
+        if(d == 0.0){
+            printf("Division by zero at i=%d\n", k);
+            exit(1);
+        }
+        for(i = 1; i < w; i++){
+            l = rk[i] / d;
+            ri = rk + (size_t)i * bw;
+            rkj = rk + i;
+            for(t = 0; t < w - i; t++){
+                ri[t] -= l * rkj[t];
+            }
+        }
+        for(t = 1; t < w; t++){
+            rk[t] /= d;
+        }
+    }
 }
 
-void read_vector(int n, char* vecfile){
-    int i;
-    printf("Vector file: %s\n", vecfile);
+// スカイライン (プロファイル) 形式: 上三角を列ごとに, 各列の最初の非零から対角までだけ持つ.
+// 列 j は a(first[j], j), ..., a(j, j) の順に連続して置く. LDL^T 分解のフィルインはこの範囲の中に収まる
+typedef struct {
+    int n;
+    int *first;      // 列 j の最初の非零の行
+    double *val;     // 全列を続けて置いた領域
+    double **col;    // col[j][i] = a(i, j) (first[j] <= i <= j)
+    size_t size;     // 格納する要素数 (プロファイル)
+} Skyline;
 
-    if((fp = fopen(vecfile, "r")) == NULL){
-        printf("Vector file open error\n");
+// 各列の最初の非零の行を求め, 格納する要素数を返す (A[i][t] = a(i, i+t), 行 i は対角から bw 個まで)
+size_t skyline_profile(double** A, int n, int bw, int* first){
+    int i, t, w;
+    size_t size = 0;
+
+    for(i = 0; i < n; i++){
+        first[i] = i;
+    }
+    for(i = 0; i < n; i++){
+        w = (n - i < bw) ? n - i : bw;
+        for(t = 1; t < w; t++){
+            if(A[i][t] != 0.0 && first[i+t] == i+t) first[i+t] = i;
+        }
+    }
+    for(i = 0; i < n; i++){
+        size += i - first[i] + 1;
+    }
+    return size;
+}
+
+// skyline_profile で求めた first (Skyline が引き取る) の範囲だけを A から写す
+Skyline* skyline_create(double** A, int n, int* first){
+    Skyline *s;
+    int i, j;
+    size_t pos;
+
+    if((s = (Skyline*)malloc(sizeof(Skyline))) == NULL
+       || (s->col = (double**)malloc(n * sizeof(double*))) == NULL){
+        printf("No memories are available (skyline)\n");
+        exit(1);
+    }
+    s->n = n;
+    s->first = first;
+    s->size = 0;
+    for(j = 0; j < n; j++){
+        s->size += j - s->first[j] + 1;
+    }
+    if(posix_memalign((void**)&s->val, 64, s->size * sizeof(double)) != 0){
+        printf("No memories are available (skyline)\n");
         exit(1);
     }
+    pos = 0;
+    for(j = 0; j < n; j++){
+        s->col[j] = s->val + pos - s->first[j];
+        pos += j - s->first[j] + 1;
+    }
+    #pragma omp parallel for private(i) schedule(dynamic, 64)
+    for(j = 0; j < n; j++){
+        for(i = s->first[j]; i <= j; i++){
+            s->col[j][i] = A[i][j-i];
+        }
+    }
+    return s;
+}
 
-    // 右辺ベクトルbの読み込み
-    for(i = 0; i < n; i++){
-        if(fscanf(fp, "%lf", &b[i]) == EOF){
-            printf("Vector file read error\n");
+void skyline_free(Skyline* s){
+    free(s->val);
+    free(s->col);
+    free(s->first);
+    free(s);
+}
+
+// スカイラインの LDL^T 分解 (列ごとの左方向版, ピボット選択なし)
+// 列 j について g(i,j) = a(i,j) - sum_k u(k,i) g(k,j) を求め, u(i,j) = g(i,j)/d(i), d(j) = a(j,j) - sum_i u(i,j) g(i,j).
+// 和は2つの列の重なる範囲の内積で, どちらも連続領域を読む. 対角に D, その上に U = L^T を上書きする
+void skyline_ldlt(Skyline* s){
+    int n = s->n, i, j, k, k0, fj;
+    double *restrict cj, *restrict ci, sum, d, g, u;
+
+    for(j = 0; j < n; j++){
+        cj = s->col[j];
+        fj = s->first[j];
+        for(i = fj+1; i < j; i++){
+            ci = s->col[i];
+            k0 = (s->first[i] > fj) ? s->first[i] : fj;
+            sum = 0.0;
+            for(k = k0; k < i; k++){
+                sum += ci[k] * cj[k];
+            }
+            cj[i] -= sum;
+        }
+        d = cj[j];
+        for(i = fj; i < j; i++){
+            g = cj[i];
+            u = g / s->col[i][i];
+            cj[i] = u;
+            d -= u * g;
+        }
+        if(d == 0.0){
+            printf("Division by zero at i=%d\n", j);
             exit(1);
         }
+        cj[j] = d;
     }
+}
+
+// 行優先の作業領域 W (n x nb) の右辺をスカイラインの LDL^T で解く
+void skyline_solve(Skyline* s, double* W, int nb){
+    int n = s->n, i, j, k;
+    double *restrict wi, *restrict wj, u;
 
-    fclose(fp);
+    // U^T Z = B
+    for(j = 0; j < n; j++){
+        wj = W + (size_t)j * nb;
+        for(i = s->first[j]; i < j; i++){
+            u = s->col[j][i];
+            wi = W + (size_t)i * nb;
+            for(k = 0; k < nb; k++){
+                wj[k] -= u * wi[k];
+            }
+        }
+    }
+    // Y = D^{-1} Z
+    for(j = 0; j < n; j++){
+        wj = W + (size_t)j * nb;
+        u = 1.0 / s->col[j][j];
+        for(k = 0; k < nb; k++){
+            wj[k] *= u;
+        }
+    }
+    // U X = Y
+    for(j = n-1; j >= 0; j--){
+        wj = W + (size_t)j * nb;
+        for(i = s->first[j]; i < j; i++){
+            u = s->col[j][i];
+            wi = W + (size_t)i * nb;
+            for(k = 0; k < nb; k++){
+                wi[k] -= u * wj[k];
+            }
+        }
+    }
 }
 
-void forward_erase(double** A, int n, int b_width){
-    int i, j, k;
-    double tmp;
-    int k_limit;
+// 分解の結果: 一度作れば右辺を何本でも解ける
+enum { FACTOR_CHOLESKY, FACTOR_LDLT, FACTOR_SKYLINE };
+typedef struct {
+    int kind;
+    int n;
+    int bw;        // バンド幅 (対角を含む)
+    double *ab;    // 分解したバンド (band_create の並び)
+    Skyline *sky;  // FACTOR_SKYLINE: スカイラインの LDL^T
+} Factor;
 
-    for(i = 0; i < n-1; i++){
-        if(A[i][0] == 0.0){
-            printf("Division by zero at i=%d\n", i);
-            exit(1);
+// プロファイルがバンド領域 (n x bw) の半分より小さければスカイラインの LDL^T 分解を行う.
+// そうでなければ A をバンドの連続領域に写してコレスキー分解する (バンド幅が BAND_BLOCKED 以上ならブロック版).
+// 正定値でなければ写し直して LDL^T 分解を行う
+Factor* factor_create(double** A, int n, int bw){
+    Factor *f;
+    int rc, *first;
+    size_t size;
+
+    if((f = (Factor*)malloc(sizeof(Factor))) == NULL || (first = (int*)malloc(n * sizeof(int))) == NULL){
+        printf("No memories are available (factor)\n");
+        exit(1);
+    }
+    f->n = n;
+    f->bw = bw;
+    f->ab = NULL;
+    f->sky = NULL;
+
+    size = skyline_profile(A, n, bw, first);
+    if(size * 2 < (size_t)n * bw){
+        printf("Profile: %zu of %zu entries (skyline LDL^T)\n", size, (size_t)n * bw);
+        f->kind = FACTOR_SKYLINE;
+        f->sky = skyline_create(A, n, first);
+        skyline_ldlt(f->sky);
+        return f;
+    }
+    free(first);
+
+    f->ab = band_create(A, n, bw);
+    rc = (bw >= BAND_BLOCKED) ? band_cholesky_blocked(f->ab, n, bw) : band_cholesky(f->ab, n, bw);
+    if(rc == 0){
+        f->kind = FACTOR_CHOLESKY;
+    }else{
+        printf("Matrix is not positive definite; using LDL^T\n");
+        band_fill(f->ab, A, n, bw);
+        band_ldlt(f->ab, n, bw);
+        f->kind = FACTOR_LDLT;
+    }
+    return f;
+}
+
+void factor_free(Factor* f){
+    free(f->ab);
+    if(f->sky != NULL) skyline_free(f->sky);
+    free(f);
+}
+
+// 行優先の作業領域 W (n x nb) の右辺をバンドの分解で解く
+void band_solve(Factor* f, double* W, int nb){
+    int n = f->n, bw = f->bw, i, j, k, w;
+    double *restrict wk, *restrict wj, *rk, tmp;
+
+    // U^T Y = B (コレスキー) または L Z = B, Y = D^{-1} Z (LDL^T)
+    for(k = 0; k < n; k++){
+        rk = f->ab + (size_t)k * bw;
+        w = (n - k < bw) ? n - k : bw;
+        wk = W + (size_t)k * nb;
+        if(f->kind == FACTOR_CHOLESKY){
+            for(i = 0; i < nb; i++){
+                wk[i] /= rk[0];
+            }
         }
-        for(j = i+1; j < i + b_width && j < n; j++){
-            tmp = A[i][j-i]/A[i][0];
-            b[j] -= tmp * b[i];
-            k_limit = i + b_width;
-            if (k_limit > n) k_limit = n;
-            for(k = j; k < k_limit; k++){
-                 if (j-i < b_width && k-i < b_width && k-j < b_width) {
-                    A[j][k-j] -= tmp * A[i][k-i];
-                }
+        for(j = 1; j < w; j++){
+            tmp = rk[j];
+            wj = W + (size_t)(k + j) * nb;
+            for(i = 0; i < nb; i++){
+                wj[i] -= tmp * wk[i];
+            }
+        }
+        if(f->kind == FACTOR_LDLT){
+            for(i = 0; i < nb; i++){
+                wk[i] /= rk[0];
+            }
+        }
+    }
+    // U X = Y (コレスキー) または L^T X = Y (LDL^T)
+    for(k = n-1; k >= 0; k--){
+        rk = f->ab + (size_t)k * bw;
+        w = (n - k < bw) ? n - k : bw;
+        wk = W + (size_t)k * nb;
+        for(j = 1; j < w; j++){
+            tmp = rk[j];
+            wj = W + (size_t)(k + j) * nb;
+            for(i = 0; i < nb; i++){
+                wk[i] -= tmp * wj[i];
+            }
+        }
+        if(f->kind == FACTOR_CHOLESKY){
+            for(i = 0; i < nb; i++){
+                wk[i] /= rk[0];
             }
         }
     }
 }
 
-void backward_assignment(double** A, int n, int b_width){
-    int i, j;
+// 右辺 nrhs 本 (B は列優先 n x nrhs, 列の間隔 ldb) を解いて B に解を上書きする.
+// SOLVE_NB 本ずつ行優先の作業領域に並べ替え, 前進・後退代入の各行の演算を右辺方向に連続させる
+// (バンドの1要素を読むごとに SOLVE_NB 本分の演算ができる)
+#define SOLVE_NB 64
+
+void factor_solve(Factor* f, double* B, int nrhs, size_t ldb){
+    int n = f->n, c0, nb, i, j;
+    double *W;
+
+    if(posix_memalign((void**)&W, 64, sizeof(double) * n * SOLVE_NB) != 0){
+        printf("No memories are available (solve)\n");
+        exit(1);
+    }
+    for(c0 = 0; c0 < nrhs; c0 += SOLVE_NB){
+        nb = (nrhs - c0 < SOLVE_NB) ? nrhs - c0 : SOLVE_NB;
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nb; j++){
+                W[(size_t)i * nb + j] = B[(size_t)(c0 + j) * ldb + i];
+            }
+        }
+
+        if(f->kind == FACTOR_SKYLINE){
+            skyline_solve(f->sky, W, nb);
+        }else{
+            band_solve(f, W, nb);
+        }
+
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nb; j++){
+                B[(size_t)(c0 + j) * ldb + i] = W[(size_t)i * nb + j];
+            }
+        }
+    }
+    free(W);
+}
+
+// 並べ替え: 行列のグラフ (CSR 形式の隣接リスト), 頂点 i の隣接頂点は adj[ptr[i]], ..., adj[ptr[i+1]-1]
+typedef struct {
+    int n;
+    int *ptr;
+    int *adj;
+} Graph;
+
+#define DEGREE(g, i) ((g)->ptr[(i)+1] - (g)->ptr[i])
+
+// バンド内の非零 a(i,j) (i != j) を辺とするグラフを作る
+Graph* graph_create(double** A, int n, int bw){
+    Graph *g;
+    int i, t, w, *pos;
+
+    if((g = (Graph*)malloc(sizeof(Graph))) == NULL
+       || (g->ptr = (int*)calloc(n + 1, sizeof(int))) == NULL
+       || (pos = (int*)malloc(n * sizeof(int))) == NULL){
+        printf("No memories are available (graph)\n");
+        exit(1);
+    }
+    g->n = n;
+    for(i = 0; i < n; i++){
+        w = (n - i < bw) ? n - i : bw;
+        for(t = 1; t < w; t++){
+            if(A[i][t] != 0.0){
+                g->ptr[i+1]++;
+                g->ptr[i+t+1]++;
+            }
+        }
+    }
+    for(i = 0; i < n; i++){
+        g->ptr[i+1] += g->ptr[i];
+        pos[i] = g->ptr[i];
+    }
+    if((g->adj = (int*)malloc(((size_t)g->ptr[n] + 1) * sizeof(int))) == NULL){
+        printf("No memories are available (graph)\n");
+        exit(1);
+    }
+    for(i = 0; i < n; i++){
+        w = (n - i < bw) ? n - i : bw;
+        for(t = 1; t < w; t++){
+            if(A[i][t] != 0.0){
+                g->adj[pos[i]++] = i + t;
+                g->adj[pos[i+t]++] = i;
+            }
+        }
+    }
+    free(pos);
+    return g;
+}
+
+void graph_free(Graph* g){
+    free(g->ptr);
+    free(g->adj);
+    free(g);
+}
+
+// root からの幅優先探索. 到達した頂点を訪問順に queue に, 距離を level に入れる (level は未訪問を -1 にしておく).
+// 到達した頂点数を返し, *depth に最大の距離を入れる
+int graph_bfs(Graph* g, int root, int* level, int* queue, int* depth){
+    int head = 0, tail = 0, i, k, v;
+
+    level[root] = 0;
+    queue[tail++] = root;
+    while(head < tail){
+        i = queue[head++];
+        for(k = g->ptr[i]; k < g->ptr[i+1]; k++){
+            v = g->adj[k];
+            if(level[v] < 0){
+                level[v] = level[i] + 1;
+                queue[tail++] = v;
+            }
+        }
+    }
+    *depth = level[queue[tail-1]];
+    return tail;
+}
+
+// 最も遠い段の中で次数が最小の頂点
+int graph_last_level(Graph* g, int* level, int* queue, int count, int depth){
+    int i, v, best = queue[count-1];
+
+    for(i = count - 1; i >= 0 && level[queue[i]] == depth; i--){
+        v = queue[i];
+        if(DEGREE(g, v) < DEGREE(g, best)) best = v;
+    }
+    return best;
+}
+
+// 擬似周辺頂点 (George-Liu): 最も遠い段の次数最小の頂点から探索し直し, 段数が増えなくなるまで繰り返す.
+// 戻ったとき level と queue には返した頂点からの探索結果が残る (*count は連結成分の頂点数, *depth は段数)
+int graph_peripheral(Graph* g, int root, int* level, int* queue, int* count, int* depth){
+    int i, next, cand;
+
+    *count = graph_bfs(g, root, level, queue, depth);
+    for(;;){
+        cand = graph_last_level(g, level, queue, *count, *depth);
+        for(i = 0; i < *count; i++){
+            level[queue[i]] = -1;
+        }
+        graph_bfs(g, cand, level, queue, &next);
+        if(next <= *depth){
+            // 離心率が同じなら cand も周辺頂点として使える
+            return cand;
+        }
+        *depth = next;
+    }
+}
+
+// 逆 Cuthill-McKee 順序 (バンド幅を小さくする): 連結成分ごとに擬似周辺頂点から幅優先に番号を付け,
+// 各頂点の未訪問の隣接頂点は次数の小さい順に並べる. 最後に全体を逆順にする (プロファイルが小さくなる).
+// perm[k] は新しい番号 k の元の頂点
+void reorder_rcm(Graph* g, int* perm){
+    int n = g->n, i, k, v, t, head, tail, k0, start, root, count, depth;
+    int *level, *queue;
 
-    for(i = n-1; i >= 0; i--){
-        for(j = i+1; j < i + b_width && j < n; j++){
-            b[i] -= A[i][j-i] * x[j];
+    if((level = (int*)malloc(n * sizeof(int))) == NULL || (queue = (int*)malloc(n * sizeof(int))) == NULL){
+        printf("No memories are available (rcm)\n");
+        exit(1);
+    }
+    for(i = 0; i < n; i++){
+        level[i] = -1;
+    }
+    tail = 0;
+    for(start = 0; start < n; start++){
+        if(level[start] >= 0) continue;
+        root = graph_peripheral(g, start, level, queue, &count, &depth);
+        for(i = 0; i < count; i++){
+            level[queue[i]] = -1;
         }
-        if(A[i][0] == 0.0){
-            printf("Division by zero at i=%d\n", i);
+        // Cuthill-McKee: 番号付けの済んだ頂点は level を 0 以上にしておく
+        head = tail;
+        level[root] = 0;
+        perm[tail++] = root;
+        while(head < tail){
+            i = perm[head++];
+            k0 = tail;
+            for(k = g->ptr[i]; k < g->ptr[i+1]; k++){
+                v = g->adj[k];
+                if(level[v] < 0){
+                    level[v] = 0;
+                    // 次数の小さい順に挿入する
+                    for(t = tail++; t > k0 && DEGREE(g, perm[t-1]) > DEGREE(g, v); t--){
+                        perm[t] = perm[t-1];
+                    }
+                    perm[t] = v;
+                }
+            }
+        }
+    }
+    for(i = 0; i < n / 2; i++){
+        v = perm[i];
+        perm[i] = perm[n-1-i];
+        perm[n-1-i] = v;
+    }
+    free(level);
+    free(queue);
+}
+
+// Sloan 順序 (プロファイルを小さくする): 擬似周辺頂点の組 (始点 s, 終点 e) を取り, s から番号を付けていく.
+// 優先度 W1 * (e からの距離) - W2 * (現在の次数 + 1) の最大の頂点を次に選ぶ.
+// 現在の次数は番号を付けると新たに前線に加わる頂点の数で, 前線 (プロファイルの幅) を増やさない頂点を先に選ぶ
+#define SLOAN_W1 2
+#define SLOAN_W2 1
+enum { SLOAN_INACTIVE, SLOAN_PREACTIVE, SLOAN_ACTIVE, SLOAN_NUMBERED };
+
+// 優先度の最大ヒープ. 優先度が変わるたびに入れ直し, 取り出したときに古い値なら捨てる
+typedef struct {
+    int *prio;
+    int *v;
+    int size, cap;
+} Heap;
+
+void heap_push(Heap* h, int prio, int v){
+    int i, p;
+
+    if(h->size == h->cap){
+        h->cap *= 2;
+        if((h->prio = (int*)realloc(h->prio, h->cap * sizeof(int))) == NULL
+           || (h->v = (int*)realloc(h->v, h->cap * sizeof(int))) == NULL){
+            printf("No memories are available (heap)\n");
             exit(1);
         }
-        x[i] = b[i]/A[i][0];
     }
+    for(i = h->size++; i > 0 && h->prio[p = (i - 1) / 2] < prio; i = p){
+        h->prio[i] = h->prio[p];
+        h->v[i] = h->v[p];
+    }
+    h->prio[i] = prio;
+    h->v[i] = v;
 }
 
-void print_solution(int n){
-    int i;
-    printf("\nSolution:\n");
+// 先頭を取り出して *prio, *v に入れる
+void heap_pop(Heap* h, int* prio, int* v){
+    int i, c, lp, lv;
+
+    *prio = h->prio[0];
+    *v = h->v[0];
+    lp = h->prio[--h->size];
+    lv = h->v[h->size];
+    for(i = 0; (c = 2 * i + 1) < h->size; i = c){
+        if(c + 1 < h->size && h->prio[c+1] > h->prio[c]) c++;
+        if(h->prio[c] <= lp) break;
+        h->prio[i] = h->prio[c];
+        h->v[i] = h->v[c];
+    }
+    h->prio[i] = lp;
+    h->v[i] = lv;
+}
+
+// 頂点 v の優先度を上げる (番号の済んでいない頂点だけ. 前線の外にあった頂点は前線の候補にする)
+static void sloan_raise(Heap* h, int* prio, int* status, int v){
+    if(status[v] == SLOAN_NUMBERED) return;
+    prio[v] += SLOAN_W2;
+    if(status[v] == SLOAN_INACTIVE) status[v] = SLOAN_PREACTIVE;
+    heap_push(h, prio[v], v);
+}
+
+void reorder_sloan(Graph* g, int* perm){
+    int n = g->n, i, j, k, l, p, start, s, e, count, depth, num = 0;
+    int *level, *queue, *prio, *status;
+    Heap h;
+
+    h.size = 0;
+    h.cap = n + 16;
+    if((level = (int*)malloc(n * sizeof(int))) == NULL || (queue = (int*)malloc(n * sizeof(int))) == NULL
+       || (prio = (int*)malloc(n * sizeof(int))) == NULL || (status = (int*)malloc(n * sizeof(int))) == NULL
+       || (h.prio = (int*)malloc(h.cap * sizeof(int))) == NULL || (h.v = (int*)malloc(h.cap * sizeof(int))) == NULL){
+        printf("No memories are available (sloan)\n");
+        exit(1);
+    }
     for(i = 0; i < n; i++){
-        printf("x[%d] = %f\n", i, x[i]);
+        level[i] = -1;
+        status[i] = SLOAN_INACTIVE;
+    }
+    for(start = 0; start < n; start++){
+        if(level[start] >= 0) continue;
+        s = graph_peripheral(g, start, level, queue, &count, &depth);
+        e = graph_last_level(g, level, queue, count, depth);
+        for(i = 0; i < count; i++){
+            level[queue[i]] = -1;
+        }
+        graph_bfs(g, e, level, queue, &depth);
+        for(i = 0; i < count; i++){
+            j = queue[i];
+            prio[j] = SLOAN_W1 * level[j] - SLOAN_W2 * (DEGREE(g, j) + 1);
+        }
+
+        status[s] = SLOAN_PREACTIVE;
+        heap_push(&h, prio[s], s);
+        while(h.size > 0){
+            heap_pop(&h, &p, &i);
+            if(status[i] == SLOAN_NUMBERED || p != prio[i]) continue;
+            // 前線の外から選んだ頂点は, その隣接頂点を前線に加える
+            if(status[i] == SLOAN_PREACTIVE){
+                for(k = g->ptr[i]; k < g->ptr[i+1]; k++){
+                    sloan_raise(&h, prio, status, g->adj[k]);
+                }
+            }
+            status[i] = SLOAN_NUMBERED;
+            perm[num++] = i;
+            // 隣接する前線候補は前線に入り, その隣接頂点の現在の次数が1つ減る
+            for(k = g->ptr[i]; k < g->ptr[i+1]; k++){
+                j = g->adj[k];
+                if(status[j] != SLOAN_PREACTIVE) continue;
+                status[j] = SLOAN_ACTIVE;
+                sloan_raise(&h, prio, status, j);
+                for(l = g->ptr[j]; l < g->ptr[j+1]; l++){
+                    sloan_raise(&h, prio, status, g->adj[l]);
+                }
+            }
+        }
     }
+    free(level);
+    free(queue);
+    free(prio);
+    free(status);
+    free(h.prio);
+    free(h.v);
 }
 
-int count_matrix_size(char* filename) {
-    FILE* fp;
-    int size = 0;
-    char line[1024];
+// 並べ替え後のバンド幅 (対角を含む) とプロファイル (skyline_profile と同じ数え方). inv[v] は頂点 v の新しい番号 (NULL なら元の順)
+void graph_envelope(Graph* g, int* inv, int* bw, size_t* profile){
+    int v, k, i, j, f;
 
-    if((fp = fopen(filename, "r")) == NULL){
-        printf("Cannot open file %s for size counting\n", filename);
+    *bw = 1;
+    *profile = 0;
+    for(v = 0; v < g->n; v++){
+        j = (inv != NULL) ? inv[v] : v;
+        f = j;
+        for(k = g->ptr[v]; k < g->ptr[v+1]; k++){
+            i = (inv != NULL) ? inv[g->adj[k]] : g->adj[k];
+            if(i < f) f = i;
+        }
+        if(j - f + 1 > *bw) *bw = j - f + 1;
+        *profile += j - f + 1;
+    }
+}
+
+// 指定の方法 (rcm または sloan) で並べ替え, 小さくなれば並べ替えた行列をバンドの連続領域 *P (行 k は対角から
+// 新しいバンド幅の個数) に作って A の各行をそこに付け替える. 新しいバンド幅を返し, *perm に順序を入れる
+// (並べ替えなかったときは *perm, *P とも NULL)
+int reorder_matrix(double** A, int n, int bw, char* method, int** perm, double** P){
+    Graph *g;
+    int *inv, bw0, bw2, k, t, p, q, d, sloan;
+    size_t prof0, prof2;
+    double *ab;
+
+    *perm = NULL;
+    *P = NULL;
+    if(strcmp(method, "rcm") == 0){
+        sloan = 0;
+    }else if(strcmp(method, "sloan") == 0){
+        sloan = 1;
+    }else{
+        printf("Unknown reordering: %s (rcm or sloan)\n", method);
+        exit(1);
+    }
+    if((*perm = (int*)malloc(n * sizeof(int))) == NULL || (inv = (int*)malloc(n * sizeof(int))) == NULL){
+        printf("No memories are available (perm)\n");
         exit(1);
     }
+    g = graph_create(A, n, bw);
+    if(sloan){
+        reorder_sloan(g, *perm);
+    }else{
+        reorder_rcm(g, *perm);
+    }
+    for(k = 0; k < n; k++){
+        inv[(*perm)[k]] = k;
+    }
+    graph_envelope(g, NULL, &bw0, &prof0);
+    graph_envelope(g, inv, &bw2, &prof2);
+    graph_free(g);
+    free(inv);
+    printf("Reordering (%s): bandwidth %d -> %d, profile %zu -> %zu\n", sloan ? "Sloan" : "RCM", bw0, bw2, prof0, prof2);
+
+    // RCM はバンド幅, Sloan はプロファイルが小さくならなければ元の順のまま解く
+    if(sloan ? prof2 >= prof0 : bw2 >= bw0){
+        printf("Keeping the original order\n");
+        free(*perm);
+        *perm = NULL;
+        return bw;
+    }
 
-    // 空でない行の数を数える
-    while(fgets(line, sizeof(line), fp) != NULL) {
-        if(strlen(line) > 1) { // 改行文字のみの行は無視
-            size++;
+    if((ab = (double*)calloc((size_t)n * bw2, sizeof(double))) == NULL){
+        printf("No memories are available (reorder)\n");
+        exit(1);
+    }
+    #pragma omp parallel for private(t, p, q, d) schedule(static)
+    for(k = 0; k < n; k++){
+        p = (*perm)[k];
+        for(t = 0; t < bw2 && k + t < n; t++){
+            q = (*perm)[k+t];
+            d = q - p;
+            if(d >= 0 && d < bw){
+                ab[(size_t)k * bw2 + t] = A[p][d];
+            }else if(d < 0 && -d < bw){
+                ab[(size_t)k * bw2 + t] = A[q][-d];
+            }
         }
     }
+    for(k = 0; k < n; k++){
+        A[k] = ab + (size_t)k * bw2;
+    }
+    *P = ab;
+    return bw2;
+}
 
-    fclose(fp);
-    return size;
+// X (列優先 n x nrhs) の行を並べ替える. inverse が 0 なら新しい行 k に元の行 perm[k] を, 1 ならその逆に置く
+void permute_rows(int n, int nrhs, double* X, int* perm, int inverse){
+    double *tmp, *x;
+    int j, k;
+
+    if((tmp = (double*)malloc(n * sizeof(double))) == NULL){
+        printf("No memories are available (perm)\n");
+        exit(1);
+    }
+    for(j = 0; j < nrhs; j++){
+        x = X + (size_t)j * n;
+        for(k = 0; k < n; k++){
+            if(inverse){
+                tmp[perm[k]] = x[k];
+            }else{
+                tmp[k] = x[perm[k]];
+            }
+        }
+        memcpy(x, tmp, n * sizeof(double));
+    }
+    free(tmp);
+}
+
+// 解の表示 (X は列優先 n x nrhs, 右辺が複数なら1行に各右辺の解を並べる)
+void print_solution(int n, double* X, int nrhs){
+    int i, j;
+    printf("\nSolution:\n");
+    for(i = 0; i < n; i++){
+        printf("x[%d] =", i);
+        for(j = 0; j < nrhs; j++){
+            printf(" %f", X[(size_t)j * n + i]);
+        }
+        printf("\n");
+    }
 }
 
 int main(int argc, char *argv[]){
     double **A;
+    double *A_map, *b_map, *B, *X, *P = NULL;
+    CrmatHeader mh, vh;
+    TextMatrix mt, vt;
+    Factor *f;
+    size_t A_len = 0, b_len = 0;
     char *matrix_file = NULL;
     char *vector_file = NULL;
-    int opt;
+    char *order = NULL;
+    int opt, n, bw, nrhs, i, j, *perm = NULL;
 
     // コマンドライン引数の解析
-    while((opt = getopt(argc, argv, "a:b:")) != -1) {
+    while((opt = getopt(argc, argv, "a:b:r:")) != -1) {
         switch(opt) {
             case 'a':
                 matrix_file = optarg;
@@ -210,42 +1357,115 @@ int main(int argc, char *argv[]){
             case 'b':
                 vector_file = optarg;
                 break;
+            case 'r':
+                order = optarg;
+                break;
             default:
-                printf("Usage: %s -a matrix_file -b vector_file\n", argv[0]);
+                printf("Usage: %s -a matrix_file -b vector_file [-r rcm|sloan]\n", argv[0]);
                 exit(1);
         }
     }
 
     // 必要な引数が指定されているか確認
     if(matrix_file == NULL || vector_file == NULL) {
-        printf("Usage: %s -a matrix_file -b vector_file\n", argv[0]);
+        printf("Usage: %s -a matrix_file -b vector_file [-r rcm|sloan]\n", argv[0]);
         exit(1);
     }
 
-    // 行列のサイズを自動的に判定
-    N = count_matrix_size(matrix_file);
-    printf("Matrix size: %d x %d\n", N, N);
+    // CRMAT形式ならサイズとバンド幅はヘッダにあるので, 3回の走査をせずmmapで使う
+    if((A_map = binary_open(matrix_file, &mh, &A_len)) != NULL){
+        n = (int)mh.rows;
+        bw = (int)mh.bandwidth;
+        printf("Matrix size: %d x %d (binary)\n", n, n);
+        printf("Bandwidth: %d\n", bw);
+        binary_attach(&A, n, A_map, &mh);
+    }else{
+        // テキストは1回の並列走査でサイズ・対称性・バンド幅まで求め, 読んだ領域をそのまま使う
+        printf("Matrix file: %s\n", matrix_file);
+        text_parse(matrix_file, &mt);
+        n = mt.rows;
+        bw = mt.bandwidth;
+        printf("Matrix size: %d x %d\n", n, n);
+        printf("Bandwidth: %d\n", bw);
+        memset(&mh, 0, sizeof(mh));
+        mh.kind = CRMAT_DENSE;
+        mh.rows = mt.rows;
+        mh.cols = mt.cols;
+        mh.symmetric = mt.symmetric;
+        mh.bandwidth = mt.bandwidth;
+        binary_attach(&A, n, mt.val, &mh);
+    }
+
+    // 節点の番号付けが悪いとバンド幅が n 近くになるので, 指定があればバンド幅・プロファイルの小さい順に並べ替える
+    if(order != NULL){
+        bw = reorder_matrix(A, n, bw, order, &perm, &P);
+    }
 
-    // バンド幅を計算
-    B = get_bandwidth(matrix_file, N);
-    printf("Bandwidth: %d\n", B);
+    // 右辺: バイナリは列優先 n x nrhs, テキストは1行に各右辺の第 i 成分を並べる (1行に n 個なら右辺1本)
+    if((b_map = binary_open(vector_file, &vh, &b_len)) != NULL){
+        if(vh.kind != CRMAT_VECTOR || vh.rows != n){
+            printf("Binary vector must have %d rows\n", n);
+            exit(1);
+        }
+        nrhs = (int)vh.cols;
+        B = b_map;
+    }else{
+        printf("Vector file: %s\n", vector_file);
+        text_parse(vector_file, &vt);
+        if(vt.rows == n){
+            nrhs = vt.cols;
+        }else if(vt.rows == 1 && vt.cols == n){
+            nrhs = 1;
+        }else{
+            printf("Vector file read error\n");
+            exit(1);
+        }
+        B = vt.val;
+    }
+    if(nrhs > 1){
+        printf("Right-hand sides: %d\n", nrhs);
+    }
+    if((X = (double*)malloc(sizeof(double) * n * nrhs)) == NULL){
+        printf("No memories are available (x)\n");
+        exit(1);
+    }
+    if(b_map != NULL || nrhs == 1){
+        memcpy(X, B, sizeof(double) * n * nrhs);
+    }else{
+        for(i = 0; i < n; i++){
+            for(j = 0; j < nrhs; j++){
+                X[(size_t)j * n + i] = B[(size_t)i * nrhs + j];
+            }
+        }
+    }
 
-    memory_allocate(&A, N, B);
-    read_matrix(A, N, B, matrix_file);
-    read_vector(N, vector_file);
-    
     printf("\nSolving the system...\n");
-    forward_erase(A, N, B);
-    backward_assignment(A, N, B);
-    print_solution(N);
+    if(perm != NULL){
+        permute_rows(n, nrhs, X, perm, 0);
+    }
+    f = factor_create(A, n, bw);
+    factor_solve(f, X, nrhs, n);
+    if(perm != NULL){
+        permute_rows(n, nrhs, X, perm, 1);
+    }
+    print_solution(n, X, nrhs);
 
     // メモリの解放
-    for(int i = 0; i < N; i++){
-        free(A[i]);
+    factor_free(f);
+    if(A_map != NULL){
+        binary_close(A_map, &mh, A_len);
+    }else{
+        free(mt.val);
     }
     free(A);
-    free(b);
-    free(x);
+    free(P);
+    free(perm);
+    if(b_map != NULL){
+        binary_close(b_map, &vh, b_len);
+    }else{
+        free(B);
+    }
+    free(X);
 
     return 0;
-}
\ No newline at end of file
+}
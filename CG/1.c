@@ -1,24 +1,108 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define N 10                // N次元方程式
-#define EPS pow(10.0, -8.0) // epsilon の設定
-#define KMAX 100            // 最大反復回数
+#define EPS pow(10.0, -8.0) // epsilon の設定 (残差の1ノルムを b の1ノルムで割った値と比べる)
+#define KMAX 100            // 最大反復回数 (n がこれより大きければ n 回まで)
+#define ALIGN 64            // ベクトル領域の境界 (キャッシュライン)
+#define PRINT_MAX 10000     // これより大きい n では解をファイルに書かない
+#define SELL_FILL 1.05      // SELL-C-σ の σ を選ぶときに許す格納要素数 (非零の何倍まで)
+#define BJ_NB 8             // ブロックヤコビ前処理の対角ブロックの大きさ
+#define SSOR_OMEGA 1.5      // SSOR 前処理の緩和係数 (-w で変えられる)
+#define PIPE_RR 100         // パイプライン CG で残差を置き換える間隔
+#define BLOCK_NB 8          // 疎行列と密ブロックの積で1度に足し込む列の数
+#define STENCIL_CACHE (1 << 20) // ステンシルのキャッシュブロッキングで x, y の行を置いておく大きさ (バイト)
+
+// SELL-C-σ 形式 (sliced ELLPACK): 行を C 行ずつのチャンクにまとめ, チャンク内は列優先に詰める.
+// 近い長さの行を同じチャンクに入れるため, σ 行ずつの窓の中で行を長さの順に並べ替えてある (perm)
+typedef struct SellMatrix SellMatrix;
+typedef double (*sell_fn)(const SellMatrix *s, int c0, int c1, const double *x, double *y);
+struct SellMatrix {
+    int n, C, sigma;
+    int nchunks;
+    int *perm;       // perm[c*C + r] はチャンク c の r 行目の元の行
+    int64_t *cptr;   // チャンク c の先頭位置
+    int *clen;       // チャンク c の幅 (最も長い行の非零の数)
+    int *col;
+    double *val;
+    int64_t size;    // 詰め物を含めた格納要素数
+    int nparts;
+    int *part;       // スレッド t はチャンク part[t], ..., part[t+1]-1 を受け持つ
+    sell_fn kernel;
+};
+
+// 行列を作らない線形演算子: apply(data, x, y) で y <- Ax を求めて x^T y を返し (添字は 0 から),
+// diagonal(data, d) で対角成分 d[0...n-1] を返す (ヤコビ前処理用). release で data を解放する
+typedef struct {
+    double (*apply)(const void *data, const double *x, double *y);
+    void (*diagonal)(const void *data, double *d);
+    void (*release)(void *data);
+    void *data;
+} Operator;
+
+// 疎行列 (CSR 形式, 添字は 0 から)
+// 行 i の非零は val[ptr[i]], ..., val[ptr[i+1]-1] で, その列番号は col[ptr[i]], ... に入る.
+// 行列ベクトル積は非零の数がほぼ等しくなるように行を nparts 個に分けてスレッドに割り当てる (part[t] は t 番目の先頭行)
+typedef struct {
+    int n;
+    int64_t nnz;
+    int64_t *ptr;
+    int *col;
+    double *val;
+    int nparts;
+    int *part;
+    SellMatrix *sell;   // NULL でなければ行列ベクトル積はこちらで行う
+    Operator *op;       // NULL でなければ行列を持たない演算子 (ptr, col, val は NULL で, 積は op->apply で求める)
+} CsrMatrix;
+
+// 前処理 (precond_create で作り, precond_apply で z = M^{-1} r を求める)
+enum { PC_NONE, PC_JACOBI, PC_BJACOBI, PC_SSOR, PC_IC0, PC_COUNT };
+static const char *precond_names[] = { "none", "jacobi", "bjacobi", "ssor", "ic0" };
+typedef struct {
+    int kind;
+    const CsrMatrix *a;
+    double *d;        // PC_JACOBI: 1/a_ii, PC_SSOR: a_ii (添字は 0 から)
+    double *block;    // PC_BJACOBI: 対角ブロックのコレスキー因子 U (BJ_NB x BJ_NB ずつ)
+    CsrMatrix *l;     // PC_IC0: 不完全コレスキー因子 L (各行の最後が対角)
+    double omega;     // PC_SSOR: 緩和係数
+} Precond;
 
 /* 関数のプロトタイプ宣言 */
 
-// 行列の入力
-void input_matrix(double **a, char c, FILE *fin, FILE *fout);
+// 行列の入力 (Matrix Market 形式または密行列のテキスト)
+CsrMatrix *input_matrix(char c, FILE *fin, FILE *fout);
 
-// ベクトルの入力
-void input_vector(double *b, char c, FILE *fin, FILE *fout);
+// ベクトルの入力 b[1...n]
+void input_vector(double *b, int n, char c, FILE *fin, FILE *fout);
 
-// 行列の領域確保
-double **dmatrix(int nr1, int nr2, int nl1, int nl2);
+// 2次元・3次元のポアソン方程式 (差分法) の係数行列 (diag は対角成分, 0 なら 2 x 次元)
+CsrMatrix *poisson_matrix(int nx, int ny, int nz, double diag);
 
-// 行列の領域解放
-void free_dmatrix(double **a, int nr1, int nr2, int nl1, int nl2);
+// 同じ係数行列を作らずに, 定数係数のステンシルとして積を求める演算子
+CsrMatrix *stencil_operator(int nx, int ny, int nz, double diag);
+
+// CSR 行列の領域確保と解放
+CsrMatrix *csr_alloc(int n, int64_t nnz);
+void csr_free(CsrMatrix *a);
+
+// 行の分割を求める
+void csr_partition(CsrMatrix *a);
+
+// SELL-C-σ 形式への変換とカーネルの選択
+SellMatrix *sell_from_csr(const CsrMatrix *a, int C, int sigma);
+void sell_free(SellMatrix *s);
+sell_fn sell_select(const char **name, int *C);
 
 // ベクトル領域の確保
 double *dvector(int i, int j);
@@ -32,218 +116,1837 @@ double vector_norm1(double *a, int m, int n);
 // ベクトル a[m...n] と b[m...n] の内積を計算する
 double inner_product(int m, int n, double *a, double *b);
 
-// 行列 a[1...N][1...N] とベクトル b[1...N] との積 c<-Ab
-void matrix_vector_product(double **a, double *b, double *c);
+// 行列 a とベクトル b[1...n] との積 c<-Ab (b^T c を返す)
+double matrix_vector_product(CsrMatrix *a, double *b, double *c);
+
+// 疎行列 a と n 行 ld 列 (行優先) の密ブロック P の先頭 nb 列との積 Q <- AP (列ごとの p_j^T A p_j を dot に返す)
+void csr_spmm(CsrMatrix *a, int nb, int ld, const double *P, double *Q, double *dot);
 
-// 共役勾配法(CG法)
-double *cg(double **a, double *b, double *x);
+// x <- x + alpha p, r <- r - alpha q を1回の走査で行い, r の1ノルムと r^T r も求める
+void cg_update(int n, double alpha, double *p, double *q, double *x, double *r, double *norm1, double *rr);
+
+// 前処理の構築・適用・解放 (kind は PC_*, 名前からは precond_kind で求める)
+int precond_kind(const char *name);
+Precond *precond_create(CsrMatrix *a, int kind, double omega);
+void precond_apply(Precond *m, double *r, double *z);
+void precond_free(Precond *m);
+
+// 前処理付き共役勾配法(PCG法)
+int cg(CsrMatrix *a, Precond *m, double *b, double *x, int kmax);
+
+// パイプライン化した前処理付き共役勾配法 (内積の集約を1反復1回にまとめて行列ベクトル積と重ねる)
+int cg_pipelined(CsrMatrix *a, Precond *m, double *b, double *x, int kmax);
+
+// nrhs 本の右辺を同時に解く CG 法 (B, X は n 行 nrhs 列の行優先, 列ごとの反復回数を iters に返す)
+int cg_block(CsrMatrix *a, Precond *m, int nrhs, double *B, double *X, int kmax, int *iters);
+
+// 経過時間 (秒)
+double elapsed(struct timespec *t0);
 
 
 /* main 関数 */
-int main(void)
+int main(int argc, char *argv[])
 {
   FILE *fin, *fout;
-  double **a, *b, *x;
-  int i;
-
-  /* 行列およびベクトルの領域確保 */
-  a = dmatrix(1, N, 1, N); /* 行列 a[1...N][1...N] */
-  b = dvector(1, N);      /* b[1...N] */
-  x = dvector(1, N);      /* x[1...N] */
+  CsrMatrix *a;
+  double *b, *x, *sol, *dot, err, t, t_setup, omega = SSOR_OMEGA, diag = 0.0;
+  char *matrix_file = NULL, *vector_file = NULL, *grid = NULL, *stencil = NULL, *format = NULL, *pc = "none", *variant = "classic";
+  const char *isa;
+  int i, j, n, opt, nx, ny, nz, kmax = 0, sigma = 0, C, k, kind, first, last, nrhs = 1, *iters, kmin;
+  size_t l, nn;
+  Precond *m;
+  int (*solver)(CsrMatrix *, Precond *, double *, double *, int);
+  sell_fn kernel;
+  struct timespec t0;
 
-  /* ファイルのオープン */
-  if ( (fin = fopen("input_matrix.txt", "r")) == NULL )
+  while ( (opt = getopt(argc, argv, "a:b:p:o:d:k:f:s:m:w:c:r:")) != -1 )
   {
-    printf("ファイルが見つかりません : input_matrix.txt \n");
-    exit(1);
+    switch (opt)
+    {
+      case 'a': matrix_file = optarg; break;
+      case 'b': vector_file = optarg; break;
+      case 'p': grid = optarg; break;
+      case 'o': stencil = optarg; break;
+      case 'd': diag = atof(optarg); break;
+      case 'k': kmax = atoi(optarg); break;
+      case 'f': format = optarg; break;
+      case 's': sigma = atoi(optarg); break;
+      case 'm': pc = optarg; break;
+      case 'w': omega = atof(optarg); break;
+      case 'c': variant = optarg; break;
+      case 'r': nrhs = atoi(optarg); break;
+      default:
+        printf("Usage: %s [-a matrix_file] [-b vector_file] [-p|-o NX[xNY[xNZ]]] [-d diag] [-k max_iterations] [-f csr|sell] [-s sigma]\n"
+               "          [-m none|jacobi|bjacobi|ssor|ic0|all] [-w omega] [-c classic|pipelined] [-r nrhs]\n", argv[0]);
+        exit(1);
+    }
   }
+  // 何も指定しなければ従来どおり input_matrix.txt と input_vector.txt を解く
+  if ( stencil != NULL ) grid = stencil;
+  if ( matrix_file == NULL && grid == NULL )
+  {
+    matrix_file = "input_matrix.txt";
+    if ( vector_file == NULL ) vector_file = "input_vector.txt";
+  }
+
   if ( (fout = fopen("output.dat", "w")) == NULL )
   {
     printf("ファイルが作成できません : output.dat \n");
     exit(1);
   }
 
-  input_matrix( a, 'A', fin, fout ); /* 行列Aの入力 */
-  
-  fclose(fin); /* 行列ファイルを閉じる */
-  
-  /* ベクトルファイルのオープン */
-  if ( (fin = fopen("input_vector.txt", "r")) == NULL )
+  if ( grid != NULL )
+  {
+    /* ポアソン方程式の係数行列を生成する (ファイルを経由しないので n = 10^8 程度まで扱える) */
+    nx = ny = nz = 1;
+    if ( sscanf(grid, "%dx%dx%d", &nx, &ny, &nz) < 1 || nx < 1 || ny < 1 || nz < 1 )
+    {
+      printf("格子の指定が正しくありません : %s \n", grid);
+      exit(1);
+    }
+    if ( stencil != NULL )
+    {
+      /* -o なら行列を作らずにステンシルのまま積を求める */
+      a = stencil_operator(nx, ny, nz, diag);
+      printf("ポアソン方程式 %d x %d x %d (行列を作らないステンシル)\n", nx, ny, nz);
+    }
+    else
+    {
+      a = poisson_matrix(nx, ny, nz, diag);
+      printf("ポアソン方程式 %d x %d x %d\n", nx, ny, nz);
+    }
+  }
+  else
+  {
+    /* ファイルのオープン */
+    if ( (fin = fopen(matrix_file, "r")) == NULL )
+    {
+      printf("ファイルが見つかりません : %s \n", matrix_file);
+      exit(1);
+    }
+    a = input_matrix( 'A', fin, fout ); /* 行列Aの入力 */
+    fclose(fin); /* 行列ファイルを閉じる */
+  }
+  n = a->n;
+  printf("n = %d, 非零要素数 = %lld\n", n, (long long)a->nnz);
+
+  /* 行列ベクトル積の形式: SIMD カーネルが使えれば SELL-C-σ (C は SIMD の幅, σ は 0 なら自動) */
+  kernel = sell_select(&isa, &C);
+  if ( format == NULL ) format = ( strcmp(isa, "scalar") != 0 && a->op == NULL ) ? "sell" : "csr";
+  if ( a->op != NULL )
   {
-    printf("ファイルが見つかりません : input_vector.txt \n");
+    if ( strcmp(format, "csr") != 0 )
+    {
+      printf("行列を作らない演算子は形式を選べません\n");
+      exit(1);
+    }
+  }
+  else if ( strcmp(format, "sell") == 0 )
+  {
+    a->sell = sell_from_csr(a, C, sigma);
+    a->sell->kernel = kernel;
+    printf("SELL-C-σ: C = %d, σ = %d, 格納要素数 = %lld (非零の %.3f 倍), カーネル %s\n",
+           C, a->sell->sigma, (long long)a->sell->size, (double)a->sell->size / (a->nnz > 0 ? a->nnz : 1), isa);
+  }
+  else if ( strcmp(format, "csr") != 0 )
+  {
+    printf("行列の形式が正しくありません : %s \n", format);
     exit(1);
   }
-  
-  input_vector( b, 'b', fin, fout ); /* ベクトルbの入力 */
-  
-  /* 初期ベクトルx0の設定（零ベクトル） */
-  for( i = 1; i <= N; i++ )
+
+  /* b, x は dvector(1, n*nrhs) なので, n*nrhs が int の添字に収まらなければ解けない */
+  if ( nrhs < 1 || (int64_t)n * nrhs > INT_MAX - 1 )
   {
-    x[i] = 0.0;
+    printf("右辺の数が正しくありません : %d \n", nrhs);
+    exit(1);
   }
-  
-  x = cg( a, b, x );                  /* 共役勾配法(CG法) */
+  nn = (size_t)n * nrhs;
+
+  /* ベクトルの領域確保 (右辺が複数なら n 行 nrhs 列を行優先で並べ, 第 i 行 j 列は b[(i-1)*nrhs + j + 1]) */
+  b = dvector(1, (int)nn);      /* b[1...n*nrhs] */
+  x = dvector(1, (int)nn);      /* x[1...n*nrhs] */
+
+  if ( vector_file != NULL )
+  {
+    /* ベクトルファイルのオープン */
+    if ( (fin = fopen(vector_file, "r")) == NULL )
+    {
+      printf("ファイルが見つかりません : %s \n", vector_file);
+      exit(1);
+    }
+    if ( nrhs == 1 )
+    {
+      input_vector( b, n, 'b', fin, fout ); /* ベクトルbの入力 */
+    }
+    else
+    {
+      /* 右辺は1列ずつ (Matrix Market の配列形式と同じ列優先で) 並んでいるものとする */
+      sol = dvector(1, n);
+      for( j = 0; j < nrhs; j++ )
+      {
+        input_vector( sol, n, 'b', fin, fout );
+        for( i = 1; i <= n; i++ )
+        {
+          b[(size_t)(i-1)*nrhs + j + 1] = sol[i];
+        }
+      }
+      free_dvector( sol, 1 );
+    }
+    fclose(fin);
+    sol = NULL;
+  }
+  else
+  {
+    /* 右辺がなければ解がわかるように b = A x とする (第1列の解はすべて 1, 第 j 列は 1 + j sin(i)) */
+    sol = dvector(1, (int)nn);
+    #pragma omp parallel for private(j) schedule(static)
+    for( i = 1; i <= n; i++ )
+    {
+      for( j = 0; j < nrhs; j++ )
+      {
+        sol[(size_t)(i-1)*nrhs + j + 1] = 1.0 + j * sin((double)i);
+      }
+    }
+    if ( nrhs == 1 )
+    {
+      matrix_vector_product( a, sol, b );
+    }
+    else
+    {
+      dot = dvector(0, nrhs - 1);
+      csr_spmm( a, nrhs, nrhs, &sol[1], &b[1], dot );
+      free_dvector( dot, 0 );
+    }
+  }
+
+  if ( kmax <= 0 ) kmax = ( n > KMAX ) ? n : KMAX;
+
+  /* CG 法の種類: classic (内積を2回待つ) または pipelined (1回の集約を行列ベクトル積と重ねる) */
+  if ( strcmp(variant, "classic") == 0 )
+  {
+    solver = cg;
+  }
+  else if ( strcmp(variant, "pipelined") == 0 )
+  {
+    solver = cg_pipelined;
+    printf("パイプライン CG (残差の置き換えは %d 回ごと)\n", PIPE_RR);
+  }
+  else
+  {
+    printf("CG 法の種類が正しくありません : %s \n", variant);
+    exit(1);
+  }
+  if ( nrhs > 1 )
+  {
+    /* 複数の右辺は A を1度流す間に全部の列に掛ける cg_block でまとめて解く */
+    if ( solver != cg )
+    {
+      printf("複数の右辺は classic でしか解けません\n");
+      exit(1);
+    }
+    if ( a->op != NULL )
+    {
+      printf("複数の右辺は行列を作ったときしか解けません\n");
+      exit(1);
+    }
+    printf("右辺 %d 本をまとめて解きます\n", nrhs);
+  }
+  iters = (int *)malloc(sizeof(int) * nrhs);
+  if ( iters == NULL )
+  {
+    printf("メモリ確保に失敗しました\n");
+    exit(1);
+  }
+
+  /* -m all なら全ての前処理を順に試して反復回数と時間を比べる (解は最後のものを出力する) */
+  if ( strcmp(pc, "all") == 0 )
+  {
+    first = 0;
+    last = ( a->op != NULL ) ? PC_JACOBI : PC_COUNT - 1; /* 行列を作らない演算子で使えるのはヤコビ前処理まで */
+  }
+  else
+  {
+    first = last = precond_kind(pc);
+  }
+  for ( kind = first; kind <= last; kind++ )
+  {
+    /* 初期ベクトルx0の設定（零ベクトル） */
+    #pragma omp parallel for schedule(static)
+    for( l = 1; l <= nn; l++ )
+    {
+      x[l] = 0.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    m = precond_create( a, kind, omega );
+    t_setup = elapsed(&t0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ( nrhs == 1 )
+    {
+      k = solver( a, m, b, x, kmax );       /* 前処理付き共役勾配法 */
+    }
+    else
+    {
+      k = cg_block( a, m, nrhs, &b[1], &x[1], kmax, iters );
+    }
+    t = elapsed(&t0);
+    precond_free( m );
+
+    if ( k < 0 )
+    {
+      printf("前処理 %-7s: 答えが見つかりませんでした (%d 回)\n", precond_names[kind], kmax);
+      if ( first == last ) exit(1);
+      continue;
+    }
+    printf("前処理 %-7s: 反復回数は%d回です (構築 %.3f 秒, 反復 %.3f 秒)\n", precond_names[kind], k, t_setup, t);
+    if ( nrhs > 1 )
+    {
+      kmin = k;
+      for( j = 0; j < nrhs; j++ )
+      {
+        if ( iters[j] < kmin ) kmin = iters[j];
+      }
+      printf("列ごとの反復回数は %d 回から %d 回です\n", kmin, k);
+    }
+
+    if ( sol != NULL )
+    {
+      err = 0.0;
+      #pragma omp parallel for reduction(max:err) schedule(static)
+      for( l = 1; l <= nn; l++ )
+      {
+        if ( fabs(x[l] - sol[l]) > err ) err = fabs(x[l] - sol[l]);
+      }
+      printf("誤差 max|x[i] - x*[i]| = %e\n", err);
+    }
+  }
+  if ( sol != NULL ) free_dvector( sol, 1 );
+  free( iters );
 
   /* 結果の出力 */
   fprintf(fout, "Ax=b の解は次の通りです\n");
-  for( i = 1; i <= N; i++ )
+  if ( n <= PRINT_MAX )
   {
-    fprintf(fout, "x[%d] = %f\n", i, x[i]);
+    for( i = 1; i <= n; i++ )
+    {
+      fprintf(fout, "x[%d] =", i);
+      for( j = 0; j < nrhs; j++ )
+      {
+        fprintf(fout, " %f", x[(size_t)(i-1)*nrhs + j + 1]);
+      }
+      fprintf(fout, "\n");
+    }
   }
+  else
+  {
+    fprintf(fout, "(n = %d のため省略します)\n", n);
+  }
+
+  fclose(fout); /* ファイルのクローズ */
 
-  fclose(fin); fclose(fout); /* ファイルのクローズ */
-  
   /* 領域の解放 */
-  free_dmatrix( a, 1, N, 1, N ); free_dvector( b, 1 ); free_dvector( x, 1 );
+  csr_free( a ); free_dvector( b, 1 ); free_dvector( x, 1 );
   return 0;
 }
 
-/* 共役勾配法 (CG法) */
-double *cg(double **a, double *b, double *x)
+/* 前処理付き共役勾配法 (PCG法)
+   収束すれば反復回数を, kmax 回で収束しなければ -1 を返す */
+int cg(CsrMatrix *a, Precond *m, double *b, double *x, int kmax)
 {
-  double eps, *r, *p, *tmp, alpha, beta, work;
-  double rho, rho_new; // rとrの内積を格納する変数
-  int i, k=0;
+  double eps, bnorm, *r, *p, *z, *tmp, alpha, beta, work;
+  double rho, rho_new, rr; // rとzの内積を格納する変数
+  int i, k=0, n = a->n;
+
+  r = dvector(1,n);
+  p = dvector(1,n);
+  z = ( m->kind == PC_NONE ) ? r : dvector(1,n); // 前処理なしなら z = r
+  tmp = dvector(1,n);
 
-  r = dvector(1,N);
-  p = dvector(1,N);
-  tmp = dvector(1,N);
-  
-  // 初期化: r_0 = p_0 = b - A*x_0
+  bnorm = vector_norm1(b, 1, n);
+  if ( bnorm == 0.0 ) bnorm = 1.0;
+
+  // 初期化: r_0 = b - A*x_0, z_0 = M^{-1} r_0, p_0 = z_0
   matrix_vector_product(a, x, tmp);
-  for ( i = 1; i <= N; i++ ) {
-    p[i] = b[i] - tmp[i];
-    r[i] = p[i];
+  #pragma omp parallel for schedule(static)
+  for ( i = 1; i <= n; i++ ) {
+    r[i] = b[i] - tmp[i];
   }
+  if ( z != r ) precond_apply(m, r, z);
+  #pragma omp parallel for schedule(static)
+  for ( i = 1; i <= n; i++ ) p[i] = z[i];
+
+  // rho = (r_k)^T * z_k を計算 (前処理なしなら z = r)
+  rho = inner_product( 1, n, r, z );
 
   do {
     k++;
 
-    // rho = (r_k)^T * r_k を計算
-    rho = inner_product( 1, N, r, r );
-
     // alpha の計算 (式 6.38 a)
-    // alpha = (r_k^T * r_k) / (p_k^T * A * p_k)
-    matrix_vector_product( a, p, tmp );     // tmp <- A * p_k
-    work = inner_product( 1, N, p, tmp ); // work <- p_k^T * A * p_k
+    // alpha = (r_k^T * z_k) / (p_k^T * A * p_k)
+    work = matrix_vector_product( a, p, tmp ); // tmp <- A * p_k, work <- p_k^T * A * p_k
     alpha = rho / work;
 
-    // 解 x と 残差 r の更新
+    // 解 x と 残差 r の更新 (同じ走査で r の1ノルムと r^T r も求める)
     // x_{k+1} = x_k + alpha * p_k
     // r_{k+1} = r_k - alpha * A * p_k
-    for( i = 1; i <= N; i++) x[i] = x[i] + alpha*p[i];
-    for( i = 1; i <= N; i++) r[i] = r[i] - alpha*tmp[i];
-    
+    cg_update( n, alpha, p, tmp, x, r, &eps, &rr );
+
     // 収束判定
-    eps = vector_norm1(r, 1, N);
-    if ( eps < EPS ) goto OUTPUT;
+    if ( eps < EPS * bnorm ) goto OUTPUT;
 
     // beta の計算 (式 6.38 b)
-    // beta = (r_{k+1}^T * r_{k+1}) / (r_k^T * r_k)
-    rho_new = inner_product( 1, N, r, r ); // r は更新済みなので r_{k+1}
-    beta = rho_new / rho; // rho は更新前の r_k の内積
+    // beta = (r_{k+1}^T * z_{k+1}) / (r_k^T * z_k)
+    if ( z == r ) {
+      rho_new = rr;
+    } else {
+      precond_apply(m, r, z);               // z_{k+1} = M^{-1} r_{k+1}
+      rho_new = inner_product( 1, n, r, z );
+    }
+    beta = rho_new / rho; // rho は更新前の内積
+    rho = rho_new;
 
     // 探索方向 p の更新
-    // p_{k+1} = r_{k+1} + beta * p_k
-    for ( i = 1; i <= N; i++) p[i] = r[i] + beta*p[i];
+    // p_{k+1} = z_{k+1} + beta * p_k
+    #pragma omp parallel for schedule(static)
+    for ( i = 1; i <= n; i++) p[i] = z[i] + beta*p[i];
 
-  } while( k < KMAX );
+  } while( k < kmax );
+  k = -1;
 
 OUTPUT:
-  // 後処理 (変更なし)
+  if ( z != r ) free_dvector(z, 1);
   free_dvector(r, 1); free_dvector(p, 1); free_dvector(tmp, 1);
-  if ( k == KMAX ) {
-    printf("答えが見つかりませんでした\n");
-    exit(1);
-  } else {
-    printf("反復回数は%d回です\n", k);
-    return x;
+  return k;
+}
+
+/* パイプライン化した前処理付き CG 法 (Ghysels-Vanroose)
+   u = M^{-1} r, w = A u と, 探索方向の像 s = A p, q = M^{-1} s, z = A q も漸化式で更新し,
+   1反復の内積 γ = (r,u), δ = (w,u) と r の1ノルムをベクトル更新と同じ1回の走査で求める.
+   次の反復では γ, δ を使う前に m = M^{-1} w, n = A m を計算するので, 分散版では内積の集約
+   (1回の非同期 allreduce) を前処理と行列ベクトル積の裏で進められる.
+   漸化式の残差は丸め誤差で真の残差からずれていくので, PIPE_RR 回ごとと収束したように見えたときに
+   r, u, w, s, q, z を定義どおり計算し直す (残差の置き換え). 収束すれば反復回数を, しなければ -1 を返す */
+
+// r = b - A x, u = M^{-1} r, w = A u, s = A p, q = M^{-1} s, z = A q (前処理なしなら u = r, q = s)
+static void pipe_replace(CsrMatrix *a, Precond *pc, double *b, double *x, double *r, double *u,
+                         double *w, double *p, double *s, double *q, double *z)
+{
+  int i, n = a->n;
+
+  matrix_vector_product(a, x, r);
+  #pragma omp parallel for schedule(static)
+  for ( i = 1; i <= n; i++ ) r[i] = b[i] - r[i];
+  if ( u != r ) precond_apply(pc, r, u);
+  matrix_vector_product(a, u, w);
+  matrix_vector_product(a, p, s);
+  if ( q != s ) precond_apply(pc, s, q);
+  matrix_vector_product(a, q, z);
+}
+
+// γ = (r,u), δ = (w,u), r の1ノルムを1回の走査で求める
+static void pipe_dots(int n, double *r, double *u, double *w, double *gamma, double *delta, double *norm1)
+{
+  double g = 0.0, d = 0.0, e = 0.0;
+  int i;
+
+  #pragma omp parallel for reduction(+:g, d, e) schedule(static)
+  for ( i = 1; i <= n; i++ ) {
+    g += r[i] * u[i];
+    d += w[i] * u[i];
+    e += fabs(r[i]);
+  }
+  *gamma = g;
+  *delta = d;
+  *norm1 = e;
+}
+
+int cg_pipelined(CsrMatrix *a, Precond *pc, double *b, double *x, int kmax)
+{
+  double *r, *u, *w, *m, *nv, *p, *s, *q, *z;
+  double eps, bnorm, gamma, delta, gamma_old = 0.0, alpha = 0.0, alpha_old = 0.0, beta, den, g, d, e;
+  int i, k = 0, n = a->n, pre = ( pc->kind != PC_NONE );
+
+  r = dvector(1,n);
+  w = dvector(1,n);
+  nv = dvector(1,n);
+  p = dvector(1,n);
+  s = dvector(1,n);
+  z = dvector(1,n);
+  // 前処理なしなら u = r, m = w, q = s なので領域を共有する
+  u = pre ? dvector(1,n) : r;
+  m = pre ? dvector(1,n) : w;
+  q = pre ? dvector(1,n) : s;
+
+  #pragma omp parallel for schedule(static)
+  for ( i = 1; i <= n; i++ ) {
+    p[i] = s[i] = q[i] = z[i] = 0.0;
+  }
+  bnorm = vector_norm1(b, 1, n);
+  if ( bnorm == 0.0 ) bnorm = 1.0;
+
+  pipe_replace(a, pc, b, x, r, u, w, p, s, q, z);
+  pipe_dots(n, r, u, w, &gamma, &delta, &eps);
+  if ( eps < EPS * bnorm ) goto OUTPUT;
+
+  do {
+    k++;
+
+    // m = M^{-1} w, n = A m (分散版ではこの間に前の走査の γ, δ の集約が進む)
+    if ( pre ) precond_apply(pc, w, m);
+    matrix_vector_product(a, m, nv);
+
+    // beta = γ_k / γ_{k-1}, alpha = γ_k / (δ_k - beta γ_k / alpha_{k-1})
+    // (最初の反復と, 分母が正にならないときは beta = 0 として最急降下からやり直す)
+    beta = ( k > 1 ) ? gamma / gamma_old : 0.0;
+    den = ( k > 1 ) ? delta - beta * gamma / alpha_old : delta;
+    if ( den <= 0.0 ) {
+      beta = 0.0;
+      den = delta;
+    }
+    alpha = gamma / den;
+
+    // 探索方向とその像, 解, 残差を更新し, 同じ走査で次の γ, δ と r の1ノルムを求める
+    g = d = e = 0.0;
+    #pragma omp parallel for reduction(+:g, d, e) schedule(static)
+    for ( i = 1; i <= n; i++ ) {
+      z[i] = nv[i] + beta * z[i];
+      s[i] = w[i] + beta * s[i];
+      p[i] = u[i] + beta * p[i];
+      x[i] += alpha * p[i];
+      r[i] -= alpha * s[i];
+      if ( pre ) {
+        q[i] = m[i] + beta * q[i];
+        u[i] -= alpha * q[i];
+      }
+      w[i] -= alpha * z[i];
+      g += r[i] * u[i];
+      d += w[i] * u[i];
+      e += fabs(r[i]);
+    }
+    gamma_old = gamma;
+    alpha_old = alpha;
+    gamma = g;
+    delta = d;
+    eps = e;
+
+    // 収束判定 (漸化式の残差で判定し, 真の残差で確かめる)
+    if ( eps < EPS * bnorm || k % PIPE_RR == 0 ) {
+      pipe_replace(a, pc, b, x, r, u, w, p, s, q, z);
+      pipe_dots(n, r, u, w, &gamma, &delta, &eps);
+      if ( eps < EPS * bnorm ) goto OUTPUT;
+    }
+  } while( k < kmax );
+  k = -1;
+
+OUTPUT:
+  if ( pre ) {
+    free_dvector(u, 1); free_dvector(m, 1); free_dvector(q, 1);
   }
+  free_dvector(r, 1); free_dvector(w, 1); free_dvector(nv, 1);
+  free_dvector(p, 1); free_dvector(s, 1); free_dvector(z, 1);
+  return k;
 }
 
+/* 複数の右辺に対する CG 法
+   nrhs 本の系 A x_j = b_j を列ごとに独立な漸化式 (それぞれの alpha_j, beta_j) で同時に解く.
+   探索方向を n 行 nrhs 列のブロック P にまとめて csr_spmm で AP を求めるので, A は1反復に1回しか読まない.
+   収束した列はその反復で外し (減次), 残りの列を R, P の先頭に詰め直して以後の積と更新を残りの列だけで行う.
+   slot[j] は詰めた j 列目が元の何列目かを表し, X はいつも元の列の位置のまま更新する.
+   iters[j] に列ごとの反復回数 (収束しなければ -1) を入れ, 全部の列が収束すれば最大の反復回数を, しなければ -1 を返す */
 
-/* 行列 a[1...N][1...N] とベクトル b[1...N] との積 c<-Ab */
-void matrix_vector_product(double **a, double *b, double *c)
+// Z = M^{-1} R (先頭 na 列) と列ごとの rho_j = r_j^T z_j. ヤコビ以外は1列ずつ取り出して precond_apply を使う
+static void block_precond(Precond *m, int n, int na, int ld, double *R, double *Z, double *u, double *v, double *rho)
 {
-  double wk;
+  double s;
   int i, j;
 
-  for ( i = 1; i <= N; i++ )
-  {
-    wk = 0.0;
-    for ( j = 1; j <= N; j++ )
-    {
-      wk += a[i][j] * b[j];
+  for ( j = 0; j < na; j++ ) rho[j] = 0.0;
+  if ( m->kind == PC_NONE ) { // Z = R
+    #pragma omp parallel for private(j) reduction(+:rho[:na]) schedule(static)
+    for ( i = 0; i < n; i++ ) {
+      const double *restrict r = &R[(size_t)i*ld];
+      for ( j = 0; j < na; j++ ) rho[j] += r[j] * r[j];
+    }
+    return;
+  }
+  if ( m->kind == PC_JACOBI ) {
+    #pragma omp parallel for private(j) reduction(+:rho[:na]) schedule(static)
+    for ( i = 0; i < n; i++ ) {
+      const double *restrict r = &R[(size_t)i*ld];
+      double *restrict z = &Z[(size_t)i*ld];
+      for ( j = 0; j < na; j++ ) {
+        z[j] = m->d[i] * r[j];
+        rho[j] += r[j] * z[j];
+      }
+    }
+    return;
+  }
+  for ( j = 0; j < na; j++ ) {
+    #pragma omp parallel for schedule(static)
+    for ( i = 0; i < n; i++ ) u[i+1] = R[(size_t)i*ld + j];
+    precond_apply(m, u, v);
+    s = 0.0;
+    #pragma omp parallel for reduction(+:s) schedule(static)
+    for ( i = 0; i < n; i++ ) {
+      Z[(size_t)i*ld + j] = v[i+1];
+      s += u[i+1] * v[i+1];
+    }
+    rho[j] = s;
+  }
+}
+
+int cg_block(CsrMatrix *a, Precond *m, int nrhs, double *B, double *X, int kmax, int *iters)
+{
+  double *R, *P, *Q, *Z, *u = NULL, *v = NULL;
+  double *bnorm, *rho, *rho_new, *alpha, *beta, *pq, *eps;
+  int i, j, c, k = 0, na = nrhs, ld = nrhs, n = a->n, *slot, *from;
+  size_t l, nn = (size_t)n * ld; // main で n*nrhs が int に収まることを確かめてある
+
+  R = dvector(0, nn-1);
+  P = dvector(0, nn-1);
+  Q = dvector(0, nn-1);
+  Z = ( m->kind == PC_NONE ) ? R : dvector(0, nn-1); // 前処理なしなら Z = R
+  if ( m->kind != PC_NONE && m->kind != PC_JACOBI ) {
+    u = dvector(1,n);
+    v = dvector(1,n);
+  }
+  bnorm = dvector(0, nrhs-1);
+  rho = dvector(0, nrhs-1);
+  rho_new = dvector(0, nrhs-1);
+  alpha = dvector(0, nrhs-1);
+  beta = dvector(0, nrhs-1);
+  pq = dvector(0, nrhs-1);
+  eps = dvector(0, nrhs-1);
+  slot = (int *)malloc(sizeof(int) * nrhs);
+  from = (int *)malloc(sizeof(int) * nrhs);
+  if ( slot == NULL || from == NULL ) {
+    fprintf(stderr, "cg_block: メモリ確保に失敗しました。\n");
+    exit(1);
+  }
+
+  // 初期化: R_0 = B - A X_0, Z_0 = M^{-1} R_0, P_0 = Z_0 と列ごとの b_j の1ノルム
+  for ( j = 0; j < nrhs; j++ ) {
+    slot[j] = j;
+    iters[j] = -1;
+    bnorm[j] = 0.0;
+  }
+  csr_spmm(a, nrhs, ld, X, Q, pq);
+  #pragma omp parallel for private(j) reduction(+:bnorm[:nrhs]) schedule(static)
+  for ( i = 0; i < n; i++ ) {
+    for ( j = 0; j < nrhs; j++ ) {
+      R[(size_t)i*ld + j] = B[(size_t)i*ld + j] - Q[(size_t)i*ld + j];
+      bnorm[j] += fabs(B[(size_t)i*ld + j]);
+    }
+  }
+  for ( j = 0; j < nrhs; j++ ) {
+    if ( bnorm[j] == 0.0 ) bnorm[j] = 1.0;
+  }
+  block_precond(m, n, na, ld, R, Z, u, v, rho);
+  #pragma omp parallel for schedule(static)
+  for ( l = 0; l < nn; l++ ) P[l] = Z[l];
+
+  do {
+    k++;
+
+    // Q = A P と列ごとの p_j^T A p_j (A は全部の列で1回だけ読む)
+    csr_spmm(a, na, ld, P, Q, pq);
+    for ( j = 0; j < na; j++ ) {
+      alpha[j] = rho[j] / pq[j];
+      eps[j] = 0.0;
+    }
+
+    // x_j <- x_j + alpha_j p_j, r_j <- r_j - alpha_j q_j と r_j の1ノルム, r_j^T r_j (前処理なしなら次の rho_j)
+    for ( j = 0; j < na; j++ ) rho_new[j] = 0.0;
+    #pragma omp parallel for private(j) reduction(+:eps[:na], rho_new[:na]) schedule(static)
+    for ( i = 0; i < n; i++ ) {
+      double *restrict x = &X[(size_t)i*ld], *restrict r = &R[(size_t)i*ld];
+      const double *restrict p = &P[(size_t)i*ld], *restrict q = &Q[(size_t)i*ld];
+      for ( j = 0; j < na; j++ ) {
+        x[slot[j]] += alpha[j] * p[j];
+        r[j] -= alpha[j] * q[j];
+        eps[j] += fabs(r[j]);
+        rho_new[j] += r[j] * r[j];
+      }
+    }
+
+    // 収束判定: 収束した列を外し, 残りの列を前に詰める (c 列が残る)
+    for ( j = c = 0; j < na; j++ ) {
+      if ( eps[j] < EPS * bnorm[j] ) {
+        iters[slot[j]] = k;
+        continue;
+      }
+      slot[c] = slot[j];
+      bnorm[c] = bnorm[j];
+      rho[c] = rho[j];
+      rho_new[c] = rho_new[j];
+      from[c] = j;
+      c++;
     }
-    c[i] = wk;
+    if ( c == 0 ) goto OUTPUT;
+    if ( c < na ) {
+      #pragma omp parallel for private(j) schedule(static)
+      for ( i = 0; i < n; i++ ) {
+        for ( j = 0; j < c; j++ ) {
+          R[(size_t)i*ld + j] = R[(size_t)i*ld + from[j]];
+          P[(size_t)i*ld + j] = P[(size_t)i*ld + from[j]];
+        }
+      }
+      na = c;
+    }
+
+    // Z = M^{-1} R, beta_j = rho_new_j / rho_j, p_j <- z_j + beta_j p_j
+    if ( Z != R ) block_precond(m, n, na, ld, R, Z, u, v, rho_new);
+    for ( j = 0; j < na; j++ ) {
+      beta[j] = rho_new[j] / rho[j];
+      rho[j] = rho_new[j];
+    }
+    #pragma omp parallel for private(j) schedule(static)
+    for ( i = 0; i < n; i++ ) {
+      double *restrict p = &P[(size_t)i*ld];
+      const double *restrict z = &Z[(size_t)i*ld];
+      for ( j = 0; j < na; j++ ) p[j] = z[j] + beta[j] * p[j];
+    }
+
+  } while( k < kmax );
+  k = -1;
+
+OUTPUT:
+  if ( Z != R ) free_dvector(Z, 0);
+  if ( u != NULL ) {
+    free_dvector(u, 1); free_dvector(v, 1);
   }
+  free_dvector(R, 0); free_dvector(P, 0); free_dvector(Q, 0);
+  free_dvector(bnorm, 0); free_dvector(rho, 0); free_dvector(rho_new, 0);
+  free_dvector(alpha, 0); free_dvector(beta, 0); free_dvector(pq, 0); free_dvector(eps, 0);
+  free(slot); free(from);
+  return k;
+}
+
+/* x <- x + alpha p, r <- r - alpha q と r の1ノルム, r^T r (前処理なしなら次の rho) を1回の走査で求める */
+void cg_update(int n, double alpha, double *p, double *q, double *x, double *r, double *norm1, double *rr)
+{
+  double s1 = 0.0, s2 = 0.0;
+  int i;
+
+  #pragma omp parallel for reduction(+:s1, s2) schedule(static)
+  for ( i = 1; i <= n; i++ ) {
+    x[i] += alpha * p[i];
+    r[i] -= alpha * q[i];
+    s1 += fabs(r[i]);
+    s2 += r[i] * r[i];
+  }
+  *norm1 = s1;
+  *rr = s2;
+}
+
+
+/* 行列 a とベクトル b[1...n] との積 c<-Ab
+   行の分割ごとに1スレッドが受け持ち, 各行は非零の列番号で b を間接参照して足し込む.
+   SELL-C-σ 形式があればチャンクの分割ごとに SIMD カーネルを呼び, 行列を作らない演算子なら op->apply を呼ぶ.
+   CG の p^T A p のために, 書いた c_i にその場で b_i を掛けて b^T c も求めて返す (c を読み直さずに済む) */
+double matrix_vector_product(CsrMatrix *a, double *b, double *c)
+{
+    const double *restrict x = &b[1];
+    double *restrict y = &c[1];
+    const int *restrict col = a->col;
+    const double *restrict val = a->val;
+    SellMatrix *sell = a->sell;
+    int t, i;
+    int64_t k;
+    double s, dot = 0.0;
+
+    if (a->op != NULL) return a->op->apply(a->op->data, x, y);
+    if (sell != NULL) {
+        #pragma omp parallel for reduction(+:dot) schedule(static, 1) if(sell->size >= 100000)
+        for (t = 0; t < sell->nparts; t++) {
+            dot += sell->kernel(sell, sell->part[t], sell->part[t + 1], x, y);
+        }
+        return dot;
+    }
+    #pragma omp parallel for private(i, k, s) reduction(+:dot) schedule(static, 1) if(a->nnz >= 100000)
+    for (t = 0; t < a->nparts; t++) {
+        for (i = a->part[t]; i < a->part[t + 1]; i++) {
+            s = 0.0;
+            for (k = a->ptr[i]; k < a->ptr[i + 1]; k++) {
+                s += val[k] * x[col[k]];
+            }
+            y[i] = s;
+            dot += x[i] * s;
+        }
+    }
+    return dot;
+}
+
+/* 疎行列 a と密ブロック P (n 行 ld 列の行優先, 添字は 0 から) の先頭 nb 列との積 Q <- AP
+   行の分割は matrix_vector_product と同じで, 各非零 a_ik を1回読む間に P の k 行目の nb 個の値に掛けて足し込む.
+   A (値と列番号) を nb 本の積で1回しか読まないので, nb 回の行列ベクトル積より主記憶の転送がずっと少ない.
+   列は BLOCK_NB 個ずつまとめて足し込む (同じ行の非零は2回目からはキャッシュにある).
+   SELL-C-σ 形式があっても CSR の配列を使う. 列ごとの p_j^T (A p_j) を dot[0...nb-1] に返す */
+void csr_spmm(CsrMatrix *a, int nb, int ld, const double *P, double *Q, double *dot)
+{
+    const int *restrict col = a->col;
+    const double *restrict val = a->val;
+    const double *restrict p;
+    double s[BLOCK_NB], v;
+    int t, i, j, j0, w;
+    int64_t k;
+
+    for (j = 0; j < nb; j++) dot[j] = 0.0;
+    #pragma omp parallel for private(i, j, j0, w, k, s, v, p) reduction(+:dot[:nb]) schedule(static, 1) if(a->nnz * nb >= 100000)
+    for (t = 0; t < a->nparts; t++) {
+        for (i = a->part[t]; i < a->part[t + 1]; i++) {
+            for (j0 = 0; j0 < nb; j0 += BLOCK_NB) {
+                w = (nb - j0 < BLOCK_NB) ? nb - j0 : BLOCK_NB;
+                for (j = 0; j < BLOCK_NB; j++) s[j] = 0.0;
+                if (w == BLOCK_NB) {
+                    // 幅が定数なら s は1本の SIMD レジスタ (AVX-512) に収まる
+                    for (k = a->ptr[i]; k < a->ptr[i + 1]; k++) {
+                        v = val[k];
+                        p = &P[(size_t)col[k] * ld + j0];
+                        for (j = 0; j < BLOCK_NB; j++) s[j] += v * p[j];
+                    }
+                } else {
+                    // 残りの列は1列ずつ (行の非零は L1 キャッシュから読み直す)
+                    for (j = 0; j < w; j++) {
+                        v = 0.0;
+                        for (k = a->ptr[i]; k < a->ptr[i + 1]; k++) {
+                            v += val[k] * P[(size_t)col[k] * ld + j0 + j];
+                        }
+                        s[j] = v;
+                    }
+                }
+                for (j = 0; j < w; j++) {
+                    Q[(size_t)i * ld + j0 + j] = s[j];
+                    dot[j0 + j] += P[(size_t)i * ld + j0 + j] * s[j];
+                }
+            }
+        }
+    }
+}
+
+/* 前処理 z = M^{-1} r
+   SSOR と IC(0) の三角解法は逐次的なので, 行列ベクトル積と同じ行の分割ごとに分割の外との結合を無視して
+   (分割ごとのブロック対角部分に対して) 作る. 1スレッドなら普通の SSOR / IC(0) になり, M は対称のまま */
+int precond_kind(const char *name)
+{
+    int k;
+
+    for (k = 0; k < PC_COUNT; k++) {
+        if (strcmp(name, precond_names[k]) == 0) return k;
+    }
+    printf("前処理の指定が正しくありません : %s \n", name);
+    exit(1);
+}
+
+// 対角ブロック (BJ_NB 行) を密行列に写してコレスキー分解 U^T U する. 正定値でなければ -1 を返す
+static int block_cholesky(const CsrMatrix *a, int b0, int nb, double *u)
+{
+    int i, j, k;
+    int64_t p;
+    double s;
+
+    memset(u, 0, sizeof(double) * BJ_NB * BJ_NB);
+    for (i = 0; i < nb; i++) {
+        for (p = a->ptr[b0 + i]; p < a->ptr[b0 + i + 1]; p++) {
+            j = a->col[p] - b0;
+            if (j >= i && j < nb) u[i * BJ_NB + j] = a->val[p];
+        }
+    }
+    for (k = 0; k < nb; k++) {
+        s = u[k * BJ_NB + k];
+        for (i = 0; i < k; i++) s -= u[i * BJ_NB + k] * u[i * BJ_NB + k];
+        if (s <= 0.0) return -1;
+        u[k * BJ_NB + k] = sqrt(s);
+        for (j = k + 1; j < nb; j++) {
+            s = u[k * BJ_NB + j];
+            for (i = 0; i < k; i++) s -= u[i * BJ_NB + k] * u[i * BJ_NB + j];
+            u[k * BJ_NB + j] = s / u[k * BJ_NB + k];
+        }
+    }
+    return 0;
+}
+
+// 行 lo, ..., hi-1 の IC(0) 分解 (列 lo 以上の下三角の非零の位置だけに L を作る, L L^T ~ A).
+// l_ik = (a_ik - sum_{m<k} l_im l_km) / l_kk の和は行 i と行 k の列番号の併合で求める.
+// 対角は a_ii (1 + shift) を使う. 対角が正にならなければ -1 を返す
+static int ic0_rows(const CsrMatrix *a, CsrMatrix *l, int lo, int hi, double shift)
+{
+    int i, k;
+    int64_t p, q, r, src, dk;
+    double s;
+
+    for (i = lo; i < hi; i++) {
+        // A の行 i から列 lo 以上 i 以下を写す
+        q = l->ptr[i];
+        for (src = a->ptr[i]; src < a->ptr[i + 1]; src++) {
+            if (a->col[src] >= lo && a->col[src] <= i) {
+                l->val[q++] = (a->col[src] == i) ? a->val[src] * (1.0 + shift) : a->val[src];
+            }
+        }
+        for (p = l->ptr[i]; p < l->ptr[i + 1] - 1; p++) {
+            k = l->col[p];
+            dk = l->ptr[k + 1] - 1;
+            s = l->val[p];
+            for (q = l->ptr[i], r = l->ptr[k]; q < p && r < dk; ) {
+                if (l->col[q] == l->col[r]) {
+                    s -= l->val[q++] * l->val[r++];
+                } else if (l->col[q] < l->col[r]) {
+                    q++;
+                } else {
+                    r++;
+                }
+            }
+            l->val[p] = s / l->val[dk];
+        }
+        s = l->val[p];
+        for (q = l->ptr[i]; q < p; q++) s -= l->val[q] * l->val[q];
+        if (s <= 0.0) return -1;
+        l->val[p] = sqrt(s);
+    }
+    return 0;
+}
+
+// 前処理の構築
+Precond *precond_create(CsrMatrix *a, int kind, double omega)
+{
+    Precond *m;
+    int i, t, nb, fail, lo;
+    int64_t p, nnz;
+    double shift;
+
+    if ((m = (Precond *)calloc(1, sizeof(Precond))) == NULL) {
+        fprintf(stderr, "precond_create: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    m->kind = kind;
+    m->a = a;
+    m->omega = omega;
+
+    if (a->op != NULL) {
+        // 行列を作らない演算子では成分を読めないので, 対角だけを使うヤコビ前処理まで
+        if (kind != PC_NONE && kind != PC_JACOBI) {
+            printf("行列を作らない演算子では %s 前処理は使えません\n", precond_names[kind]);
+            exit(1);
+        }
+        if (kind == PC_JACOBI) {
+            m->d = dvector(0, a->n - 1);
+            a->op->diagonal(a->op->data, m->d);
+            for (i = 0; i < a->n; i++) {
+                if (m->d[i] <= 0.0) {
+                    printf("対角成分が正ではありません (%d 行目)\n", i + 1);
+                    exit(1);
+                }
+                m->d[i] = 1.0 / m->d[i];
+            }
+        }
+        return m;
+    }
+
+    if (kind == PC_JACOBI || kind == PC_SSOR) {
+        m->d = dvector(0, a->n - 1);
+        #pragma omp parallel for private(p) schedule(static)
+        for (i = 0; i < a->n; i++) {
+            m->d[i] = 0.0;
+            for (p = a->ptr[i]; p < a->ptr[i + 1]; p++) {
+                if (a->col[p] == i) m->d[i] = a->val[p];
+            }
+        }
+        for (i = 0; i < a->n; i++) {
+            if (m->d[i] <= 0.0) {
+                printf("対角成分が正ではありません (%d 行目)\n", i + 1);
+                exit(1);
+            }
+        }
+        if (kind == PC_JACOBI) {
+            #pragma omp parallel for schedule(static)
+            for (i = 0; i < a->n; i++) m->d[i] = 1.0 / m->d[i];
+        }
+    } else if (kind == PC_BJACOBI) {
+        nb = (a->n + BJ_NB - 1) / BJ_NB;
+        if (posix_memalign((void **)&m->block, ALIGN, sizeof(double) * BJ_NB * BJ_NB * nb) != 0) {
+            fprintf(stderr, "precond_create: メモリ確保に失敗しました。\n");
+            exit(1);
+        }
+        fail = 0;
+        #pragma omp parallel for reduction(|:fail) schedule(static)
+        for (t = 0; t < nb; t++) {
+            lo = t * BJ_NB;
+            fail |= block_cholesky(a, lo, (a->n - lo < BJ_NB) ? a->n - lo : BJ_NB,
+                                   m->block + (size_t)t * BJ_NB * BJ_NB);
+        }
+        if (fail) {
+            printf("対角ブロックが正定値ではありません\n");
+            exit(1);
+        }
+    } else if (kind == PC_IC0) {
+        // L の非零の位置: 各行で同じ分割に入る列 j <= i (対角は行の最後)
+        nnz = 0;
+        for (t = 0; t < a->nparts; t++) {
+            for (i = a->part[t]; i < a->part[t + 1]; i++) {
+                for (p = a->ptr[i]; p < a->ptr[i + 1]; p++) {
+                    if (a->col[p] >= a->part[t] && a->col[p] <= i) nnz++;
+                }
+            }
+        }
+        m->l = csr_alloc(a->n, nnz);
+        for (t = 0; t < a->nparts; t++) {
+            for (i = a->part[t]; i < a->part[t + 1]; i++) {
+                m->l->ptr[i + 1] = m->l->ptr[i];
+                for (p = a->ptr[i]; p < a->ptr[i + 1]; p++) {
+                    if (a->col[p] >= a->part[t] && a->col[p] <= i) m->l->col[m->l->ptr[i + 1]++] = a->col[p];
+                }
+                if (m->l->ptr[i + 1] == m->l->ptr[i] || m->l->col[m->l->ptr[i + 1] - 1] != i) {
+                    printf("対角成分がありません (%d 行目)\n", i + 1);
+                    exit(1);
+                }
+            }
+        }
+        // 分解が破綻したら対角を (1 + shift) 倍して作り直す
+        for (shift = 0.0; ; shift = (shift == 0.0) ? 1e-3 : 2.0 * shift) {
+            fail = 0;
+            #pragma omp parallel for reduction(|:fail) schedule(static, 1)
+            for (t = 0; t < a->nparts; t++) {
+                fail |= ic0_rows(a, m->l, a->part[t], a->part[t + 1], shift);
+            }
+            if (!fail) break;
+            if (shift > 1e3) {
+                printf("不完全コレスキー分解ができません\n");
+                exit(1);
+            }
+        }
+        if (shift > 0.0) printf("IC(0): 対角を %g 倍して分解しました\n", 1.0 + shift);
+    }
+    return m;
+}
+
+void precond_free(Precond *m)
+{
+    if (m->d != NULL) free_dvector(m->d, 0);
+    free(m->block);
+    if (m->l != NULL) csr_free(m->l);
+    free(m);
 }
 
-/* ベクトル領域の確保 */
+// z[1...n] = M^{-1} r[1...n]
+void precond_apply(Precond *m, double *r, double *z)
+{
+    const CsrMatrix *a = m->a, *l = m->l;
+    const double *rr = &r[1];
+    double *zz = &z[1], *u, s, w = m->omega;
+    int n = a->n, i, j, k, t, lo, hi, nb;
+    int64_t p;
+
+    switch (m->kind) {
+    case PC_NONE:
+        #pragma omp parallel for schedule(static) if(n >= 10000)
+        for (i = 0; i < n; i++) zz[i] = rr[i];
+        break;
+
+    case PC_JACOBI:
+        #pragma omp parallel for schedule(static) if(n >= 10000)
+        for (i = 0; i < n; i++) zz[i] = m->d[i] * rr[i];
+        break;
+
+    case PC_BJACOBI:
+        // ブロックごとに U^T y = r, U z = y
+        #pragma omp parallel for private(lo, nb, u, i, k, s) schedule(static) if(n >= 10000)
+        for (t = 0; t < (n + BJ_NB - 1) / BJ_NB; t++) {
+            lo = t * BJ_NB;
+            nb = (n - lo < BJ_NB) ? n - lo : BJ_NB;
+            u = m->block + (size_t)t * BJ_NB * BJ_NB;
+            for (i = 0; i < nb; i++) {
+                s = rr[lo + i];
+                for (k = 0; k < i; k++) s -= u[k * BJ_NB + i] * zz[lo + k];
+                zz[lo + i] = s / u[i * BJ_NB + i];
+            }
+            for (i = nb - 1; i >= 0; i--) {
+                s = zz[lo + i];
+                for (k = i + 1; k < nb; k++) s -= u[i * BJ_NB + k] * zz[lo + k];
+                zz[lo + i] = s / u[i * BJ_NB + i];
+            }
+        }
+        break;
+
+    case PC_SSOR:
+        // M = w/(2-w) (D/w + L) (D/w)^{-1} (D/w + U): (D/w + L) y = r を解き,
+        // (D/w + U) z = (2-w)/w * (D/w) y を解く
+        #pragma omp parallel for private(lo, hi, i, j, p, s) schedule(static, 1)
+        for (t = 0; t < a->nparts; t++) {
+            lo = a->part[t];
+            hi = a->part[t + 1];
+            for (i = lo; i < hi; i++) {
+                s = rr[i];
+                for (p = a->ptr[i]; p < a->ptr[i + 1] && a->col[p] < i; p++) {
+                    j = a->col[p];
+                    if (j >= lo) s -= a->val[p] * zz[j];
+                }
+                zz[i] = s * w / m->d[i];
+            }
+            for (i = hi - 1; i >= lo; i--) {
+                s = (2.0 - w) * m->d[i] * zz[i] / (w * w);
+                for (p = a->ptr[i + 1] - 1; p >= a->ptr[i] && a->col[p] > i; p--) {
+                    j = a->col[p];
+                    if (j < hi) s -= a->val[p] * zz[j];
+                }
+                zz[i] = s * w / m->d[i];
+            }
+        }
+        break;
+
+    case PC_IC0:
+        // L y = r (行ごと), L^T z = y (列ごとに, 解いた成分を上の行へ配る)
+        #pragma omp parallel for private(lo, hi, i, p, s) schedule(static, 1)
+        for (t = 0; t < a->nparts; t++) {
+            lo = a->part[t];
+            hi = a->part[t + 1];
+            for (i = lo; i < hi; i++) {
+                s = rr[i];
+                for (p = l->ptr[i]; p < l->ptr[i + 1] - 1; p++) s -= l->val[p] * zz[l->col[p]];
+                zz[i] = s / l->val[p];
+            }
+            for (i = hi - 1; i >= lo; i--) {
+                p = l->ptr[i + 1] - 1;
+                zz[i] /= l->val[p];
+                s = zz[i];
+                for (p = l->ptr[i]; p < l->ptr[i + 1] - 1; p++) zz[l->col[p]] -= l->val[p] * s;
+            }
+        }
+        break;
+    }
+}
+
+/* CSR 行列の領域確保 (ptr は 0 で埋める) */
+CsrMatrix *csr_alloc(int n, int64_t nnz)
+{
+    CsrMatrix *a;
+
+    if ((a = (CsrMatrix *)malloc(sizeof(CsrMatrix))) == NULL
+        || (a->ptr = (int64_t *)calloc((size_t)n + 1, sizeof(int64_t))) == NULL
+        || (a->col = (int *)malloc(sizeof(int) * (nnz > 0 ? nnz : 1))) == NULL
+        || (a->val = (double *)malloc(sizeof(double) * (nnz > 0 ? nnz : 1))) == NULL) {
+        fprintf(stderr, "csr_alloc: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    a->n = n;
+    a->nnz = nnz;
+    a->nparts = 0;
+    a->part = NULL;
+    a->sell = NULL;
+    a->op = NULL;
+    return a;
+}
+
+void csr_free(CsrMatrix *a)
+{
+    free(a->ptr);
+    free(a->col);
+    free(a->val);
+    free(a->part);
+    if (a->sell != NULL) sell_free(a->sell);
+    if (a->op != NULL) {
+        a->op->release(a->op->data);
+        free(a->op);
+    }
+    free(a);
+}
+
+/* 非零の数が t * nnz / nparts を超える最初の行を二分探索で求め, 分割の境界にする */
+void csr_partition(CsrMatrix *a)
+{
+    int t, lo, hi, mid;
+    int64_t target;
+
+#ifdef _OPENMP
+    a->nparts = omp_get_max_threads();
+#else
+    a->nparts = 1;
+#endif
+    if ((a->part = (int *)malloc(sizeof(int) * (a->nparts + 1))) == NULL) {
+        fprintf(stderr, "csr_partition: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    a->part[0] = 0;
+    for (t = 1; t < a->nparts; t++) {
+        target = a->nnz * t / a->nparts;
+        lo = a->part[t - 1];
+        hi = a->n;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (a->ptr[mid] < target) lo = mid + 1;
+            else hi = mid;
+        }
+        a->part[t] = lo;
+    }
+    a->part[a->nparts] = a->n;
+}
+
+/* SELL-C-σ 形式への変換
+   σ 行ずつの窓の中で行を非零の数の多い順に並べ替え, 並べ替えた行を C 行ずつのチャンクにまとめる.
+   チャンクの幅はその中で最も長い行に合わせ, 短い行は値 0 の要素で埋める. 窓の外へは並べ替えないので
+   x の参照の局所性は σ が小さいほど保たれ, 詰め物は σ が大きいほど減る */
+
+// 窓ごとに (長い順, 同じ長さは行番号順) に並べるためのキー
+static int compare_key(const void *p, const void *q)
+{
+    int64_t a = *(const int64_t *)p, b = *(const int64_t *)q;
+    return (a > b) - (a < b);
+}
+
+// 並べ替えた順 perm (新しい位置 -> 元の行) を作り, 詰め物を含めた格納要素数を返す
+int64_t sell_order(const CsrMatrix *a, int C, int sigma, int *perm)
+{
+    int w, i, q, m, len, maxlen;
+    int64_t size = 0, *key;
+
+    if ((key = (int64_t *)malloc(sizeof(int64_t) * sigma)) == NULL) {
+        fprintf(stderr, "sell_order: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    for (w = 0; w < a->n; w += sigma) {
+        m = (a->n - w < sigma) ? a->n - w : sigma;
+        for (i = 0; i < m; i++) {
+            len = (int)(a->ptr[w + i + 1] - a->ptr[w + i]);
+            key[i] = ((int64_t)(INT32_MAX - len) << 32) | (w + i);
+        }
+        if (sigma > C) qsort(key, m, sizeof(int64_t), compare_key);
+        for (i = 0; i < m; i++) {
+            perm[w + i] = (int)(key[i] & 0xffffffff);
+        }
+        // チャンクの幅はその中で最も長い行の長さ
+        for (i = 0; i < m; i += C) {
+            maxlen = 0;
+            for (q = i; q < m && q < i + C; q++) {
+                len = INT32_MAX - (int)(key[q] >> 32);
+                if (len > maxlen) maxlen = len;
+            }
+            size += (int64_t)C * maxlen;
+        }
+    }
+    free(key);
+    return size;
+}
+
+// σ を C から4倍ずつ広げ, 詰め物が非零の SELL_FILL 倍以下になった最初の値を使う
+int sell_choose_sigma(const CsrMatrix *a, int C)
+{
+    int sigma, best = C, *perm;
+    int64_t size, best_size = -1;
+
+    if ((perm = (int *)malloc(sizeof(int) * (a->n > 0 ? a->n : 1))) == NULL) {
+        fprintf(stderr, "sell_choose_sigma: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    for (sigma = C; ; sigma *= 4) {
+        size = sell_order(a, C, sigma, perm);
+        if (best_size < 0 || size < best_size) {
+            best = sigma;
+            best_size = size;
+        }
+        if (size <= SELL_FILL * a->nnz || sigma >= a->n || sigma > INT32_MAX / 4) break;
+    }
+    free(perm);
+    return best;
+}
+
+// CSR から SELL-C-σ を作る (sigma は C の倍数, 0 なら自動で選ぶ).
+// 各チャンクは列優先 (要素 j の C 行分が連続) で, 1つの SIMD レーンが1行を受け持つ
+SellMatrix *sell_from_csr(const CsrMatrix *a, int C, int sigma)
+{
+    SellMatrix *s;
+    int c, r, j, p, row, len, t, lo, hi, mid;
+    int64_t k, base, target;
+
+    if (sigma <= 0) sigma = sell_choose_sigma(a, C);
+    sigma = (sigma + C - 1) / C * C;
+    if ((s = (SellMatrix *)malloc(sizeof(SellMatrix))) == NULL) {
+        fprintf(stderr, "sell_from_csr: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    s->n = a->n;
+    s->C = C;
+    s->sigma = sigma;
+    s->nchunks = (a->n + C - 1) / C;
+    s->perm = (int *)malloc(sizeof(int) * ((size_t)s->nchunks * C + C));
+    s->cptr = (int64_t *)malloc(sizeof(int64_t) * (s->nchunks + 1));
+    s->clen = (int *)malloc(sizeof(int) * (s->nchunks + 1));
+    if (s->perm == NULL || s->cptr == NULL || s->clen == NULL) {
+        fprintf(stderr, "sell_from_csr: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    sell_order(a, C, sigma, s->perm);
+    s->cptr[0] = 0;
+    for (c = 0; c < s->nchunks; c++) {
+        s->clen[c] = 0;
+        for (r = 0; r < C && c * C + r < a->n; r++) {
+            row = s->perm[c * C + r];
+            len = (int)(a->ptr[row + 1] - a->ptr[row]);
+            if (len > s->clen[c]) s->clen[c] = len;
+        }
+        s->cptr[c + 1] = s->cptr[c] + (int64_t)C * s->clen[c];
+    }
+    s->size = s->cptr[s->nchunks];
+    if (posix_memalign((void **)&s->val, ALIGN, sizeof(double) * (s->size > 0 ? s->size : 1)) != 0
+        || posix_memalign((void **)&s->col, ALIGN, sizeof(int) * (s->size > 0 ? s->size : 1)) != 0) {
+        fprintf(stderr, "sell_from_csr: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+
+    // 行列ベクトル積と同じ分割で書く (ファーストタッチ). 詰め物は自分の行の列を値 0 で参照する
+    #pragma omp parallel for private(r, j, p, row, len, k, base) schedule(static)
+    for (c = 0; c < s->nchunks; c++) {
+        base = s->cptr[c];
+        for (r = 0; r < C; r++) {
+            p = c * C + r;
+            row = (p < a->n) ? s->perm[p] : 0;
+            len = (p < a->n) ? (int)(a->ptr[row + 1] - a->ptr[row]) : 0;
+            k = a->ptr[row];
+            for (j = 0; j < s->clen[c]; j++) {
+                s->col[base + (int64_t)j * C + r] = (j < len) ? a->col[k + j] : row;
+                s->val[base + (int64_t)j * C + r] = (j < len) ? a->val[k + j] : 0.0;
+            }
+        }
+    }
+
+    // 格納要素数がほぼ等しくなるようにチャンクをスレッドに分ける
+    s->nparts = a->nparts;
+    if ((s->part = (int *)malloc(sizeof(int) * (s->nparts + 1))) == NULL) {
+        fprintf(stderr, "sell_from_csr: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    s->part[0] = 0;
+    for (t = 1; t < s->nparts; t++) {
+        target = s->size * t / s->nparts;
+        lo = s->part[t - 1];
+        hi = s->nchunks;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (s->cptr[mid] < target) lo = mid + 1;
+            else hi = mid;
+        }
+        s->part[t] = lo;
+    }
+    s->part[s->nparts] = s->nchunks;
+    return s;
+}
+
+void sell_free(SellMatrix *s)
+{
+    free(s->perm);
+    free(s->cptr);
+    free(s->clen);
+    free(s->col);
+    free(s->val);
+    free(s->part);
+    free(s);
+}
+
+/* SELL-C-σ の行列ベクトル積 y = A x (チャンク c0, ..., c1-1)
+   チャンクの要素 j ごとに C 行分の値を連続に読み, x を列番号でギャザーして C 本のアキュムレータに足す.
+   結果は元の行番号 perm に書き戻す. 要素を2つずつ処理して FMA の遅延を隠す.
+   書き戻す行の x_i との積の和 (x^T y の部分和) を返す */
+double sell_spmv_scalar(const SellMatrix *s, int c0, int c1, const double *x, double *y)
+{
+    int c, r, j, C = s->C;
+    const double *v;
+    const int *ci;
+    double sum, dot = 0.0;
+
+    for (c = c0; c < c1; c++) {
+        v = s->val + s->cptr[c];
+        ci = s->col + s->cptr[c];
+        for (r = 0; r < C && c * C + r < s->n; r++) {
+            sum = 0.0;
+            for (j = 0; j < s->clen[c]; j++) {
+                sum += v[j * C + r] * x[ci[j * C + r]];
+            }
+            y[s->perm[c * C + r]] = sum;
+            dot += x[s->perm[c * C + r]] * sum;
+        }
+    }
+    return dot;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// C = 4
+__attribute__((target("avx2,fma")))
+double sell_spmv_avx2(const SellMatrix *s, int c0, int c1, const double *x, double *y)
+{
+    int c, j, r, len;
+    const double *v;
+    const int *ci;
+    __m256d acc0, acc1;
+    double t[4], dot = 0.0;
+
+    for (c = c0; c < c1; c++) {
+        v = s->val + s->cptr[c];
+        ci = s->col + s->cptr[c];
+        len = s->clen[c];
+        acc0 = acc1 = _mm256_setzero_pd();
+        for (j = 0; j + 2 <= len; j += 2) {
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(v + 4 * j),
+                                   _mm256_i32gather_pd(x, _mm_loadu_si128((const __m128i *)(ci + 4 * j)), 8), acc0);
+            acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(v + 4 * j + 4),
+                                   _mm256_i32gather_pd(x, _mm_loadu_si128((const __m128i *)(ci + 4 * j + 4)), 8), acc1);
+        }
+        if (j < len) {
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(v + 4 * j),
+                                   _mm256_i32gather_pd(x, _mm_loadu_si128((const __m128i *)(ci + 4 * j)), 8), acc0);
+        }
+        _mm256_storeu_pd(t, _mm256_add_pd(acc0, acc1));
+        for (r = 0; r < 4 && c * 4 + r < s->n; r++) {
+            y[s->perm[c * 4 + r]] = t[r];
+            dot += x[s->perm[c * 4 + r]] * t[r];
+        }
+    }
+    return dot;
+}
+
+// C = 8 (書き戻しはマスク付きスキャッタ, 最後のチャンクの行列の外のレーンは書かない. perm は C 個分余分に確保してある)
+__attribute__((target("avx512f")))
+double sell_spmv_avx512(const SellMatrix *s, int c0, int c1, const double *x, double *y)
+{
+    int c, j, len;
+    const double *v;
+    const int *ci;
+    __m512d acc0, acc1, dot = _mm512_setzero_pd();
+    __m256i idx;
+    __mmask8 k;
+
+    for (c = c0; c < c1; c++) {
+        v = s->val + s->cptr[c];
+        ci = s->col + s->cptr[c];
+        len = s->clen[c];
+        acc0 = acc1 = _mm512_setzero_pd();
+        for (j = 0; j + 2 <= len; j += 2) {
+            acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(v + 8 * j),
+                                   _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(ci + 8 * j)), x, 8), acc0);
+            acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(v + 8 * j + 8),
+                                   _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(ci + 8 * j + 8)), x, 8), acc1);
+        }
+        if (j < len) {
+            acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(v + 8 * j),
+                                   _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)(ci + 8 * j)), x, 8), acc0);
+        }
+        k = (s->n - c * 8 >= 8) ? 0xFF : (__mmask8)((1u << (s->n - c * 8)) - 1);
+        idx = _mm256_loadu_si256((const __m256i *)(s->perm + c * 8));
+        acc0 = _mm512_add_pd(acc0, acc1);
+        _mm512_mask_i32scatter_pd(y, k, idx, acc0, 8);
+        dot = _mm512_fmadd_pd(_mm512_mask_i32gather_pd(_mm512_setzero_pd(), k, idx, x, 8), acc0, dot);
+    }
+    return _mm512_reduce_add_pd(dot);
+}
+#endif
+
+// 使えるカーネルとその C を選ぶ. 環境変数 SPMV_ISA (scalar, avx2, avx512) で明示的に選ぶこともできる
+sell_fn sell_select(const char **name, int *C)
+{
+    const char *isa = getenv("SPMV_ISA");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa == NULL || strcmp(isa, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        *name = "avx512";
+        *C = 8;
+        return sell_spmv_avx512;
+    }
+    if ((isa == NULL || strcmp(isa, "avx2") == 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        *C = 4;
+        return sell_spmv_avx2;
+    }
+#endif
+    (void)isa;
+    *name = "scalar";
+    *C = 4;
+    return sell_spmv_scalar;
+}
+
+/* 2次元・3次元のポアソン方程式 -Δu = f を 5点 / 7点差分で離散化した係数行列 (ディリクレ境界)
+   格子点 (ix, iy, iz) を i = ix + nx * (iy + ny * iz) と番号付ける. ny = nz = 1 なら 1次元 (3重対角).
+   対角成分は diag (0 以下なら 2 x 次元. input_matrix.txt は -p 10 -d 4 と同じ行列)
+   各行の非零の数は式で分かるので, 行の先頭位置を求めてから各スレッドが自分の行を書く (ファーストタッチ) */
+CsrMatrix *poisson_matrix(int nx, int ny, int nz, double diag)
+{
+    CsrMatrix *a;
+    int i, ix, iy, iz, dim;
+    int64_t n = (int64_t)nx * ny * nz, nnz, k;
+
+    if (n > 0x7fffffff) {
+        printf("格子点が多すぎます\n");
+        exit(1);
+    }
+    dim = (nz > 1) ? 3 : (ny > 1) ? 2 : 1;
+    if (diag <= 0.0) diag = 2.0 * dim;
+    nnz = n + 2 * ((int64_t)(nx - 1) * ny * nz
+                 + (int64_t)nx * (ny - 1) * nz
+                 + (int64_t)nx * ny * (nz - 1));
+    a = csr_alloc((int)n, nnz);
+
+    // 行 i の非零の数 = 1 + 隣接する格子点の数
+    #pragma omp parallel for private(ix, iy, iz) schedule(static)
+    for (i = 0; i < (int)n; i++) {
+        ix = i % nx;
+        iy = (i / nx) % ny;
+        iz = i / nx / ny;
+        a->ptr[i + 1] = 1 + (ix > 0) + (ix < nx - 1) + (iy > 0) + (iy < ny - 1) + (iz > 0) + (iz < nz - 1);
+    }
+    for (i = 0; i < (int)n; i++) {
+        a->ptr[i + 1] += a->ptr[i];
+    }
+
+    // 列番号の小さい順に並べる
+    #pragma omp parallel for private(ix, iy, iz, k) schedule(static)
+    for (i = 0; i < (int)n; i++) {
+        ix = i % nx;
+        iy = (i / nx) % ny;
+        iz = i / nx / ny;
+        k = a->ptr[i];
+        if (iz > 0)      { a->col[k] = i - nx * ny; a->val[k++] = -1.0; }
+        if (iy > 0)      { a->col[k] = i - nx;      a->val[k++] = -1.0; }
+        if (ix > 0)      { a->col[k] = i - 1;       a->val[k++] = -1.0; }
+        a->col[k] = i; a->val[k++] = diag;
+        if (ix < nx - 1) { a->col[k] = i + 1;       a->val[k++] = -1.0; }
+        if (iy < ny - 1) { a->col[k] = i + nx;      a->val[k++] = -1.0; }
+        if (iz < nz - 1) { a->col[k] = i + nx * ny; a->val[k++] = -1.0; }
+    }
+    csr_partition(a);
+    return a;
+}
+
+/* 行列を作らないステンシル演算子
+   poisson_matrix と同じ係数 (中央 diag, 隣接する格子点 -1) を, 格子の各行 (x 方向の nx 点) ごとに
+   y_i = c x_i + wx (x_{i-1} + x_{i+1}) + wy (x の y 方向の隣の行) + wz (z 方向の隣の面の行) として求める.
+   行列の値も列番号も読まないので, 主記憶から読むのは x と y だけになる.
+   境界の外の行は零の行 zero で表すので, 行の内側のループは分岐なしで SIMD 化できる.
+   3次元では y 方向を bj 行ずつのタイルに分け, タイルごとに z 方向へ進む (キャッシュブロッキング):
+   面 k-1, k, k+1 のタイル分の行がキャッシュに残るので, x の各行は主記憶から1回しか読まない.
+   タイル (1次元では行をスレッドの数に分けた区間) をスレッドに割り当てる */
+typedef struct {
+    int nx, ny, nz;
+    int bj;        // タイルの行数 (y 方向)
+    int ni;        // 行を分ける区間の数 (1次元のときだけ 2 以上)
+    double c, wx, wy, wz;
+    double *zero;  // 境界の外 (nx 個の 0)
+} Stencil;
+
+// 面 k の行 j の区間 [i0, i1) の y = Ax と x^T y
+static double stencil_row(const Stencil *s, const double *x, double *y, int j, int k, int i0, int i1)
+{
+    int nx = s->nx, i;
+    size_t o = ((size_t)k * s->ny + j) * nx, plane = (size_t)s->ny * nx;
+    const double *restrict xc = x + o;
+    const double *restrict xs = (j > 0) ? xc - nx : s->zero;
+    const double *restrict xn = (j < s->ny - 1) ? xc + nx : s->zero;
+    const double *restrict xb = (k > 0) ? xc - plane : s->zero;
+    const double *restrict xt = (k < s->nz - 1) ? xc + plane : s->zero;
+    double *restrict yc = y + o;
+    double c = s->c, wx = s->wx, wy = s->wy, wz = s->wz, v, dot = 0.0;
+    int lo = (i0 > 1) ? i0 : 1, hi = (i1 < nx - 1) ? i1 : nx - 1;
+
+    // 行の両端は x 方向の隣が片方しかない
+    for (i = i0; i < i1 && i < lo; i++) {
+        v = c * xc[i] + wy * (xs[i] + xn[i]) + wz * (xb[i] + xt[i]);
+        if (i + 1 < nx) v += wx * xc[i + 1];
+        yc[i] = v;
+        dot += xc[i] * v;
+    }
+    #pragma omp simd reduction(+:dot)
+    for (i = lo; i < hi; i++) {
+        v = c * xc[i] + wx * (xc[i - 1] + xc[i + 1]) + wy * (xs[i] + xn[i]) + wz * (xb[i] + xt[i]);
+        yc[i] = v;
+        dot += xc[i] * v;
+    }
+    for (i = (hi > lo) ? hi : lo; i < i1; i++) {
+        v = c * xc[i] + wx * xc[i - 1] + wy * (xs[i] + xn[i]) + wz * (xb[i] + xt[i]);
+        yc[i] = v;
+        dot += xc[i] * v;
+    }
+    return dot;
+}
+
+static double stencil_apply(const void *data, const double *x, double *y)
+{
+    const Stencil *s = (const Stencil *)data;
+    int t, q, j, k, j0, j1, i0, i1, ntile = (s->ny + s->bj - 1) / s->bj;
+    double dot = 0.0;
+
+    #pragma omp parallel for collapse(2) private(j, k, j0, j1, i0, i1) reduction(+:dot) schedule(static) if((int64_t)s->nx * s->ny * s->nz >= 10000)
+    for (t = 0; t < ntile; t++) {
+        for (q = 0; q < s->ni; q++) {
+            j0 = t * s->bj;
+            j1 = (j0 + s->bj < s->ny) ? j0 + s->bj : s->ny;
+            i0 = (int)((int64_t)s->nx * q / s->ni);
+            i1 = (int)((int64_t)s->nx * (q + 1) / s->ni);
+            for (k = 0; k < s->nz; k++) {
+                for (j = j0; j < j1; j++) {
+                    dot += stencil_row(s, x, y, j, k, i0, i1);
+                }
+            }
+        }
+    }
+    return dot;
+}
+
+static void stencil_diagonal(const void *data, double *d)
+{
+    const Stencil *s = (const Stencil *)data;
+    int64_t i, n = (int64_t)s->nx * s->ny * s->nz;
+
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++) d[i] = s->c;
+}
+
+static void stencil_release(void *data)
+{
+    Stencil *s = (Stencil *)data;
+
+    free_dvector(s->zero, 0);
+    free(s);
+}
+
+CsrMatrix *stencil_operator(int nx, int ny, int nz, double diag)
+{
+    CsrMatrix *a;
+    Stencil *s;
+    int i, nthreads, dim;
+    int64_t n = (int64_t)nx * ny * nz;
+
+    if (n > 0x7fffffff) {
+        printf("格子点が多すぎます\n");
+        exit(1);
+    }
+    if ((a = (CsrMatrix *)calloc(1, sizeof(CsrMatrix))) == NULL
+        || (a->op = (Operator *)malloc(sizeof(Operator))) == NULL
+        || (s = (Stencil *)malloc(sizeof(Stencil))) == NULL) {
+        fprintf(stderr, "stencil_operator: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    dim = (nz > 1) ? 3 : (ny > 1) ? 2 : 1;
+    s->nx = nx;
+    s->ny = ny;
+    s->nz = nz;
+    s->c = (diag > 0.0) ? diag : 2.0 * dim;
+    s->wx = (nx > 1) ? -1.0 : 0.0;
+    s->wy = (ny > 1) ? -1.0 : 0.0;
+    s->wz = (nz > 1) ? -1.0 : 0.0;
+    // タイルの行数: 3面分の x と y の行が STENCIL_CACHE に収まり, かつタイルの数がスレッドの数以上になるように
+    s->bj = STENCIL_CACHE / (4 * (int)sizeof(double) * nx);
+    if (s->bj > (ny + nthreads - 1) / nthreads) s->bj = (ny + nthreads - 1) / nthreads;
+    if (s->bj < 1) s->bj = 1;
+    s->ni = (ny == 1 && nz == 1 && nx >= 10000) ? nthreads : 1;
+    s->zero = dvector(0, nx - 1);
+    for (i = 0; i < nx; i++) s->zero[i] = 0.0;
+
+    a->n = (int)n;
+    a->nnz = n + 2 * ((int64_t)(nx - 1) * ny * nz + (int64_t)nx * (ny - 1) * nz + (int64_t)nx * ny * (nz - 1));
+    a->op->apply = stencil_apply;
+    a->op->diagonal = stencil_diagonal;
+    a->op->release = stencil_release;
+    a->op->data = s;
+    return a;
+}
+
+/* ベクトル領域の確保
+   先頭要素 a[i] が 64 バイト境界に来るように確保する */
 double *dvector(int i, int j) {
-    double *p = (double *)malloc(sizeof(double) * (j - i + 2));
-    if (p == NULL) {
+    char *base;
+    double *p;
+    size_t n = ((size_t)(j - i + 1) + 7) & ~(size_t)7;
+
+    /* 先頭の ALIGN バイトは空けておき, 要素の直前に領域の先頭を保存する (free_dvector で使う) */
+    if (posix_memalign((void **)&base, ALIGN, ALIGN + sizeof(double) * n) != 0) {
         fprintf(stderr, "dvector: メモリ確保に失敗しました。\n");
         exit(1);
     }
-    return p - i + 1;
+    p = (double *)(base + ALIGN);
+    ((void **)p)[-1] = base;
+    return p - i;
 }
 
 /* ベクトル領域の解放 */
 void free_dvector(double *a, int i) {
-    free(a + i - 1);
+    free(((void **)(a + i))[-1]);
 }
 
-/* 行列領域の確保 */
-double **dmatrix(int nr1, int nr2, int nl1, int nl2) {
-    int i;
-    double **p = (double **)malloc(sizeof(double *) * (nr2 - nr1 + 2));
-    if (p == NULL) {
-        fprintf(stderr, "dmatrix: メモリ確保に失敗しました。\n");
+/* Matrix Market の座標形式 (coordinate real / integer / pattern, general / symmetric) を読む.
+   symmetric は下三角だけが書かれているので上三角にも写す. 行ごとに数えてから詰め, 各行を列番号の順に並べる */
+CsrMatrix *read_matrix_market(FILE *fin, char *header)
+{
+    char object[32], format[32], field[32], symmetry[32], line[1024];
+    long long rows, cols, nz, k, e, count;
+    int *ri, *ci, i, j, pattern, symmetric, c;
+    double *v, val;
+    int64_t p, q;
+    CsrMatrix *a;
+
+    if (sscanf(header, "%%%%MatrixMarket %31s %31s %31s %31s", object, format, field, symmetry) != 4
+        || strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0) {
+        fprintf(stderr, "Matrix Market の座標形式 (coordinate) のみ読めます。\n");
         exit(1);
     }
-    p = p - nr1 + 1;
-    
-    for (i = nr1; i <= nr2; i++) {
-        p[i] = (double *)malloc(sizeof(double) * (nl2 - nl1 + 2));
-        if (p[i] == NULL) {
-            fprintf(stderr, "dmatrix: メモリ確保に失敗しました。\n");
+    pattern = (strcmp(field, "pattern") == 0);
+    symmetric = (strcmp(symmetry, "symmetric") == 0);
+    if ((!pattern && strcmp(field, "real") != 0 && strcmp(field, "integer") != 0)
+        || (!symmetric && strcmp(symmetry, "general") != 0)) {
+        fprintf(stderr, "対応していない形式です: %s %s\n", field, symmetry);
+        exit(1);
+    }
+    // コメント行を読み飛ばしてサイズの行を読む
+    do {
+        if (fgets(line, sizeof(line), fin) == NULL) {
+            fprintf(stderr, "行列の読み込みエラーです。\n");
             exit(1);
         }
-        p[i] = p[i] - nl1 + 1;
+    } while (line[0] == '%');
+    if (sscanf(line, "%lld %lld %lld", &rows, &cols, &nz) != 3 || rows != cols || rows > 0x7fffffff) {
+        fprintf(stderr, "正方行列ではありません。\n");
+        exit(1);
     }
-    return p;
-}
 
-/* 行列領域の解放 */
-void free_dmatrix(double **a, int nr1, int nr2, int nl1, int nl2) {
-    int i;
-    for (i = nr1; i <= nr2; i++) {
-        free(a[i] + nl1 - 1);
+    count = symmetric ? 2 * nz : nz;
+    ri = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
+    ci = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
+    v = (double *)malloc(sizeof(double) * (count > 0 ? count : 1));
+    if (ri == NULL || ci == NULL || v == NULL) {
+        fprintf(stderr, "read_matrix_market: メモリ確保に失敗しました。\n");
+        exit(1);
+    }
+    e = 0;
+    for (k = 0; k < nz; k++) {
+        val = 1.0;
+        if (fscanf(fin, "%d %d", &i, &j) != 2 || (!pattern && fscanf(fin, "%lf", &val) != 1)
+            || i < 1 || i > rows || j < 1 || j > rows) {
+            fprintf(stderr, "行列の読み込みエラーです (%lld 番目の要素)。\n", k + 1);
+            exit(1);
+        }
+        ri[e] = i - 1; ci[e] = j - 1; v[e++] = val;
+        if (symmetric && i != j) {
+            ri[e] = j - 1; ci[e] = i - 1; v[e++] = val;
+        }
     }
-    free(a + nr1 - 1);
+
+    a = csr_alloc((int)rows, e);
+    for (k = 0; k < e; k++) {
+        a->ptr[ri[k] + 1]++;
+    }
+    for (i = 0; i < a->n; i++) {
+        a->ptr[i + 1] += a->ptr[i];
+    }
+    for (k = 0; k < e; k++) {
+        p = a->ptr[ri[k]]++;
+        a->col[p] = ci[k];
+        a->val[p] = v[k];
+    }
+    // 詰めるときに進めた ptr を戻す
+    for (i = a->n; i > 0; i--) {
+        a->ptr[i] = a->ptr[i - 1];
+    }
+    a->ptr[0] = 0;
+    // 各行を列番号の順に (挿入ソート, 行は短い)
+    for (i = 0; i < a->n; i++) {
+        for (p = a->ptr[i] + 1; p < a->ptr[i + 1]; p++) {
+            c = a->col[p];
+            val = a->val[p];
+            for (q = p; q > a->ptr[i] && a->col[q - 1] > c; q--) {
+                a->col[q] = a->col[q - 1];
+                a->val[q] = a->val[q - 1];
+            }
+            a->col[q] = c;
+            a->val[q] = val;
+        }
+    }
+    free(ri); free(ci); free(v);
+    return a;
 }
 
-/* 行列の入力 */
-void input_matrix(double **a, char c, FILE *fin, FILE *fout) {
-    int i, j;
+/* 行列の入力
+   先頭行が %%MatrixMarket なら Matrix Market 形式, そうでなければ密行列 (1行に1行分) として読み,
+   非零だけを CSR に詰める. 密行列の大きさ n は1行目の値の数で決める */
+CsrMatrix *input_matrix(char c, FILE *fin, FILE *fout) {
+    char *line = NULL, *s, *end;
+    size_t len = 0;
+    int i, j, n = 0;
+    int64_t nnz = 0, cap;
+    double v;
+    CsrMatrix *a;
+
     fprintf(fout, "行列%cを入力します\n", c);
-    for (i = 1; i <= N; i++) {
-        for (j = 1; j <= N; j++) {
-            if (fscanf(fin, "%lf", &a[i][j]) != 1) {
+    if (getline(&line, &len, fin) < 0) {
+        fprintf(stderr, "行列の読み込みエラーです。\n");
+        exit(1);
+    }
+    if (strncmp(line, "%%MatrixMarket", 14) == 0) {
+        a = read_matrix_market(fin, line);
+        free(line);
+        csr_partition(a);
+        fprintf(fout, "行列%cの入力が完了しました\n", c);
+        return a;
+    }
+
+    for (s = line; strtod(s, &end), end != s; s = end) {
+        n++;
+    }
+    free(line);
+    if (n == 0) {
+        fprintf(stderr, "行列の読み込みエラーです。\n");
+        exit(1);
+    }
+    rewind(fin);
+    cap = 4 * (int64_t)n;
+    a = csr_alloc(n, cap);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            if (fscanf(fin, "%lf", &v) != 1) {
                 fprintf(stderr, "行列の読み込みエラーです。\n");
                 exit(1);
             }
+            if (v == 0.0) continue;
+            if (nnz == cap) {
+                cap *= 2;
+                if ((a->col = (int *)realloc(a->col, sizeof(int) * cap)) == NULL
+                    || (a->val = (double *)realloc(a->val, sizeof(double) * cap)) == NULL) {
+                    fprintf(stderr, "input_matrix: メモリ確保に失敗しました。\n");
+                    exit(1);
+                }
+            }
+            a->col[nnz] = j;
+            a->val[nnz++] = v;
         }
+        a->ptr[i + 1] = nnz;
     }
+    a->nnz = nnz;
+    csr_partition(a);
     fprintf(fout, "行列%cの入力が完了しました\n", c);
+    return a;
 }
 
-/* ベクトルの入力 */
-void input_vector(double *b, char c, FILE *fin, FILE *fout) {
-    int i;
+/* ベクトルの入力
+   Matrix Market の配列形式 (array) ならコメントとサイズの行を読み飛ばす */
+void input_vector(double *b, int n, char c, FILE *fin, FILE *fout) {
+    char line[1024];
+    long long rows, cols;
+    int i, ch;
+
     fprintf(fout, "ベクトル%cを入力します\n", c);
-    for (i = 1; i <= N; i++) {
+    if ((ch = fgetc(fin)) != EOF) ungetc(ch, fin);
+    if (ch == '%') {
+        do {
+            if (fgets(line, sizeof(line), fin) == NULL) {
+                fprintf(stderr, "ベクトルの読み込みエラーです。\n");
+                exit(1);
+            }
+        } while (line[0] == '%');
+        if (sscanf(line, "%lld %lld", &rows, &cols) != 2 || rows != n) {
+            fprintf(stderr, "ベクトルの大きさが行列と合いません。\n");
+            exit(1);
+        }
+    }
+    for (i = 1; i <= n; i++) {
         if (fscanf(fin, "%lf", &b[i]) != 1) {
             fprintf(stderr, "ベクトルの読み込みエラーです。\n");
             exit(1);
@@ -256,6 +1959,7 @@ void input_vector(double *b, char c, FILE *fin, FILE *fout) {
 double vector_norm1(double *a, int m, int n) {
     double norm = 0.0;
     int i;
+    #pragma omp parallel for reduction(+:norm) schedule(static) if(n - m >= 10000)
     for (i = m; i <= n; i++) {
         norm += fabs(a[i]);
     }
@@ -266,8 +1970,16 @@ double vector_norm1(double *a, int m, int n) {
 double inner_product(int m, int n, double *a, double *b) {
     double product = 0.0;
     int i;
+    #pragma omp parallel for reduction(+:product) schedule(static) if(n - m >= 10000)
     for (i = m; i <= n; i++) {
         product += a[i] * b[i];
     }
     return product;
-}
\ No newline at end of file
+}
+
+double elapsed(struct timespec *t0) {
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// 行列ベクトル積 y = A x のカーネル (A は行優先, 行の間隔 lda)
+// 4行ずつ同時に処理し, 各行に2本ずつアキュムレータを持たせて FMA の遅延を隠す.
+// SSE2 / AVX2 / AVX-512 版を用意し, 起動時に cpuid で使えるものを選ぶ
+typedef void (*gemv_fn)(int m, int n, const double *a, size_t lda, const double *x, double *y);
+
+void gemv_scalar(int m, int n, const double *a, size_t lda, const double *x, double *y)
+{
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    double s0, s1, s2, s3;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < n; j++) {
+            s0 += a0[j] * x[j];
+            s1 += a1[j] * x[j];
+            s2 += a2[j] * x[j];
+            s3 += a3[j] * x[j];
+        }
+        y[i] = s0;
+        y[i + 1] = s1;
+        y[i + 2] = s2;
+        y[i + 3] = s3;
+    }
+    for (; i < m; i++) {
+        a0 = a + (size_t)i * lda;
+        s0 = s1 = 0.0;
+        for (j = 0; j + 2 <= n; j += 2) {
+            s0 += a0[j] * x[j];
+            s1 += a0[j + 1] * x[j + 1];
+        }
+        if (j < n) s0 += a0[j] * x[j];
+        y[i] = s0 + s1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline double hsum_sse2(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+void gemv_sse2(int m, int n, const double *a, size_t lda, const double *x, double *y)
+{
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m128d xv0, xv1, s0a, s0b, s1a, s1b, s2a, s2b, s3a, s3b;
+    double t0, t1, t2, t3;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0a = s0b = s1a = s1b = s2a = s2b = s3a = s3b = _mm_setzero_pd();
+        for (j = 0; j + 4 <= n; j += 4) {
+            xv0 = _mm_loadu_pd(x + j);
+            xv1 = _mm_loadu_pd(x + j + 2);
+            s0a = _mm_add_pd(s0a, _mm_mul_pd(_mm_loadu_pd(a0 + j), xv0));
+            s0b = _mm_add_pd(s0b, _mm_mul_pd(_mm_loadu_pd(a0 + j + 2), xv1));
+            s1a = _mm_add_pd(s1a, _mm_mul_pd(_mm_loadu_pd(a1 + j), xv0));
+            s1b = _mm_add_pd(s1b, _mm_mul_pd(_mm_loadu_pd(a1 + j + 2), xv1));
+            s2a = _mm_add_pd(s2a, _mm_mul_pd(_mm_loadu_pd(a2 + j), xv0));
+            s2b = _mm_add_pd(s2b, _mm_mul_pd(_mm_loadu_pd(a2 + j + 2), xv1));
+            s3a = _mm_add_pd(s3a, _mm_mul_pd(_mm_loadu_pd(a3 + j), xv0));
+            s3b = _mm_add_pd(s3b, _mm_mul_pd(_mm_loadu_pd(a3 + j + 2), xv1));
+        }
+        t0 = hsum_sse2(_mm_add_pd(s0a, s0b));
+        t1 = hsum_sse2(_mm_add_pd(s1a, s1b));
+        t2 = hsum_sse2(_mm_add_pd(s2a, s2b));
+        t3 = hsum_sse2(_mm_add_pd(s3a, s3b));
+        for (; j < n; j++) {
+            t0 += a0[j] * x[j];
+            t1 += a1[j] * x[j];
+            t2 += a2[j] * x[j];
+            t3 += a3[j] * x[j];
+        }
+        y[i] = t0;
+        y[i + 1] = t1;
+        y[i + 2] = t2;
+        y[i + 3] = t3;
+    }
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+
+__attribute__((target("avx2,fma")))
+void gemv_avx2(int m, int n, const double *a, size_t lda, const double *x, double *y)
+{
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m256d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3, h0, h1;
+    double t[4];
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm256_setzero_pd();
+        for (j = 0; j + 8 <= n; j += 8) {
+            xv0 = _mm256_loadu_pd(x + j);
+            xv1 = _mm256_loadu_pd(x + j + 4);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j + 4), xv1, u0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j + 4), xv1, u1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j + 4), xv1, u2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j + 4), xv1, u3);
+        }
+        if (j + 4 <= n) {
+            xv0 = _mm256_loadu_pd(x + j);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            j += 4;
+        }
+        // 4行分の水平和を1本のベクトルにまとめる
+        h0 = _mm256_hadd_pd(_mm256_add_pd(s0, u0), _mm256_add_pd(s1, u1));
+        h1 = _mm256_hadd_pd(_mm256_add_pd(s2, u2), _mm256_add_pd(s3, u3));
+        _mm256_storeu_pd(t, _mm256_add_pd(_mm256_permute2f128_pd(h0, h1, 0x20),
+                                          _mm256_permute2f128_pd(h0, h1, 0x31)));
+        for (; j < n; j++) {
+            t[0] += a0[j] * x[j];
+            t[1] += a1[j] * x[j];
+            t[2] += a2[j] * x[j];
+            t[3] += a3[j] * x[j];
+        }
+        y[i] = t[0];
+        y[i + 1] = t[1];
+        y[i + 2] = t[2];
+        y[i + 3] = t[3];
+    }
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+
+__attribute__((target("avx512f")))
+void gemv_avx512(int m, int n, const double *a, size_t lda, const double *x, double *y)
+{
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m512d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3;
+    __mmask8 k;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm512_setzero_pd();
+        for (j = 0; j + 16 <= n; j += 16) {
+            xv0 = _mm512_loadu_pd(x + j);
+            xv1 = _mm512_loadu_pd(x + j + 8);
+            s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j + 8), xv1, u0);
+            s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j + 8), xv1, u1);
+            s2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j + 8), xv1, u2);
+            s3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j + 8), xv1, u3);
+        }
+        // 端数はマスク付きロードで処理する (範囲外は 0 として読む)
+        for (; j < n; j += 8) {
+            k = (n - j >= 8) ? 0xFF : (__mmask8)((1u << (n - j)) - 1);
+            xv0 = _mm512_maskz_loadu_pd(k, x + j);
+            s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a0 + j), xv0, s0);
+            s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a1 + j), xv0, s1);
+            s2 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a2 + j), xv0, s2);
+            s3 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a3 + j), xv0, s3);
+        }
+        y[i] = _mm512_reduce_add_pd(_mm512_add_pd(s0, u0));
+        y[i + 1] = _mm512_reduce_add_pd(_mm512_add_pd(s1, u1));
+        y[i + 2] = _mm512_reduce_add_pd(_mm512_add_pd(s2, u2));
+        y[i + 3] = _mm512_reduce_add_pd(_mm512_add_pd(s3, u3));
+    }
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+#endif
+
+// 環境変数 GEMV_ISA (scalar, sse2, avx2, avx512) で明示的に選ぶこともできる
+gemv_fn gemv_select(const char **name)
+{
+    const char *isa = getenv("GEMV_ISA");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa == NULL || strcmp(isa, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        *name = "avx512";
+        return gemv_avx512;
+    }
+    if ((isa == NULL || strcmp(isa, "avx2") == 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return gemv_avx2;
+    }
+    if ((isa == NULL || strcmp(isa, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return gemv_sse2;
+    }
+#endif
+    (void)isa;
+    *name = "scalar";
+    return gemv_scalar;
+}
+
+// 行を64行ずつのブロックに分けて, スレッド並列に fn を呼ぶ
+void gemv_blocked(gemv_fn fn, int m, int n, const double *a, size_t lda, const double *x, double *y)
+{
+    int ib, blk = 64;
+
+    if ((double)m * n < 1e5) {
+        fn(m, n, a, lda, x, y);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (ib = 0; ib < m; ib += blk) {
+        fn((m - ib < blk) ? m - ib : blk, n, a + (size_t)ib * lda, lda, x, y + ib);
+    }
+}
+
+double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double *aligned_vector(size_t n)
+{
+    double *p;
+    if (posix_memalign((void **)&p, 64, n * sizeof(double)) != 0) {
+        printf("No memories are available (%zu doubles)\n", n);
+        exit(1);
+    }
+    return p;
+}
+
+// STREAM の triad (a = b + s c) と同じ方法で, このマシンのメモリ帯域 [GB/s] を測る
+double stream_triad(size_t len, int reps)
+{
+    double *a = aligned_vector(len), *b = aligned_vector(len), *c = aligned_vector(len);
+    double t, best = 1e30, s = 3.0;
+    long i, n = (long)len;
+    int r;
+
+    #pragma omp parallel for schedule(static)
+    for (i = 0; i < n; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    for (r = 0; r < reps; r++) {
+        t = wall_time();
+        #pragma omp parallel for schedule(static)
+        for (i = 0; i < n; i++) {
+            a[i] = b[i] + s * c[i];
+        }
+        t = wall_time() - t;
+        if (t < best) best = t;
+    }
+    if (a[n / 2] != 7.0) printf("STREAM check failed\n");
+    free(a);
+    free(b);
+    free(c);
+    return 3.0 * sizeof(double) * len / best * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    int m = 4096, n = 4096, reps = 10, opt, r, k, i;
+    size_t stream_len = (size_t)1 << 24, lda;
+    double *a, *x, *y, *y_ref, t, best, err, bw, gbs;
+    const char *name;
+    struct { const char *name; gemv_fn fn; int ok; } kernels[4];
+    int nk = 0;
+
+    while ((opt = getopt(argc, argv, "m:n:r:s:")) != -1) {
+        switch (opt) {
+            case 'm': m = atoi(optarg); break;
+            case 'n': n = atoi(optarg); break;
+            case 'r': reps = atoi(optarg); break;
+            case 's': stream_len = (size_t)atol(optarg); break;
+            default:
+                printf("Usage: %s [-m rows] [-n cols] [-r repeats] [-s stream_length]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    kernels[nk].name = "scalar"; kernels[nk].fn = gemv_scalar; kernels[nk++].ok = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    kernels[nk].name = "sse2"; kernels[nk].fn = gemv_sse2;
+    kernels[nk++].ok = __builtin_cpu_supports("sse2");
+    kernels[nk].name = "avx2"; kernels[nk].fn = gemv_avx2;
+    kernels[nk++].ok = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    kernels[nk].name = "avx512"; kernels[nk].fn = gemv_avx512;
+    kernels[nk++].ok = __builtin_cpu_supports("avx512f");
+#endif
+    gemv_select(&name);
+
+#ifdef _OPENMP
+    printf("Threads: %d\n", omp_get_max_threads());
+#endif
+    bw = stream_triad(stream_len, reps);
+    printf("STREAM triad: %8.2f GB/s (%zu doubles x 3)\n", bw, stream_len);
+
+    // 行の長さは 64 バイトの倍数に切り上げ, どの行の先頭も境界に揃った状態で測る
+    lda = ((size_t)n + 7) & ~(size_t)7;
+    a = aligned_vector((size_t)m * lda);
+    x = aligned_vector(n);
+    y = aligned_vector(m);
+    y_ref = aligned_vector(m);
+    #pragma omp parallel for private(k) schedule(static)
+    for (i = 0; i < m; i++) {
+        for (k = 0; k < (int)lda; k++) {
+            a[(size_t)i * lda + k] = (k < n) ? 1.0 / (1.0 + i + k) : 0.0;
+        }
+    }
+    for (k = 0; k < n; k++) x[k] = 1.0 + (k % 7);
+    gemv_scalar(m, n, a, lda, x, y_ref);
+
+    printf("GEMV %d x %d (default kernel: %s)\n", m, n, name);
+    printf("%-8s %10s %10s %8s %12s\n", "kernel", "time[ms]", "GB/s", "STREAM", "max rel.err");
+    for (k = 0; k < nk; k++) {
+        if (!kernels[k].ok) {
+            printf("%-8s (not supported on this CPU)\n", kernels[k].name);
+            continue;
+        }
+        best = 1e30;
+        for (r = 0; r < reps; r++) {
+            t = wall_time();
+            gemv_blocked(kernels[k].fn, m, n, a, lda, x, y);
+            t = wall_time() - t;
+            if (t < best) best = t;
+        }
+        err = 0.0;
+        for (i = 0; i < m; i++) {
+            double e = (y[i] - y_ref[i]) / y_ref[i];
+            if (e < 0) e = -e;
+            if (e > err) err = e;
+        }
+        // 行列を1回, x と y を1回ずつ読み書きする量
+        gbs = sizeof(double) * ((double)m * n + n + m) / best * 1e-9;
+        printf("%-8s %10.3f %10.2f %7.1f%% %12.2e\n", kernels[k].name, best * 1e3, gbs, 100.0 * gbs / bw, err);
+    }
+
+    free(a);
+    free(x);
+    free(y);
+    free(y_ref);
+    return 0;
+}
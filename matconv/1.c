@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// バイナリ行列ファイル (CRMAT) のヘッダ: 64バイト固定, その後ろに double の列が続く
+#define CRMAT_MAGIC "CRMAT01"
+
+enum {
+    CRMAT_DENSE  = 0,   // rows x cols の行優先
+    CRMAT_UPPER  = 1,   // 対称行列の上三角, 行 i は対角から n-i 個
+    CRMAT_BAND   = 2,   // 対称バンド行列, 行 i は対角から bandwidth 個 (範囲外は 0)
+    CRMAT_VECTOR = 3    // rows x cols の列優先 (右辺ベクトルを cols 本)
+};
+
+typedef struct {
+    char magic[8];        // "CRMAT01"
+    int32_t kind;         // 格納形式 (CRMAT_*)
+    int32_t symmetric;    // 1: 対称行列
+    int64_t rows;         // 行数
+    int64_t cols;         // 列数
+    int64_t bandwidth;    // 上側バンド幅 (対角を含む)
+    int64_t data_offset;  // データの開始位置 (64バイト境界)
+    int64_t reserved[2];
+} CrmatHeader;
+
+// テキストファイルを丸ごと読み込み, 数値と行列の形を1パスで求める
+double *read_text(char *filename, int64_t *rows, int64_t *cols)
+{
+    FILE *fp;
+    char *buf, *p, *end;
+    long len;
+    int64_t n = 0, cap = 1024, in_row = 0;
+    double *val, v;
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        printf("Input file open error: %s\n", filename);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((buf = (char *)malloc(len + 1)) == NULL || (val = (double *)malloc(cap * sizeof(double))) == NULL) {
+        printf("No memories are available (text)\n");
+        exit(1);
+    }
+    if (fread(buf, 1, len, fp) != (size_t)len) {
+        printf("Input file read error: %s\n", filename);
+        exit(1);
+    }
+    buf[len] = '\0';
+    fclose(fp);
+
+    *rows = 0;
+    *cols = 0;
+    p = buf;
+    while (*p != '\0') {
+        if (*p == '\n') {
+            // 空行は数えない (count_matrix_size と同じ扱い)
+            if (in_row > 0) {
+                if (*cols == 0) *cols = in_row;
+                if (in_row != *cols) {
+                    printf("Row %lld has %lld values (expected %lld)\n", (long long)*rows, (long long)in_row, (long long)*cols);
+                    exit(1);
+                }
+                (*rows)++;
+            }
+            in_row = 0;
+            p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+        v = strtod(p, &end);
+        if (end == p) {
+            printf("Invalid number in %s at byte %ld\n", filename, (long)(p - buf));
+            exit(1);
+        }
+        if (n == cap) {
+            cap *= 2;
+            if ((val = (double *)realloc(val, cap * sizeof(double))) == NULL) {
+                printf("No memories are available (text)\n");
+                exit(1);
+            }
+        }
+        val[n++] = v;
+        in_row++;
+        p = end;
+    }
+    // 最終行が改行で終わっていない場合
+    if (in_row > 0) {
+        if (*cols == 0) *cols = in_row;
+        if (in_row != *cols) {
+            printf("Row %lld has %lld values (expected %lld)\n", (long long)*rows, (long long)in_row, (long long)*cols);
+            exit(1);
+        }
+        (*rows)++;
+    }
+
+    free(buf);
+    return val;
+}
+
+// 対称性と上側バンド幅 (5_kadai の get_bandwidth と同じ定義) を求める
+void analyze(double *a, int64_t rows, int64_t cols, int32_t *symmetric, int64_t *bandwidth)
+{
+    int64_t i, j;
+
+    *symmetric = (rows == cols);
+    *bandwidth = 0;
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            if (j >= i && a[i * cols + j] != 0.0 && j - i + 1 > *bandwidth) {
+                *bandwidth = j - i + 1;
+            }
+            if (*symmetric && j < i && a[i * cols + j] != a[j * cols + i]) {
+                *symmetric = 0;
+            }
+        }
+    }
+    if (*bandwidth == 0) *bandwidth = 1;
+}
+
+void write_values(FILE *fp, double *v, int64_t count)
+{
+    if (count > 0 && fwrite(v, sizeof(double), count, fp) != (size_t)count) {
+        printf("Output file write error\n");
+        exit(1);
+    }
+}
+
+void write_crmat(char *filename, CrmatHeader *h, double *a)
+{
+    FILE *fp;
+    int64_t i, j, n = h->rows, w;
+    double *row;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        printf("Output file open error: %s\n", filename);
+        exit(1);
+    }
+    if (fwrite(h, sizeof(CrmatHeader), 1, fp) != 1) {
+        printf("Output file write error\n");
+        exit(1);
+    }
+
+    switch (h->kind) {
+    case CRMAT_DENSE:
+        write_values(fp, a, h->rows * h->cols);
+        break;
+    case CRMAT_UPPER:
+        for (i = 0; i < n; i++) {
+            write_values(fp, &a[i * n + i], n - i);
+        }
+        break;
+    case CRMAT_BAND:
+        if ((row = (double *)calloc(h->bandwidth, sizeof(double))) == NULL) {
+            printf("No memories are available (row)\n");
+            exit(1);
+        }
+        for (i = 0; i < n; i++) {
+            w = (n - i < h->bandwidth) ? n - i : h->bandwidth;
+            memcpy(row, &a[i * n + i], w * sizeof(double));
+            memset(row + w, 0, (h->bandwidth - w) * sizeof(double));
+            write_values(fp, row, h->bandwidth);
+        }
+        free(row);
+        break;
+    case CRMAT_VECTOR:
+        // テキストは1行が1つの i に対応するので, 列優先に並べ替える
+        for (j = 0; j < h->cols; j++) {
+            for (i = 0; i < h->rows; i++) {
+                write_values(fp, &a[i * h->cols + j], 1);
+            }
+        }
+        break;
+    }
+    fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    CrmatHeader h;
+    double *a;
+    char *kind = "dense";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        switch (opt) {
+            case 'k':
+                kind = optarg;
+                break;
+            default:
+                printf("Usage: %s [-k dense|upper|band|vector] text_file binary_file\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        printf("Usage: %s [-k dense|upper|band|vector] text_file binary_file\n", argv[0]);
+        exit(1);
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CRMAT_MAGIC, sizeof(h.magic));
+    h.data_offset = sizeof(CrmatHeader);
+
+    a = read_text(argv[optind], &h.rows, &h.cols);
+
+    if (strcmp(kind, "dense") == 0) {
+        h.kind = CRMAT_DENSE;
+    } else if (strcmp(kind, "upper") == 0) {
+        h.kind = CRMAT_UPPER;
+    } else if (strcmp(kind, "band") == 0) {
+        h.kind = CRMAT_BAND;
+    } else if (strcmp(kind, "vector") == 0) {
+        h.kind = CRMAT_VECTOR;
+    } else {
+        printf("Unknown storage kind: %s\n", kind);
+        exit(1);
+    }
+
+    if (h.kind == CRMAT_VECTOR) {
+        h.bandwidth = 0;
+        h.symmetric = 0;
+    } else {
+        analyze(a, h.rows, h.cols, &h.symmetric, &h.bandwidth);
+        if ((h.kind == CRMAT_UPPER || h.kind == CRMAT_BAND) && !h.symmetric) {
+            printf("Matrix is not symmetric; use -k dense\n");
+            exit(1);
+        }
+    }
+
+    write_crmat(argv[optind + 1], &h, a);
+    printf("%s -> %s: %lld x %lld, kind=%s, symmetric=%d, bandwidth=%lld\n",
+           argv[optind], argv[optind + 1], (long long)h.rows, (long long)h.cols,
+           kind, h.symmetric, (long long)h.bandwidth);
+
+    free(a);
+    return 0;
+}
@@ -3,52 +3,490 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// ファイルから行列の次元（行数と列数）を取得する関数
-void get_matrix_dimensions(const char* filename, int* rows, int* cols) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "エラー: ファイルを開けません %s\n", filename);
-        MPI_Abort(MPI_COMM_WORLD, 1);
+// テキスト行列の並列パーサ
+// ファイルを改行位置で区切ったチャンクに分け, 各スレッドが1回の走査で数値・行数・列数を求める
+typedef struct {
+    double *val;     // 値 (行優先, rows x cols)
+    int rows;        // 空でない行の数
+    int cols;        // 1行あたりの値の数
+} TextMatrix;
+
+typedef struct {
+    const char *begin, *end;
+    const char *bad;   // 数値として読めなかった位置
+    double *val;
+    size_t count, cap;
+    int lines;
+    int first_cols;    // チャンク内の最初の行の値の数
+    int ragged;        // 値の数が違う行があった
+} TextChunk;
+
+static const double pow10_table[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// from_chars 相当の double 変換: 仮数が 2^53 以下かつ指数が ±22 以内なら正確に計算し,
+// それ以外 (桁数が多い, inf/nan など) は strtod に任せる. 読めなければ NULL を返す
+const char *parse_double(const char *p, const char *end, double *out) {
+    const char *s = p, *q;
+    uint64_t m = 0;
+    int neg = 0, nd = 0, exp10 = 0, ex = 0, eneg = 0, digits = 0, exact = 1;
+    char buf[128];
+    char *e;
+    size_t len;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (nd < 19) {
+            m = m * 10 + (*p - '0');
+            if (m != 0) nd++;
+        } else {
+            exp10++;
+            exact = 0;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (nd < 19) {
+                m = m * 10 + (*p - '0');
+                if (m != 0) nd++;
+                exp10--;
+            } else {
+                exact = 0;
+            }
+        }
+    }
+    if (digits > 0 && p < end && (*p == 'e' || *p == 'E')) {
+        q = p + 1;
+        if (q < end && (*q == '-' || *q == '+')) {
+            eneg = (*q == '-');
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            for (p = q; p < end && *p >= '0' && *p <= '9'; p++) {
+                if (ex < 100000) ex = ex * 10 + (*p - '0');
+            }
+            exp10 += eneg ? -ex : ex;
+        }
     }
 
-    *rows = 0;
-    *cols = 0;
-    char line[1024]; 
-    int cols_in_row = 0;
-    char* token;
+    if (digits > 0 && exact && m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22
+        && (p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        *out = (exp10 < 0) ? (double)m / pow10_table[-exp10] : (double)m * pow10_table[exp10];
+        if (neg) *out = -*out;
+        return p;
+    }
 
-    if (fgets(line, sizeof(line), file) != NULL) {
-        (*rows)++;
-        token = strtok(line, " \t\n");
-        while(token != NULL) {
-            if(strlen(token) > 0) (*cols)++;
-            token = strtok(NULL, " \t\n");
+    // 低速経路: 空白までを切り出して strtod で変換する
+    for (q = s; q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n'; q++)
+        ;
+    len = (size_t)(q - s) < sizeof(buf) - 1 ? (size_t)(q - s) : sizeof(buf) - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *out = strtod(buf, &e);
+    if (e != buf + len) return NULL;
+    return q;
+}
+
+void parse_chunk(TextChunk *c) {
+    const char *p = c->begin, *q;
+    int in_row = 0;
+
+    c->first_cols = -1;
+    c->cap = (size_t)(c->end - c->begin) / 8 + 16;
+    if ((c->val = (double *)malloc(c->cap * sizeof(double))) == NULL) {
+        c->bad = p;
+        return;
+    }
+
+    for (;;) {
+        if (p == c->end || *p == '\n') {
+            // 空行は数えない (count_matrix_size と同じ扱い)
+            if (in_row > 0) {
+                if (c->first_cols < 0) c->first_cols = in_row;
+                else if (in_row != c->first_cols) c->ragged = 1;
+                c->lines++;
+            }
+            if (p == c->end) break;
+            in_row = 0;
+            p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+        if (c->count == c->cap) {
+            c->cap *= 2;
+            if ((c->val = (double *)realloc(c->val, c->cap * sizeof(double))) == NULL) {
+                c->bad = p;
+                return;
+            }
+        }
+        if ((q = parse_double(p, c->end, &c->val[c->count])) == NULL) {
+            c->bad = p;
+            return;
         }
+        c->count++;
+        in_row++;
+        p = q;
     }
+}
+
+// メモリ上のテキスト base[0...len-1] を改行位置で区切ったチャンクに分けて並列に解析し, 値と行数・列数を求める
+// (行がなければ rows = 0, cols = -1). エラーの位置は base_offset を足したファイルの中の位置で表示する
+void text_parse_buffer(const char *base, size_t len, const char *filename, long base_offset, TextMatrix *t) {
+    int nchunk, k;
+    const char *p;
+    size_t total, *offset;
+    TextChunk *chunk;
 
-    while (fgets(line, sizeof(line), file) != NULL) {
-        if(strlen(line) > 1) (*rows)++;
+    // スレッド数の4倍に分割 (1チャンク 1MB 以上)
+#ifdef _OPENMP
+    nchunk = omp_get_max_threads() * 4;
+#else
+    nchunk = 1;
+#endif
+    if ((size_t)nchunk > len / (1 << 20)) nchunk = (int)(len / (1 << 20));
+    if (nchunk < 1) nchunk = 1;
+
+    chunk = (TextChunk *)calloc(nchunk, sizeof(TextChunk));
+    offset = (size_t *)malloc((nchunk + 1) * sizeof(size_t));
+    if (chunk == NULL || offset == NULL) {
+        fprintf(stderr, "エラー: メモリを確保できません。\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // 区切りは必ず改行の直後に置く
+    p = base;
+    for (k = 0; k < nchunk; k++) {
+        chunk[k].begin = p;
+        if (k == nchunk - 1) {
+            p = base + len;
+        } else {
+            if (p < base + len * (k + 1) / nchunk) p = base + len * (k + 1) / nchunk;
+            while (p < base + len && *p != '\n') p++;
+            if (p < base + len) p++;
+        }
+        chunk[k].end = p;
     }
 
-    fclose(file);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < nchunk; k++) {
+        parse_chunk(&chunk[k]);
+    }
+
+    t->rows = 0;
+    t->cols = -1;
+    total = 0;
+    for (k = 0; k < nchunk; k++) {
+        if (chunk[k].bad != NULL) {
+            fprintf(stderr, "エラー: %s の %ld バイト目を数値として読めません。\n", filename, base_offset + (long)(chunk[k].bad - base));
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (chunk[k].first_cols >= 0) {
+            if (t->cols < 0) t->cols = chunk[k].first_cols;
+            if (chunk[k].ragged || chunk[k].first_cols != t->cols) {
+                fprintf(stderr, "エラー: %s の行ごとの要素数が揃っていません。\n", filename);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+        offset[k] = total;
+        total += chunk[k].count;
+        t->rows += chunk[k].lines;
+    }
+
+    if ((t->val = (double *)malloc(total * sizeof(double) + 1)) == NULL) {
+        fprintf(stderr, "エラー: メモリを確保できません。\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < nchunk; k++) {
+        memcpy(t->val + offset[k], chunk[k].val, chunk[k].count * sizeof(double));
+        free(chunk[k].val);
+    }
+    free(chunk);
+    free(offset);
 }
 
-// ファイルからベクトルのサイズ（要素数）を取得する関数
-void get_vector_size(const char* filename, int* size) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
+// ファイルを1回だけ読み, 値とサイズをまとめて求める
+void text_parse(char *filename, TextMatrix *t) {
+    int fd;
+    struct stat st;
+    char *base;
+    size_t len;
+
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
         fprintf(stderr, "エラー: ファイルを開けません %s\n", filename);
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    *size = 0;
-    double temp;
-    while (fscanf(file, "%lf", &temp) == 1) {
-        (*size)++;
+    len = st.st_size;
+    if (len == 0) {
+        fprintf(stderr, "エラー: ファイルが空です %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "エラー: mmap に失敗しました %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    madvise(base, len, MADV_WILLNEED);
+
+    text_parse_buffer(base, len, filename, 0, t);
+    munmap(base, len);
+    if (t->rows == 0) {
+        fprintf(stderr, "エラー: %s にデータがありません。\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+
+// 行列ベクトル積 y = A x のカーネル (A は行優先, 行の間隔 lda)
+// 4行ずつ同時に処理し, 各行に2本ずつアキュムレータを持たせて FMA の遅延を隠す.
+// SSE2 / AVX2 / AVX-512 版を用意し, 起動時に cpuid で使えるものを選ぶ
+typedef void (*gemv_fn)(int m, int n, const double *a, size_t lda, const double *x, double *y);
+
+void gemv_scalar(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    double s0, s1, s2, s3;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = 0.0;
+        for (j = 0; j < n; j++) {
+            s0 += a0[j] * x[j];
+            s1 += a1[j] * x[j];
+            s2 += a2[j] * x[j];
+            s3 += a3[j] * x[j];
+        }
+        y[i] = s0;
+        y[i + 1] = s1;
+        y[i + 2] = s2;
+        y[i + 3] = s3;
+    }
+    for (; i < m; i++) {
+        a0 = a + (size_t)i * lda;
+        s0 = s1 = 0.0;
+        for (j = 0; j + 2 <= n; j += 2) {
+            s0 += a0[j] * x[j];
+            s1 += a0[j + 1] * x[j + 1];
+        }
+        if (j < n) s0 += a0[j] * x[j];
+        y[i] = s0 + s1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline double hsum_sse2(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+void gemv_sse2(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m128d xv0, xv1, s0a, s0b, s1a, s1b, s2a, s2b, s3a, s3b;
+    double t0, t1, t2, t3;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0a = s0b = s1a = s1b = s2a = s2b = s3a = s3b = _mm_setzero_pd();
+        for (j = 0; j + 4 <= n; j += 4) {
+            xv0 = _mm_loadu_pd(x + j);
+            xv1 = _mm_loadu_pd(x + j + 2);
+            s0a = _mm_add_pd(s0a, _mm_mul_pd(_mm_loadu_pd(a0 + j), xv0));
+            s0b = _mm_add_pd(s0b, _mm_mul_pd(_mm_loadu_pd(a0 + j + 2), xv1));
+            s1a = _mm_add_pd(s1a, _mm_mul_pd(_mm_loadu_pd(a1 + j), xv0));
+            s1b = _mm_add_pd(s1b, _mm_mul_pd(_mm_loadu_pd(a1 + j + 2), xv1));
+            s2a = _mm_add_pd(s2a, _mm_mul_pd(_mm_loadu_pd(a2 + j), xv0));
+            s2b = _mm_add_pd(s2b, _mm_mul_pd(_mm_loadu_pd(a2 + j + 2), xv1));
+            s3a = _mm_add_pd(s3a, _mm_mul_pd(_mm_loadu_pd(a3 + j), xv0));
+            s3b = _mm_add_pd(s3b, _mm_mul_pd(_mm_loadu_pd(a3 + j + 2), xv1));
+        }
+        t0 = hsum_sse2(_mm_add_pd(s0a, s0b));
+        t1 = hsum_sse2(_mm_add_pd(s1a, s1b));
+        t2 = hsum_sse2(_mm_add_pd(s2a, s2b));
+        t3 = hsum_sse2(_mm_add_pd(s3a, s3b));
+        for (; j < n; j++) {
+            t0 += a0[j] * x[j];
+            t1 += a1[j] * x[j];
+            t2 += a2[j] * x[j];
+            t3 += a3[j] * x[j];
+        }
+        y[i] = t0;
+        y[i + 1] = t1;
+        y[i + 2] = t2;
+        y[i + 3] = t3;
+    }
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+
+__attribute__((target("avx2,fma")))
+void gemv_avx2(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m256d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3, h0, h1;
+    double t[4];
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm256_setzero_pd();
+        for (j = 0; j + 8 <= n; j += 8) {
+            xv0 = _mm256_loadu_pd(x + j);
+            xv1 = _mm256_loadu_pd(x + j + 4);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j + 4), xv1, u0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j + 4), xv1, u1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j + 4), xv1, u2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j + 4), xv1, u3);
+        }
+        if (j + 4 <= n) {
+            xv0 = _mm256_loadu_pd(x + j);
+            s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a0 + j), xv0, s0);
+            s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a1 + j), xv0, s1);
+            s2 = _mm256_fmadd_pd(_mm256_loadu_pd(a2 + j), xv0, s2);
+            s3 = _mm256_fmadd_pd(_mm256_loadu_pd(a3 + j), xv0, s3);
+            j += 4;
+        }
+        // 4行分の水平和を1本のベクトルにまとめる
+        h0 = _mm256_hadd_pd(_mm256_add_pd(s0, u0), _mm256_add_pd(s1, u1));
+        h1 = _mm256_hadd_pd(_mm256_add_pd(s2, u2), _mm256_add_pd(s3, u3));
+        _mm256_storeu_pd(t, _mm256_add_pd(_mm256_permute2f128_pd(h0, h1, 0x20),
+                                          _mm256_permute2f128_pd(h0, h1, 0x31)));
+        for (; j < n; j++) {
+            t[0] += a0[j] * x[j];
+            t[1] += a1[j] * x[j];
+            t[2] += a2[j] * x[j];
+            t[3] += a3[j] * x[j];
+        }
+        y[i] = t[0];
+        y[i + 1] = t[1];
+        y[i + 2] = t[2];
+        y[i + 3] = t[3];
+    }
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
+}
+
+__attribute__((target("avx512f")))
+void gemv_avx512(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int i, j;
+    const double *a0, *a1, *a2, *a3;
+    __m512d xv0, xv1, s0, s1, s2, s3, u0, u1, u2, u3;
+    __mmask8 k;
+
+    for (i = 0; i + 4 <= m; i += 4) {
+        a0 = a + (size_t)i * lda;
+        a1 = a0 + lda;
+        a2 = a1 + lda;
+        a3 = a2 + lda;
+        s0 = s1 = s2 = s3 = u0 = u1 = u2 = u3 = _mm512_setzero_pd();
+        for (j = 0; j + 16 <= n; j += 16) {
+            xv0 = _mm512_loadu_pd(x + j);
+            xv1 = _mm512_loadu_pd(x + j + 8);
+            s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j), xv0, s0);
+            u0 = _mm512_fmadd_pd(_mm512_loadu_pd(a0 + j + 8), xv1, u0);
+            s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j), xv0, s1);
+            u1 = _mm512_fmadd_pd(_mm512_loadu_pd(a1 + j + 8), xv1, u1);
+            s2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j), xv0, s2);
+            u2 = _mm512_fmadd_pd(_mm512_loadu_pd(a2 + j + 8), xv1, u2);
+            s3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j), xv0, s3);
+            u3 = _mm512_fmadd_pd(_mm512_loadu_pd(a3 + j + 8), xv1, u3);
+        }
+        // 端数はマスク付きロードで処理する (範囲外は 0 として読む)
+        for (; j < n; j += 8) {
+            k = (n - j >= 8) ? 0xFF : (__mmask8)((1u << (n - j)) - 1);
+            xv0 = _mm512_maskz_loadu_pd(k, x + j);
+            s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a0 + j), xv0, s0);
+            s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a1 + j), xv0, s1);
+            s2 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a2 + j), xv0, s2);
+            s3 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a3 + j), xv0, s3);
+        }
+        y[i] = _mm512_reduce_add_pd(_mm512_add_pd(s0, u0));
+        y[i + 1] = _mm512_reduce_add_pd(_mm512_add_pd(s1, u1));
+        y[i + 2] = _mm512_reduce_add_pd(_mm512_add_pd(s2, u2));
+        y[i + 3] = _mm512_reduce_add_pd(_mm512_add_pd(s3, u3));
     }
-    fclose(file);
+    if (i < m) gemv_scalar(m - i, n, a + (size_t)i * lda, lda, x, y + i);
 }
+#endif
 
+// 環境変数 GEMV_ISA (scalar, sse2, avx2, avx512) で明示的に選ぶこともできる
+gemv_fn gemv_select(const char **name) {
+    const char *isa = getenv("GEMV_ISA");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa == NULL || strcmp(isa, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        *name = "avx512";
+        return gemv_avx512;
+    }
+    if ((isa == NULL || strcmp(isa, "avx2") == 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        *name = "avx2";
+        return gemv_avx2;
+    }
+    if ((isa == NULL || strcmp(isa, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return gemv_sse2;
+    }
+#endif
+    (void)isa;
+    *name = "scalar";
+    return gemv_scalar;
+}
+
+// 行を64行ずつのブロックに分けて, スレッド並列に fn を呼ぶ
+void gemv_blocked(gemv_fn fn, int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    int ib, blk = 64;
+
+    if ((double)m * n < 1e5) {
+        fn(m, n, a, lda, x, y);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (ib = 0; ib < m; ib += blk) {
+        fn((m - ib < blk) ? m - ib : blk, n, a + (size_t)ib * lda, lda, x, y + ib);
+    }
+}
+
+// y = A x (初回呼び出し時にカーネルを選ぶ)
+void gemv(int m, int n, const double *a, size_t lda, const double *x, double *y) {
+    static gemv_fn fn = NULL;
+    const char *name;
+
+    if (fn == NULL) fn = gemv_select(&name);
+    gemv_blocked(fn, m, n, a, lda, x, y);
+}
 
 // 行列を整形して出力する関数
 void print_matrix(const char* title, int rows, int cols, double *matrix) {
@@ -71,193 +509,838 @@ void print_vector(const char* title, int size, double *vector) {
     printf("\n");
 }
 
-int main(int argc, char **argv) {
-    MPI_Init(&argc, &argv);
+// ブロックサイクリック分割: 行を nb 行ずつのブロックに分け, ブロック b を rank b % p に割り当てる
+// (nb = 1 なら従来の行サイクリック). counts[r] は rank r の行数, displs[r] は rank 順に並べたときの先頭行
+void block_cyclic_counts(int N, int nb, int p, int *counts, int *displs) {
+    for (int r = 0; r < p; r++) counts[r] = 0;
+    for (int b = 0; b * nb < N; b++) {
+        counts[b % p] += (N - b * nb < nb) ? N - b * nb : nb;
+    }
+    displs[0] = 0;
+    for (int r = 1; r < p; r++) displs[r] = displs[r - 1] + counts[r - 1];
+}
 
-    int world_rank, world_size;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+// 大域の行の順 (src) と rank 順 (dst) の間で, 1行 len 個の値を並べ替える (unpack = 1 なら逆向き)
+void block_cyclic_pack(int N, int len, int nb, int p, const int *displs, double *global, double *packed, int unpack) {
+    int *pos = (int *)malloc(p * sizeof(int));
 
-    int N = 0, M = 0; // 行列の次元 (N行, M列)
-    double *matrix = NULL;
-    double *vector = NULL;
-    double *result_vector = NULL;
-    MPI_Request *send_requests = NULL;
+    memcpy(pos, displs, p * sizeof(int));
+    for (int b = 0; b * nb < N; b++) {
+        int r = b % p, rows = (N - b * nb < nb) ? N - b * nb : nb;
+        double *g = global + (size_t)b * nb * len, *q = packed + (size_t)pos[r] * len;
+        if (unpack) memcpy(g, q, (size_t)rows * len * sizeof(double));
+        else memcpy(q, g, (size_t)rows * len * sizeof(double));
+        pos[r] += rows;
+    }
+    free(pos);
+}
 
-    if (world_rank == 0) {
-        if (argc < 3) {
-            fprintf(stderr, "使用法: %s <matrix_file> <vector_file>\n", argv[0]);
-            MPI_Abort(MPI_COMM_WORLD, 1);
+// n 個を parts 個にほぼ等分したときの個数と先頭 (余りは前から1個ずつ)
+void block_counts(int n, int parts, int *counts, int *displs) {
+    for (int r = 0; r < parts; r++) {
+        counts[r] = n / parts + (r < n % parts);
+        displs[r] = (r == 0) ? 0 : displs[r - 1] + counts[r - 1];
+    }
+}
+
+// 1回の行列ベクトル積の rank ごとの記録 (-t で表示する)
+typedef struct {
+    double io;       // 入力 (ファイルの読み込み) の時間 (秒)
+    double comm;     // 通信の時間 (秒)
+    double comp;     // 計算 (gemv) の時間 (秒)
+    double pack;     // rank 0 の並べ替えの時間 (秒)
+    int rows, cols;  // この rank が持つ小行列の大きさ
+} MatvecStat;
+
+// 行列の分割と, この rank が持つ小行列・ベクトルの部分
+// 1次元: 行のブロックサイクリック分割で, rank は自分の行 (大域の行の順) と x 全体を持つ.
+// 格子: p 個のプロセスを pr x pc の格子に並べ, 格子の (i, j) が行のブロック i と列のブロック j の交わる小行列と
+//       x の列のブロック j を持つ
+typedef struct {
+    int N, M;
+    int use_grid;            // 0: 1次元ブロックサイクリック, 1: 2次元プロセス格子
+    int nb;                  // 1次元: ブロックの行数
+    int rank, size;
+    int rows, cols;          // この rank の小行列の大きさ
+    int *counts, *displs;    // 1次元: rank ごとの行数と rank 順の先頭行 / 格子: 行のブロックの行数と先頭行
+    int *ccounts, *cdispls;  // 格子: 列のブロックの列数と先頭列
+    int dims[2], coords[2];  // 格子の大きさ (pr, pc) と自分の位置
+    MPI_Comm grid, row_comm, col_comm;
+    double *a;               // 小行列 (rows x cols, 行優先)
+    double *x;               // 1次元: x 全体 (M 個), 格子: 列のブロック (cols 個)
+} Dist;
+
+// 分割を決めて小行列とベクトルの領域を確保する (全プロセスで呼ぶ)
+void dist_create(Dist *d, int N, int M, int nb, int use_grid) {
+    int periods[2] = { 0, 0 }, remain[2], t;
+
+    memset(d, 0, sizeof(Dist));
+    d->N = N;
+    d->M = M;
+    d->nb = nb;
+    d->use_grid = use_grid;
+    MPI_Comm_rank(MPI_COMM_WORLD, &d->rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &d->size);
+
+    if (use_grid) {
+        MPI_Dims_create(d->size, 2, d->dims);
+        // MPI_Dims_create は pr >= pc の順に返すので, 横長の行列では列の方を多く分ける
+        if (M > N) {
+            t = d->dims[0];
+            d->dims[0] = d->dims[1];
+            d->dims[1] = t;
         }
-        char* matrix_filename = argv[1];
-        char* vector_filename = argv[2];
+        // 並べ替えなし (reorder = 0) なので格子の rank は MPI_COMM_WORLD と同じで, rank 0 が (0, 0) になる
+        MPI_Cart_create(MPI_COMM_WORLD, 2, d->dims, periods, 0, &d->grid);
+        MPI_Cart_coords(d->grid, d->rank, 2, d->coords);
+        remain[0] = 0; remain[1] = 1;
+        MPI_Cart_sub(d->grid, remain, &d->row_comm);   // 同じ行 i の rank (j の順)
+        remain[0] = 1; remain[1] = 0;
+        MPI_Cart_sub(d->grid, remain, &d->col_comm);   // 同じ列 j の rank (i の順)
+
+        d->counts = (int *)malloc(d->dims[0] * sizeof(int));
+        d->displs = (int *)malloc(d->dims[0] * sizeof(int));
+        d->ccounts = (int *)malloc(d->dims[1] * sizeof(int));
+        d->cdispls = (int *)malloc(d->dims[1] * sizeof(int));
+        block_counts(N, d->dims[0], d->counts, d->displs);
+        block_counts(M, d->dims[1], d->ccounts, d->cdispls);
+        d->rows = d->counts[d->coords[0]];
+        d->cols = d->ccounts[d->coords[1]];
+    } else {
+        d->counts = (int *)malloc(d->size * sizeof(int));
+        d->displs = (int *)malloc(d->size * sizeof(int));
+        block_cyclic_counts(N, nb, d->size, d->counts, d->displs);
+        d->rows = d->counts[d->rank];
+        d->cols = M;
+    }
+    d->a = (double *)malloc((size_t)d->rows * d->cols * sizeof(double) + 1);
+    d->x = (double *)malloc(d->cols * sizeof(double) + 1);
+    if (d->a == NULL || d->x == NULL) {
+        fprintf(stderr, "エラー: メモリを確保できません。\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
 
-        // ファイルから次元を自動取得
-        get_matrix_dimensions(matrix_filename, &N, &M);
-        int vec_dim;
-        get_vector_size(vector_filename, &vec_dim);
+void dist_free(Dist *d) {
+    free(d->a);
+    free(d->x);
+    free(d->counts);
+    free(d->displs);
+    free(d->ccounts);
+    free(d->cdispls);
+    if (d->use_grid) {
+        MPI_Comm_free(&d->row_comm);
+        MPI_Comm_free(&d->col_comm);
+        MPI_Comm_free(&d->grid);
+    }
+}
 
-        if (M != vec_dim) {
-             fprintf(stderr, "エラー: 行列とベクトルの次元が非互換です。 (M=%d, vec_dim=%d)\n", M, vec_dim);
-             MPI_Abort(MPI_COMM_WORLD, 1);
+// rank 0 が持つベクトル全体を配る
+// 1次元: 全プロセスに MPI_Bcast する. 格子: 列のブロックごとに格子の第0行へ MPI_Scatterv で配ってから
+// 列のコミュニケータで MPI_Bcast するので, 各 rank が受け取るのは x 全体ではなく M / pc 個だけになる
+void dist_scatter_vector(Dist *d, double *vector, MatvecStat *st) {
+    double t0 = MPI_Wtime();
+
+    if (d->use_grid) {
+        if (d->coords[0] == 0) {
+            MPI_Scatterv(vector, d->ccounts, d->cdispls, MPI_DOUBLE, d->x, d->cols, MPI_DOUBLE, 0, d->row_comm);
         }
+        MPI_Bcast(d->x, d->cols, MPI_DOUBLE, 0, d->col_comm);
+    } else {
+        if (d->rank == 0) memcpy(d->x, vector, d->M * sizeof(double));
+        MPI_Bcast(d->x, d->M, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+    st->comm += MPI_Wtime() - t0;
+}
 
-        // 行列のメモリ確保と読み込み
-        matrix = (double *)malloc(N * M * sizeof(double));
-        FILE *matrix_file = fopen(matrix_filename, "r");
-        for (int i = 0; i < N * M; i++) {
-            if (fscanf(matrix_file, "%lf", &matrix[i]) != 1) {
-                fprintf(stderr, "エラー: 行列のデータを読み込めません。\n");
-                fclose(matrix_file);
-                MPI_Abort(MPI_COMM_WORLD, 1);
+// rank 0 が持つ行列全体を配る
+// 1次元: 1行 (M 個の double) を派生データ型にして, rank 0 が行を rank 順に並べ替えてから1回の MPI_Scatterv で配る.
+// 格子: 小行列を列の間隔 M の MPI_Type_vector で rank 0 の行列から直接 rank ごとに1通ずつ送る
+void dist_scatter_matrix(Dist *d, double *matrix, MatvecStat *st) {
+    double t0, *packed = NULL;
+
+    if (d->use_grid) {
+        t0 = MPI_Wtime();
+        if (d->rank == 0) {
+            MPI_Request *reqs = (MPI_Request *)malloc(d->size * sizeof(MPI_Request));
+            MPI_Datatype *types = (MPI_Datatype *)malloc(d->size * sizeof(MPI_Datatype));
+            int c[2];
+            for (int r = 1; r < d->size; r++) {
+                MPI_Cart_coords(d->grid, r, 2, c);
+                MPI_Type_vector(d->counts[c[0]], d->ccounts[c[1]], d->M, MPI_DOUBLE, &types[r]);
+                MPI_Type_commit(&types[r]);
+                MPI_Isend(matrix + (size_t)d->displs[c[0]] * d->M + d->cdispls[c[1]], 1, types[r], r, 0, d->grid, &reqs[r - 1]);
             }
+            for (int i = 0; i < d->rows; i++) {
+                memcpy(d->a + (size_t)i * d->cols, matrix + (size_t)i * d->M, d->cols * sizeof(double));
+            }
+            MPI_Waitall(d->size - 1, reqs, MPI_STATUSES_IGNORE);
+            for (int r = 1; r < d->size; r++) MPI_Type_free(&types[r]);
+            free(reqs);
+            free(types);
+        } else {
+            MPI_Recv(d->a, d->rows * d->cols, MPI_DOUBLE, 0, 0, d->grid, MPI_STATUS_IGNORE);
         }
-        fclose(matrix_file);
+        st->comm += MPI_Wtime() - t0;
+        return;
+    }
 
-        // ベクトルのメモリ確保と読み込み
-        vector = (double *)malloc(M * sizeof(double));
-        FILE *vector_file = fopen(vector_filename, "r");
-        for (int i = 0; i < M; i++) {
-            if (fscanf(vector_file, "%lf", &vector[i]) != 1) {
-                fprintf(stderr, "エラー: ベクトルのデータを読み込めません。\n");
-                fclose(vector_file);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-            }
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(d->M, MPI_DOUBLE, &row_type);
+    MPI_Type_commit(&row_type);
+    if (d->rank == 0) {
+        t0 = MPI_Wtime();
+        packed = (double *)malloc((size_t)d->N * d->M * sizeof(double));
+        block_cyclic_pack(d->N, d->M, d->nb, d->size, d->displs, matrix, packed, 0);
+        st->pack += MPI_Wtime() - t0;
+    }
+    t0 = MPI_Wtime();
+    MPI_Scatterv(packed, d->counts, d->displs, row_type, d->a, d->rows, row_type, 0, MPI_COMM_WORLD);
+    st->comm += MPI_Wtime() - t0;
+    free(packed);
+    MPI_Type_free(&row_type);
+}
+
+// y = A x を計算して rank 0 の result に集める
+// 1次元: 各 rank の結果を rank 順に1回の MPI_Gatherv で集めてから大域の行の順に戻す.
+// 格子: 部分和を行のコミュニケータで MPI_Reduce して第0列に集め, 第0列から rank 0 に MPI_Gatherv で集める
+void dist_matvec(Dist *d, double *result, MatvecStat *st) {
+    double t0, *packed = NULL;
+    double *y = (double *)malloc(d->rows * sizeof(double) + 1);
+
+    t0 = MPI_Wtime();
+    gemv(d->rows, d->cols, d->a, d->cols, d->x, y);
+    st->comp += MPI_Wtime() - t0;
+
+    t0 = MPI_Wtime();
+    if (d->use_grid) {
+        if (d->coords[1] == 0) {
+            MPI_Reduce(MPI_IN_PLACE, y, d->rows, MPI_DOUBLE, MPI_SUM, 0, d->row_comm);
+            MPI_Gatherv(y, d->rows, MPI_DOUBLE, result, d->counts, d->displs, MPI_DOUBLE, 0, d->col_comm);
+        } else {
+            MPI_Reduce(y, NULL, d->rows, MPI_DOUBLE, MPI_SUM, 0, d->row_comm);
         }
-        fclose(vector_file);
-        
-        print_matrix("読み込み行列:", N, M, matrix);
-        print_vector("読み込みベクトル:", M, vector);
+        st->comm += MPI_Wtime() - t0;
+    } else {
+        if (d->rank == 0) packed = (double *)malloc(d->N * sizeof(double));
+        MPI_Gatherv(y, d->rows, MPI_DOUBLE, packed, d->counts, d->displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        st->comm += MPI_Wtime() - t0;
+        if (d->rank == 0) {
+            t0 = MPI_Wtime();
+            block_cyclic_pack(d->N, 1, d->nb, d->size, d->displs, result, packed, 1);
+            st->pack += MPI_Wtime() - t0;
+        }
+        free(packed);
+    }
+    free(y);
+}
 
-        result_vector = (double *)malloc(N * sizeof(double));
+// --- ストリーミング (-s): 行の到着と計算を重ねる ---
+// 行列を nb 行のブロックごとに1通のメッセージにして rank 0 から MPI_Isend で巡回的に送り,
+// 受け手はブロックが届いたもの (MPI_Testsome, なければ MPI_Waitany で待つ) から順に計算して,
+// そのブロックの結果をすぐに MPI_Isend で rank 0 に返す. 後のブロックの転送中に前のブロックを計算するので,
+// 計算が分配の後ろではなく分配の陰で進む. rank 0 は結果をブロックごとに result の大域の位置へ直接受け取る
+// (並べ替えは不要). 行列は d->a に残るので, 分配後は dist_matvec と同じように使える
+void dist_stream(Dist *d, double *matrix, double *result, MatvecStat *st) {
+    int p = d->size, nblocks = (d->N + d->nb - 1) / d->nb;
+    int mine = (nblocks - d->rank + p - 1) / p;   // この rank のブロック数 (ブロック rank, rank + p, ...)
+    int flag, *tag_ub, i, k, b, rows, count, outcount, *done;
+    double t0, *y;
+    MPI_Request *rreq, *sreq;
+
+    // ブロック k (この rank の k 番目) をタグ k で送るので, タグの上限を確かめる
+    MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+    if ((nblocks + p - 1) / p > *tag_ub) {
+        if (d->rank == 0) fprintf(stderr, "エラー: ブロックの数が多すぎます。 -b を大きくしてください。\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
+    y = (double *)malloc(d->rows * sizeof(double) + 1);
 
-    // 全プロセスに次元をブロードキャスト
-    MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&M, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (d->rank == 0) {
+        // 結果の受信を先に出しておき, 行列のブロックを送り先が巡回するよう大域の順に送る
+        rreq = (MPI_Request *)malloc(nblocks * sizeof(MPI_Request));
+        sreq = (MPI_Request *)malloc(nblocks * sizeof(MPI_Request));
+        count = 0;
+        for (b = 0; b < nblocks; b++) {
+            if (b % p == 0) continue;
+            rows = (d->N - b * d->nb < d->nb) ? d->N - b * d->nb : d->nb;
+            MPI_Irecv(result + (size_t)b * d->nb, rows, MPI_DOUBLE, b % p, b / p, MPI_COMM_WORLD, &rreq[count]);
+            MPI_Isend(matrix + (size_t)b * d->nb * d->M, rows * d->M, MPI_DOUBLE, b % p, b / p, MPI_COMM_WORLD, &sreq[count]);
+            count++;
+        }
+        // 送信の間に自分のブロックを計算する (ブロックごとに MPI_Testall を呼んで送信を進める)
+        for (k = 0, i = 0; k < mine; k++) {
+            b = k * p;
+            rows = (d->N - b * d->nb < d->nb) ? d->N - b * d->nb : d->nb;
+            t0 = MPI_Wtime();
+            memcpy(d->a + (size_t)i * d->M, matrix + (size_t)b * d->nb * d->M, (size_t)rows * d->M * sizeof(double));
+            gemv(rows, d->M, d->a + (size_t)i * d->M, d->M, d->x, result + (size_t)b * d->nb);
+            st->comp += MPI_Wtime() - t0;
+            MPI_Testall(count, sreq, &outcount, MPI_STATUSES_IGNORE);
+            i += rows;
+        }
+        t0 = MPI_Wtime();
+        MPI_Waitall(count, sreq, MPI_STATUSES_IGNORE);
+        MPI_Waitall(count, rreq, MPI_STATUSES_IGNORE);
+        st->comm += MPI_Wtime() - t0;
+        free(rreq);
+        free(sreq);
+        free(y);
+        return;
+    }
 
-    // rank 0以外のプロセスでベクトルのメモリを確保
-    if (world_rank != 0) {
-        vector = (double *)malloc(M * sizeof(double));
+    // 自分のブロックの受信をすべて出しておき, 届いたものから計算して結果を返す
+    rreq = (MPI_Request *)malloc(mine * sizeof(MPI_Request) + 1);
+    sreq = (MPI_Request *)malloc(mine * sizeof(MPI_Request) + 1);
+    done = (int *)malloc(mine * sizeof(int) + 1);
+    int *offset = (int *)malloc(mine * sizeof(int) + 1);
+    for (k = 0, i = 0; k < mine; k++) {
+        b = d->rank + k * p;
+        rows = (d->N - b * d->nb < d->nb) ? d->N - b * d->nb : d->nb;
+        offset[k] = i;
+        MPI_Irecv(d->a + (size_t)i * d->M, rows * d->M, MPI_DOUBLE, 0, k, MPI_COMM_WORLD, &rreq[k]);
+        i += rows;
+    }
+    for (int left = mine; left > 0; left -= outcount) {
+        t0 = MPI_Wtime();
+        MPI_Testsome(mine, rreq, &outcount, done, MPI_STATUSES_IGNORE);
+        if (outcount == 0) {
+            MPI_Waitany(mine, rreq, &done[0], MPI_STATUS_IGNORE);
+            outcount = 1;
+        }
+        st->comm += MPI_Wtime() - t0;
+        for (int j = 0; j < outcount; j++) {
+            k = done[j];
+            b = d->rank + k * p;
+            rows = (d->N - b * d->nb < d->nb) ? d->N - b * d->nb : d->nb;
+            t0 = MPI_Wtime();
+            gemv(rows, d->M, d->a + (size_t)offset[k] * d->M, d->M, d->x, y + offset[k]);
+            st->comp += MPI_Wtime() - t0;
+            MPI_Isend(y + offset[k], rows, MPI_DOUBLE, 0, k, MPI_COMM_WORLD, &sreq[k]);
+        }
     }
-    // 全プロセスにベクトルをブロードキャスト
-    MPI_Bcast(vector, M, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    MPI_Waitall(mine, sreq, MPI_STATUSES_IGNORE);
+    st->comm += MPI_Wtime() - t0;
+    free(rreq);
+    free(sreq);
+    free(done);
+    free(offset);
+    free(y);
+}
+
+// --- 反復 (-n): A を配ったまま y = A x を繰り返す (べき乗法) ---
+// x <- A x / ||A x|| を iters 回繰り返す (N = M のときだけ). 行列は最初の分配の後は動かさず, 毎回交換するのは
+// ベクトルの部分だけで, その送受信は最初に MPI_Send_init / MPI_Recv_init で作っておき, 毎回 MPI_Startall で再開する.
+// 1次元: 各 rank の y の部分 (自分の行) をほかの全 rank に送り, 受け取った部分を大域の行の順に戻して次の x にする.
+// 格子: 部分和を行のコミュニケータで MPI_Allreduce して y の行のブロック i を得てから, 列のコミュニケータの中で
+//       行のブロック i と列のブロック j の重なる部分を送り合うと, 各 rank に次の x の列のブロック j が揃う.
+// 終わったら最後の x を rank 0 の result に集め, ||A x|| (絶対値最大の固有値の推定) を *lambda, 反復ごとの時間
+// (全 rank の最大) を lat に返す
+void dist_iterate(Dist *d, int iters, double *result, double *lambda, double *lat, MatvecStat *st) {
+    int p = d->use_grid ? d->dims[0] : d->size;   // 送り合う相手の数 (格子では同じ列の rank)
+    int me = d->use_grid ? d->coords[0] : d->rank;
+    int j = d->use_grid ? d->coords[1] : 0;
+    int nreq = 0, lo, hi, mylo = 0, mylen = 0;
+    double *y = (double *)malloc(d->rows * sizeof(double) + 1);
+    double *buf = (double *)malloc(d->N * sizeof(double) + 1);   // 1次元: rank 順に並べた y
+    MPI_Request *reqs = (MPI_Request *)malloc(2 * p * sizeof(MPI_Request));
+    MPI_Comm comm = d->use_grid ? d->col_comm : MPI_COMM_WORLD;
+    double t0, t1, s, norm = 0.0;
 
-    // --- 行列の各行をサイクリックに分配 ---
-    
-    // このプロセスが担当する行数を計算
-    int my_rows = 0;
-    for (int i = 0; i < N; i++) {
-        if (i % world_size == world_rank) {
-            my_rows++;
+    // 送受信を1回だけ作る
+    if (d->use_grid) {
+        // 自分の行のブロックと列のブロックの重なり [mylo, mylo + mylen) を同じ列の全 rank に送り,
+        // rank i' からは行のブロック i' との重なりを x の該当位置に受け取る
+        lo = d->displs[me] > d->cdispls[j] ? d->displs[me] : d->cdispls[j];
+        hi = d->displs[me] + d->counts[me] < d->cdispls[j] + d->cols ? d->displs[me] + d->counts[me] : d->cdispls[j] + d->cols;
+        if (hi > lo) {
+            mylo = lo;
+            mylen = hi - lo;
+        }
+        for (int r = 0; r < p; r++) {
+            if (r == me) continue;
+            if (mylen > 0) {
+                MPI_Send_init(y + (mylo - d->displs[me]), mylen, MPI_DOUBLE, r, 0, comm, &reqs[nreq++]);
+            }
+            lo = d->displs[r] > d->cdispls[j] ? d->displs[r] : d->cdispls[j];
+            hi = d->displs[r] + d->counts[r] < d->cdispls[j] + d->cols ? d->displs[r] + d->counts[r] : d->cdispls[j] + d->cols;
+            if (hi > lo) {
+                MPI_Recv_init(d->x + (lo - d->cdispls[j]), hi - lo, MPI_DOUBLE, r, 0, comm, &reqs[nreq++]);
+            }
+        }
+    } else {
+        for (int r = 0; r < p; r++) {
+            if (r == me) continue;
+            if (d->rows > 0) MPI_Send_init(y, d->rows, MPI_DOUBLE, r, 0, comm, &reqs[nreq++]);
+            if (d->counts[r] > 0) MPI_Recv_init(buf + d->displs[r], d->counts[r], MPI_DOUBLE, r, 0, comm, &reqs[nreq++]);
         }
     }
-    
-    if (my_rows == 0 && N > 0) {
-        // 仕事がないプロセス。何もしないが、後続の処理で問題が起きないようにする。
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int it = 0; it < iters; it++) {
+        t1 = MPI_Wtime();
+        t0 = t1;
+        gemv(d->rows, d->cols, d->a, d->cols, d->x, y);
+        st->comp += MPI_Wtime() - t0;
+
+        t0 = MPI_Wtime();
+        if (d->use_grid) MPI_Allreduce(MPI_IN_PLACE, y, d->rows, MPI_DOUBLE, MPI_SUM, d->row_comm);
+        // 同じ行のブロックを持つ rank のうち第0列だけが ||y||^2 に足す (格子). 送受信の完了を待つ間に和をとる
+        s = 0.0;
+        if (!d->use_grid || j == 0) {
+            for (int i = 0; i < d->rows; i++) s += y[i] * y[i];
+        }
+        MPI_Startall(nreq, reqs);
+        MPI_Allreduce(&s, &norm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        norm = sqrt(norm);
+        if (norm == 0.0) {
+            if (d->rank == 0) fprintf(stderr, "エラー: A x が 0 になりました。\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_Waitall(nreq, reqs, MPI_STATUSES_IGNORE);
+        st->comm += MPI_Wtime() - t0;
+
+        // 自分の部分を置いて大域の順に戻し, 正規化したものを次の x にする
+        t0 = MPI_Wtime();
+        if (d->use_grid) {
+            if (mylen > 0) memcpy(d->x + (mylo - d->cdispls[j]), y + (mylo - d->displs[me]), mylen * sizeof(double));
+        } else {
+            memcpy(buf + d->displs[me], y, d->rows * sizeof(double));
+            block_cyclic_pack(d->N, 1, d->nb, d->size, d->displs, d->x, buf, 1);
+        }
+        for (int i = 0; i < d->cols; i++) d->x[i] /= norm;
+        st->pack += MPI_Wtime() - t0;
+        lat[it] = MPI_Wtime() - t1;
+    }
+    *lambda = norm;
+
+    // 反復ごとの時間は最も遅い rank で決まる
+    MPI_Allreduce(MPI_IN_PLACE, lat, iters, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    // 最後の x を rank 0 に集める (1次元では全 rank が全体を持っている)
+    if (d->use_grid) {
+        if (d->coords[0] == 0) {
+            MPI_Gatherv(d->x, d->cols, MPI_DOUBLE, result, d->ccounts, d->cdispls, MPI_DOUBLE, 0, d->row_comm);
+        }
+    } else if (d->rank == 0) {
+        memcpy(result, d->x, d->M * sizeof(double));
     }
 
+    for (int r = 0; r < nreq; r++) MPI_Request_free(&reqs[r]);
+    free(reqs);
+    free(buf);
+    free(y);
+}
 
-    double *my_matrix_part = (double *)malloc(my_rows * M * sizeof(double));
-    MPI_Request *recv_requests = (MPI_Request *)malloc(my_rows * sizeof(MPI_Request));
-    int my_row_idx = 0;
+// --- MPI-IO による並列入力 ---
+// CRMAT (matconv で作るバイナリ) なら, 各 rank が自分の行 (格子なら小行列) だけをファイルビューで選んで
+// 集団的に読む (MPI_File_read_all). テキストなら, ファイルを p 等分したバイト位置から各 rank が自分の範囲を読み,
+// その範囲で始まる行を解析してから MPI_Alltoallv で担当の rank に送る. どちらも rank 0 が全体を持つことはない
 
-    if (world_rank == 0) {
-        int send_req_count = 0;
-        if (N > 0) { // N=0 のケースを考慮
-             send_requests = (MPI_Request *)malloc((N - my_rows) * sizeof(MPI_Request));
-        }
-        for (int i = 0; i < N; i++) {
-            int dest_rank = i % world_size;
-            if (dest_rank == 0) {
-                // 自身の担当分は直接コピー
-                if (my_rows > 0) {
-                    memcpy(&my_matrix_part[my_row_idx * M], &matrix[i * M], M * sizeof(double));
-                    my_row_idx++;
+// バイナリ行列ファイル (CRMAT, matconv で作成) のヘッダ: 64バイト
+#define CRMAT_MAGIC "CRMAT01"
+enum { CRMAT_DENSE = 0, CRMAT_UPPER = 1, CRMAT_BAND = 2, CRMAT_VECTOR = 3 };
+typedef struct {
+    char magic[8];
+    int32_t kind;         // 格納形式
+    int32_t symmetric;    // 1: 対称行列
+    int64_t rows;
+    int64_t cols;
+    int64_t bandwidth;    // 上側バンド幅 (対角を含む)
+    int64_t data_offset;  // データの開始位置
+    int64_t reserved[2];
+} CrmatHeader;
+
+// ファイルを開き, CRMAT ならヘッダを h に読んで 1 を返す (全プロセスで呼ぶ)
+int crmat_open(char *filename, MPI_File *fh, CrmatHeader *h) {
+    MPI_Offset size;
+
+    if (MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, fh) != MPI_SUCCESS) {
+        fprintf(stderr, "エラー: ファイルを開けません %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_get_size(*fh, &size);
+    memset(h, 0, sizeof(CrmatHeader));
+    if (size >= (MPI_Offset)sizeof(CrmatHeader)) {
+        MPI_File_read_at_all(*fh, 0, h, sizeof(CrmatHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    return memcmp(h->magic, CRMAT_MAGIC, sizeof(h->magic)) == 0;
+}
+
+// CRMAT の密行列から自分の小行列を読む. 1次元は MPI_Type_create_darray (行方向にブロック nb のサイクリック),
+// 格子は MPI_Type_create_subarray をファイルビューにして, 1回の MPI_File_read_all で d->a に詰めて読む
+void crmat_read_matrix(Dist *d, MPI_File fh, const CrmatHeader *h) {
+    MPI_Datatype filetype;
+    int gsizes[2] = { d->N, d->M };
+
+    if (d->use_grid) {
+        int subsizes[2] = { d->rows, d->cols };
+        int starts[2] = { d->displs[d->coords[0]], d->cdispls[d->coords[1]] };
+        if (d->rows > 0 && d->cols > 0) {
+            MPI_Type_create_subarray(2, gsizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &filetype);
+        } else {
+            MPI_Type_contiguous(0, MPI_DOUBLE, &filetype);
+        }
+    } else {
+        int distribs[2] = { MPI_DISTRIBUTE_CYCLIC, MPI_DISTRIBUTE_NONE };
+        int dargs[2] = { d->nb, MPI_DISTRIBUTE_DFLT_DARG };
+        int psizes[2] = { d->size, 1 };
+        MPI_Type_create_darray(d->size, d->rank, 2, gsizes, distribs, dargs, psizes, MPI_ORDER_C, MPI_DOUBLE, &filetype);
+    }
+    MPI_Type_commit(&filetype);
+    MPI_File_set_view(fh, h->data_offset, MPI_DOUBLE, filetype, "native", MPI_INFO_NULL);
+    MPI_File_read_all(fh, d->a, d->rows * d->cols, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_Type_free(&filetype);
+}
+
+// CRMAT のベクトル (vector または dense で要素数 M) から自分の部分を読む
+void crmat_read_vector(Dist *d, MPI_File fh, const CrmatHeader *h) {
+    MPI_Offset start = d->use_grid ? d->cdispls[d->coords[1]] : 0;
+
+    MPI_File_read_at_all(fh, h->data_offset + start * (MPI_Offset)sizeof(double), d->x, d->cols, MPI_DOUBLE, MPI_STATUS_IGNORE);
+}
+
+// テキストのファイルのうち, 先頭がバイト位置 [size * rank / p, size * (rank + 1) / p) にある行を読んで解析する.
+// 範囲の前後の行の続きは, 直前の1バイトと範囲の後ろを改行が見つかるまで読み足して判定する
+void text_read_rows(char *filename, MPI_File fh, TextMatrix *t, int rank, int size) {
+    MPI_Offset fsize, lo, hi, from, begin, end;
+    char *buf;
+    size_t len, cap;
+    int n;
+
+    MPI_File_get_size(fh, &fsize);
+    lo = fsize * rank / size;
+    hi = fsize * (rank + 1) / size;
+    from = (lo > 0) ? lo - 1 : 0;
+    cap = (size_t)(hi - from) + (1 << 16);
+    if ((buf = (char *)malloc(cap)) == NULL) {
+        fprintf(stderr, "エラー: メモリを確保できません。\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_read_at_all(fh, from, buf, (int)(hi - from), MPI_CHAR, MPI_STATUS_IGNORE);
+    len = (size_t)(hi - from);
+
+    // 自分の最初の行: lo が行頭でなければ lo - 1 以降で最初の改行の次
+    begin = lo;
+    if (lo > 0) {
+        while (begin < hi && buf[begin - 1 - from] != '\n') begin++;
+    }
+    // 範囲を越えた最後の行の終わりまで読み足す (範囲内で始まる行がなければ読まない)
+    end = hi;
+    if (begin < hi) {
+        while (end < fsize && (end == 0 || buf[end - 1 - from] != '\n')) {
+            if ((size_t)(end - from) == len) {
+                if (len + (1 << 16) > cap) {
+                    cap *= 2;
+                    if ((buf = (char *)realloc(buf, cap)) == NULL) {
+                        fprintf(stderr, "エラー: メモリを確保できません。\n");
+                        MPI_Abort(MPI_COMM_WORLD, 1);
+                    }
                 }
-            } else {
-                // 他のrankへノンブロッキング送信
-                MPI_Isend(&matrix[i * M], M, MPI_DOUBLE, dest_rank, i, MPI_COMM_WORLD, &send_requests[send_req_count++]);
+                n = (fsize - end < (1 << 16)) ? (int)(fsize - end) : (1 << 16);
+                MPI_File_read_at(fh, end, buf + len, n, MPI_CHAR, MPI_STATUS_IGNORE);
+                len += n;
             }
+            end++;
         }
     } else {
-        if (my_rows > 0) {
-            for (int i = 0; i < N; i++) {
-                if (i % world_size == world_rank) {
-                    // 自身の担当分をノンブロッキング受信
-                    MPI_Irecv(&my_matrix_part[my_row_idx * M], M, MPI_DOUBLE, 0, i, MPI_COMM_WORLD, &recv_requests[my_row_idx]);
-                    my_row_idx++;
+        begin = end = hi;
+    }
+    text_parse_buffer(buf + (begin - from), (size_t)(end - begin), filename, (long)begin, t);
+    free(buf);
+}
+
+// テキストから読んだ連続する行 (大域の行 row0 から t->rows 行) を分割に従って担当の rank に送る.
+// 送り手は rank 順にファイルの前から並んでいるので, 受け取った順に詰めれば大域の行の順 (格子では小行列) になる
+void dist_redistribute(Dist *d, const TextMatrix *t, int row0, MatvecStat *st) {
+    int *scount = (int *)calloc(d->size, sizeof(int)), *sdispl = (int *)malloc(d->size * sizeof(int));
+    int *rcount = (int *)malloc(d->size * sizeof(int)), *rdispl = (int *)malloc(d->size * sizeof(int));
+    int *pos = (int *)malloc(d->size * sizeof(int));
+    int pass, g, i, j, r, c[2];
+    double *sbuf = NULL, t0;
+
+    // 1回目で送る個数を数え, 2回目で送り先ごとに詰める
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (r = 0; r < d->size; r++) {
+                sdispl[r] = (r == 0) ? 0 : sdispl[r - 1] + scount[r - 1];
+                pos[r] = sdispl[r];
+            }
+            sbuf = (double *)malloc(((size_t)sdispl[d->size - 1] + scount[d->size - 1]) * sizeof(double) + 1);
+        }
+        for (i = 0; i < t->rows; i++) {
+            g = row0 + i;
+            if (d->use_grid) {
+                for (c[0] = 0; g >= d->displs[c[0]] + d->counts[c[0]]; c[0]++)
+                    ;
+                for (c[1] = 0; c[1] < d->dims[1]; c[1]++) {
+                    MPI_Cart_rank(d->grid, c, &r);
+                    if (pass == 0) scount[r] += d->ccounts[c[1]];
+                    else {
+                        memcpy(sbuf + pos[r], t->val + (size_t)i * d->M + d->cdispls[c[1]], d->ccounts[c[1]] * sizeof(double));
+                        pos[r] += d->ccounts[c[1]];
+                    }
+                }
+            } else {
+                r = (g / d->nb) % d->size;
+                if (pass == 0) scount[r] += d->M;
+                else {
+                    memcpy(sbuf + pos[r], t->val + (size_t)i * d->M, d->M * sizeof(double));
+                    pos[r] += d->M;
                 }
             }
-            // 受信完了を待つ
-            MPI_Waitall(my_rows, recv_requests, MPI_STATUSES_IGNORE);
         }
     }
-    
-    // --- 内積計算 ---
-    double *my_results = (double *)malloc(my_rows * sizeof(double));
-    for (int i = 0; i < my_rows; i++) {
-        my_results[i] = 0.0;
-        for (int j = 0; j < M; j++) {
-            my_results[i] += my_matrix_part[i * M + j] * vector[j];
+
+    t0 = MPI_Wtime();
+    MPI_Alltoall(scount, 1, MPI_INT, rcount, 1, MPI_INT, MPI_COMM_WORLD);
+    for (j = 0; j < d->size; j++) rdispl[j] = (j == 0) ? 0 : rdispl[j - 1] + rcount[j - 1];
+    MPI_Alltoallv(sbuf, scount, sdispl, MPI_DOUBLE, d->a, rcount, rdispl, MPI_DOUBLE, MPI_COMM_WORLD);
+    st->comm += MPI_Wtime() - t0;
+
+    free(sbuf);
+    free(scount);
+    free(sdispl);
+    free(rcount);
+    free(rdispl);
+    free(pos);
+}
+
+// 行列とベクトルを全プロセスで並列に読み, 分割を作る
+void dist_read(Dist *d, char *matrix_filename, char *vector_filename, int nb, int use_grid, MatvecStat *st) {
+    MPI_File fh;
+    CrmatHeader h;
+    TextMatrix t;
+    int rank, size, N, M, row0 = 0, bad;
+    double t0 = MPI_Wtime();
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (crmat_open(matrix_filename, &fh, &h)) {
+        if (h.kind != CRMAT_DENSE || h.rows > 0x7fffffff || h.cols > 0x7fffffff) {
+            if (rank == 0) fprintf(stderr, "エラー: %s は密行列の CRMAT ではありません。\n", matrix_filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        dist_create(d, (int)h.rows, (int)h.cols, nb, use_grid);
+        crmat_read_matrix(d, fh, &h);
+    } else {
+        text_read_rows(matrix_filename, fh, &t, rank, size);
+        // 行数は全体の和, 列数はどの rank でも同じ, 先頭の行は前の rank までの行数の和
+        MPI_Allreduce(&t.rows, &N, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(&t.cols, &M, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        MPI_Exscan(&t.rows, &row0, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        if (rank == 0) row0 = 0;
+        bad = (t.rows > 0 && t.cols != M);
+        MPI_Allreduce(MPI_IN_PLACE, &bad, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+        if (N == 0 || bad) {
+            if (rank == 0) fprintf(stderr, "エラー: %s にデータがないか, 行ごとの要素数が揃っていません。\n", matrix_filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
+        dist_create(d, N, M, nb, use_grid);
+        st->io += MPI_Wtime() - t0;
+        dist_redistribute(d, &t, row0, st);
+        t0 = MPI_Wtime();
+        free(t.val);
     }
-    
-    // --- 計算結果をrank 0に集約 ---
-    if (world_rank == 0) {
-        MPI_Request *result_recv_reqs = (MPI_Request*) malloc(N * sizeof(MPI_Request));
-        int own_res_idx = 0;
-        for (int i = 0; i < N; i++) {
-            int source_rank = i % world_size;
-            if (source_rank == 0) {
-                 if(my_rows > 0) result_vector[i] = my_results[own_res_idx++];
-            } else {
-                // 他のrankからノンブロッキング受信
-                MPI_Irecv(&result_vector[i], 1, MPI_DOUBLE, source_rank, i, MPI_COMM_WORLD, &result_recv_reqs[i]);
+    MPI_File_close(&fh);
+
+    // ベクトルは CRMAT なら自分の部分だけを読み, テキストなら (M 個だけなので) rank 0 が読んで配る
+    if (crmat_open(vector_filename, &fh, &h)) {
+        if ((h.kind != CRMAT_VECTOR && h.kind != CRMAT_DENSE) || h.rows * h.cols != d->M) {
+            if (rank == 0) fprintf(stderr, "エラー: 行列とベクトルの次元が非互換です。 (M=%d)\n", d->M);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        crmat_read_vector(d, fh, &h);
+        MPI_File_close(&fh);
+        st->io += MPI_Wtime() - t0;
+    } else {
+        MPI_File_close(&fh);
+        double *vector = NULL;
+        if (rank == 0) {
+            text_parse(vector_filename, &t);
+            if (t.rows * t.cols != d->M) {
+                fprintf(stderr, "エラー: 行列とベクトルの次元が非互換です。 (M=%d, vec_dim=%d)\n", d->M, t.rows * t.cols);
+                MPI_Abort(MPI_COMM_WORLD, 1);
             }
+            vector = t.val;
         }
-        // 受信完了を待つ (自分以外のrankからのものだけ)
-        for (int i = 0; i < N; i++) {
-            if (i % world_size != 0) {
-                MPI_Wait(&result_recv_reqs[i], MPI_STATUS_IGNORE);
+        st->io += MPI_Wtime() - t0;
+        dist_scatter_vector(d, vector, st);
+        free(vector);
+    }
+}
+
+int main(int argc, char **argv) {
+    MPI_Init(&argc, &argv);
+
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    int N = 0, M = 0;     // 行列の次元 (N行, M列)
+    int nb = 1;           // ブロックサイクリック分割のブロックの行数
+    int use_grid = 0;     // 1: 2次元プロセス格子で分割する
+    int parallel_io = 0;  // 1: 全プロセスがファイルの自分の部分を読む (CRMAT なら常に)
+    int streaming = 0;    // 1: 行のブロックの到着と計算を重ねる
+    int iters = 0;        // > 0: 行列を配ったまま y = A x を iters 回繰り返す (べき乗法)
+    int timing = 0;       // 1: 通信と計算の時間を rank ごとに表示する
+    double *matrix = NULL;
+    double *vector = NULL;
+    double *result_vector = NULL;
+    int opt;
+    Dist d;
+
+    // オプションは全プロセスが同じように解釈する
+    while ((opt = getopt(argc, argv, "b:gin:st")) != -1) {
+        switch (opt) {
+        case 'b': nb = atoi(optarg); break;
+        case 'g': use_grid = 1; break;
+        case 'i': parallel_io = 1; break;
+        case 'n': iters = atoi(optarg); if (iters < 1) nb = 0; break;
+        case 's': streaming = 1; break;
+        case 't': timing = 1; break;
+        default: nb = 0; break;
+        }
+    }
+    if (argc - optind < 2 || nb < 1 || (streaming && (use_grid || parallel_io))) {
+        if (world_rank == 0) fprintf(stderr, "使用法: %s [-b block_rows [-s] | -g] [-i] [-n iterations] [-t] <matrix_file> <vector_file>\n", argv[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    char* matrix_filename = argv[optind];
+    char* vector_filename = argv[optind + 1];
+
+    MatvecStat st = { 0.0, 0.0, 0.0, 0.0, 0, 0 };
+    double t0;
+
+    // 行列ファイルが CRMAT なら MPI-IO で読む
+    if (!parallel_io) {
+        char magic[8] = { 0 };
+        if (world_rank == 0) {
+            FILE *fp = fopen(matrix_filename, "rb");
+            if (fp != NULL) {
+                if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic)) magic[0] = '\0';
+                fclose(fp);
             }
         }
-        free(result_recv_reqs);
-        
-        print_vector("計算結果ベクトル:", N, result_vector);
+        MPI_Bcast(magic, sizeof(magic), MPI_CHAR, 0, MPI_COMM_WORLD);
+        parallel_io = (memcmp(magic, CRMAT_MAGIC, sizeof(magic)) == 0);
+        if (parallel_io && streaming) {
+            if (world_rank == 0) fprintf(stderr, "エラー: -s は CRMAT の行列には使えません。\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
 
+    if (parallel_io) {
+        // --- 全プロセスが自分の部分だけを読む (rank 0 も行列全体は持たない) ---
+        if (timing) MPI_Barrier(MPI_COMM_WORLD);
+        dist_read(&d, matrix_filename, vector_filename, nb, use_grid, &st);
+        N = d.N;
+        M = d.M;
+        if (world_rank == 0) result_vector = (double *)malloc(N * sizeof(double));
     } else {
-        if(my_rows > 0) {
-            MPI_Request *result_send_reqs = (MPI_Request*) malloc(my_rows * sizeof(MPI_Request));
-            int send_req_count = 0;
-            for (int i = 0; i < N; i++) {
-                if (i % world_size == world_rank) {
-                    // 計算結果をノンブロッキング送信
-                    MPI_Isend(&my_results[send_req_count], 1, MPI_DOUBLE, 0, i, MPI_COMM_WORLD, &result_send_reqs[send_req_count]);
-                    send_req_count++;
-                }
+        // --- rank 0 が全体を読んで配る ---
+        if (world_rank == 0) {
+            // ファイルを1回だけ並列に走査して, 次元とデータを同時に取得
+            TextMatrix mt, vt;
+            t0 = MPI_Wtime();
+            text_parse(matrix_filename, &mt);
+            text_parse(vector_filename, &vt);
+            st.io += MPI_Wtime() - t0;
+            N = mt.rows;
+            M = mt.cols;
+            int vec_dim = vt.rows * vt.cols;
+
+            if (M != vec_dim) {
+                 fprintf(stderr, "エラー: 行列とベクトルの次元が非互換です。 (M=%d, vec_dim=%d)\n", M, vec_dim);
+                 MPI_Abort(MPI_COMM_WORLD, 1);
             }
-            // 送信完了を待つ
-            MPI_Waitall(my_rows, result_send_reqs, MPI_STATUSES_IGNORE);
-            free(result_send_reqs);
+
+            matrix = mt.val;
+            vector = vt.val;
+
+            if (!timing) {
+                print_matrix("読み込み行列:", N, M, matrix);
+                print_vector("読み込みベクトル:", M, vector);
+            }
+
+            result_vector = (double *)malloc(N * sizeof(double));
+        }
+
+        // 全プロセスに次元をブロードキャスト (-t ではファイルの読み込みを待つ時間を通信に含めないよう揃えてから測る)
+        if (timing) MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&M, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        st.comm += MPI_Wtime() - t0;
+
+        dist_create(&d, N, M, nb, use_grid);
+        dist_scatter_vector(&d, vector, &st);
+        if (streaming) dist_stream(&d, matrix, result_vector, &st);
+        else dist_scatter_matrix(&d, matrix, &st);
+        if (world_rank == 0) {
+            free(matrix);
+            free(vector);
+        }
+    }
+    st.rows = d.rows;
+    st.cols = d.cols;
+
+    double *latency = NULL, lambda = 0.0;
+    if (iters > 0) {
+        // --- 反復: 行列は配ったまま, ベクトルの部分だけを永続的な送受信で交換する ---
+        if (N != M) {
+            if (world_rank == 0) fprintf(stderr, "エラー: -n は正方行列にしか使えません。 (N=%d, M=%d)\n", N, M);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        latency = (double *)malloc(iters * sizeof(double));
+        dist_iterate(&d, iters, result_vector, &lambda, latency, &st);
+        if (world_rank == 0) {
+            double sum = 0.0, lmin = latency[0], lmax = latency[0];
+            for (int k = 0; k < iters; k++) {
+                sum += latency[k];
+                if (latency[k] < lmin) lmin = latency[k];
+                if (latency[k] > lmax) lmax = latency[k];
+            }
+            if (!timing) print_vector("反復後のベクトル:", N, result_vector);
+            printf("||A x|| (絶対値最大の固有値の推定): %.10g\n", lambda);
+            printf("反復 %d 回, 1回あたり 平均 %.3f マイクロ秒 (最小 %.3f, 最大 %.3f)\n", iters,
+                   sum / iters * 1e6, lmin * 1e6, lmax * 1e6);
         }
+        free(latency);
+    } else {
+        if (!streaming) dist_matvec(&d, result_vector, &st);
+        if (world_rank == 0 && !timing) print_vector("計算結果ベクトル:", N, result_vector);
     }
 
-    // rank 0 で行列送信の完了を待つ
-    if (world_rank == 0 && N > my_rows) {
-        MPI_Waitall(N - my_rows, send_requests, MPI_STATUSES_IGNORE);
-        free(send_requests);
+    // --- 時間の表示 (-t): rank ごとの小行列の大きさと, 入力, 通信 (Bcast, Scatterv, Gatherv など), 計算 (gemv) の時間,
+    //     最大常駐メモリ (並列入力なら rank 0 も含めてどの rank も行列の約 1/p) ---
+    if (timing) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        double mine[7] = { st.io, st.comm, st.comp, st.pack, st.rows, st.cols, ru.ru_maxrss / 1024.0 }, *all = NULL;
+        if (world_rank == 0) all = (double *)malloc(7 * world_size * sizeof(double));
+        MPI_Gather(mine, 7, MPI_DOUBLE, all, 7, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if (world_rank == 0) {
+            if (use_grid) printf("N = %d, M = %d, プロセス数 %d, 2次元プロセス格子", N, M, world_size);
+            else printf("N = %d, M = %d, プロセス数 %d, ブロック %d 行%s", N, M, world_size, nb, streaming ? ", ストリーミング" : "");
+            printf(", %s\n", parallel_io ? "並列入力" : "rank 0 が入力");
+            printf("%6s %14s %12s %12s %12s %12s\n", "rank", "行 x 列", "入力 (秒)", "通信 (秒)", "計算 (秒)", "メモリ (MB)");
+            for (int r = 0; r < world_size; r++) {
+                double *a = all + 7 * r;
+                printf("%6d %6d x %-6d %12.6f %12.6f %12.6f %12.1f\n", r, (int)a[4], (int)a[5], a[0], a[1], a[2], a[6]);
+            }
+            if (!use_grid && !parallel_io && !streaming) printf("rank 0 の並べ替え %.6f 秒\n", all[3]);
+            free(all);
+        }
     }
 
     // --- メモリ解放 ---
     if (world_rank == 0) {
-        free(matrix);
         free(result_vector);
     }
-    free(vector);
-    free(my_matrix_part);
-    free(my_results);
-    free(recv_requests);
+    dist_free(&d);
 
     MPI_Finalize();
     return 0;